@@ -1,6 +1,9 @@
 #include "arm.h"
 
+#include <string.h>
+
 #include "arm_core.h"
+#include "thumb.h"
 
 ArmInstrFormat arm_lookup[1 << 8][1 << 4];
 
@@ -139,6 +142,141 @@ void arm_exec_instr(ArmCore* cpu) {
     func_lookup[instr.dechi][instr.declo](cpu, instr);
 }
 
+static bool ends_block(ArmInstr instr) {
+    switch (arm_lookup[instr.dechi][instr.declo]) {
+        case ARM_BRANCH:
+        case ARM_BRANCHEX:
+        case ARM_SWINTR:
+        case ARM_UNDEFINED:
+        case ARM_CPREGTRANS:
+        case ARM_PSRTRANS:
+            return true;
+        case ARM_DATAPROC:
+        case ARM_MOV:
+            return instr.data_proc.rd == 15;
+        case ARM_SINGLETRANS:
+            return instr.single_trans.l && instr.single_trans.rd == 15;
+        case ARM_HALFTRANS:
+            return instr.half_trans.l && instr.half_trans.rd == 15;
+        case ARM_BLOCKTRANS:
+            return instr.block_trans.l && (instr.block_trans.rlist & (1 << 15));
+        default:
+            return false;
+    }
+}
+
+static bool is_idle_loop(ArmBlock* block) {
+    u32 isz = block->thumb ? 2 : 4;
+    ArmInstr last = block->instrs[block->len - 1];
+    if (block->funcs[block->len - 1] != exec_arm_branch || last.branch.l ||
+        last.cond == 0xf)
+        return false;
+    s32 offset = (s32) (last.branch.offset << 8) >> 8;
+    if ((block->len + 1) * isz + offset * isz != 0) return false;
+
+    for (u32 i = 0; i < block->len - 1; i++) {
+        ArmInstr instr = block->instrs[i];
+        ArmExecFunc func = block->funcs[i];
+        if (func == exec_arm_data_proc || func == exec_arm_mov) continue;
+        if (func == exec_arm_single_trans && instr.single_trans.l &&
+            instr.single_trans.p && !instr.single_trans.w)
+            continue;
+        if (func == exec_arm_half_trans && instr.half_trans.l &&
+            instr.half_trans.p && !instr.half_trans.w)
+            continue;
+        return false;
+    }
+    return true;
+}
+
+static void arm_decode_block(ArmCore* cpu, ArmBlock* block, u32 addr,
+                             u32* page) {
+    int cycles = cpu->cycles;
+    u32 isz = cpu->cpsr.t ? 2 : 4;
+    block->start = addr;
+    block->thumb = cpu->cpsr.t;
+    block->page = page;
+    block->gen = *page;
+    block->code = NULL;
+    block->len = 0;
+    u32 n = 0;
+    bool end = false;
+    while (n < block->len + 2 && !((addr ^ block->start) >> BLOCKPAGEBITS)) {
+        ArmInstr instr;
+        if (block->thumb) instr = thumb_lookup[cpu->fetch16(cpu, addr)];
+        else instr.w = cpu->fetch32(cpu, addr);
+        block->instrs[n] = instr;
+        block->funcs[n] = func_lookup[instr.dechi][instr.declo];
+        n++;
+        addr += isz;
+        if (!end) {
+            block->len = n;
+            end = n == BLOCKMAX || ends_block(instr);
+        }
+    }
+    block->size = n * isz;
+    block->idle = is_idle_loop(block);
+    cpu->cycles = cycles;
+}
+
+ArmBlock* arm_get_block(ArmCore* cpu, u32 addr) {
+    u32* page = cpu->code_page(cpu, addr);
+    if (!page) return NULL;
+
+    ArmBlock* block =
+        &cpu->blocks[(addr >> (cpu->cpsr.t ? 1 : 2)) % BLOCKCACHESIZE];
+    if (block->start != addr || block->thumb != cpu->cpsr.t ||
+        block->page != page || block->gen != *page) {
+        arm_decode_block(cpu, block, addr, page);
+    }
+    return block;
+}
+
+void arm_exec_block(ArmCore* cpu) {
+    u32 addr = cpu->cur_instr_addr;
+    ArmBlock* block = arm_get_block(cpu, addr);
+    if (!block) {
+        arm_exec_instr(cpu);
+        return;
+    }
+
+    u32 start = addr;
+    u32 isz = block->thumb ? 2 : 4;
+    cpu->block = block;
+    for (u32 i = 0; i < block->len; i++) {
+        ArmInstr instr = block->instrs[i];
+
+#ifdef CPULOG
+        cpu->log[cpu->log_idx].addr = cpu->cur_instr_addr;
+        cpu->log[cpu->log_idx].instr = instr;
+        cpu->log_idx = (cpu->log_idx + 1) % LOGMAX;
+#endif
+
+        int cycles = cpu->cycles;
+        if (eval_cond(cpu, instr)) block->funcs[i](cpu, instr);
+        else cpu_fetch_instr(cpu);
+        if (cpu->cycles == cycles) cpu->cycles++;
+
+        addr += isz;
+        if (cpu->block != block || cpu->cur_instr_addr != addr ||
+            cpu->cpsr.t != block->thumb || block->gen != *block->page)
+            break;
+    }
+    cpu->block = NULL;
+    if (block->idle) arm_check_idle(cpu, start);
+}
+
+void arm_check_idle(ArmCore* cpu, u32 start) {
+    if (cpu->cur_instr_addr != start) return;
+    if (cpu->idle_addr == start && cpu->idle_cpsr == cpu->cpsr.w &&
+        !memcmp(cpu->idle_r, cpu->r, sizeof cpu->r)) {
+        cpu->idle = true;
+    }
+    cpu->idle_addr = start;
+    cpu->idle_cpsr = cpu->cpsr.w;
+    memcpy(cpu->idle_r, cpu->r, sizeof cpu->r);
+}
+
 static u32 arm_shifter(ArmCore* cpu, u8 shift, u32 operand, u32* carry) {
     u32 shift_type = (shift >> 1) & 0b11;
     u32 shift_amt = shift >> 3;
@@ -921,6 +1059,10 @@ void exec_arm_cp_reg_trans(ArmCore* cpu, ArmInstr instr) {
 }
 
 void exec_arm_sw_intr(ArmCore* cpu, ArmInstr instr) {
+    if (cpu->hle_swi) {
+        u32 num = cpu->cpsr.t ? instr.sw_intr.arg : instr.sw_intr.arg >> 16;
+        if (cpu->hle_swi(cpu, num & 0xff)) return;
+    }
     cpu_handle_interrupt(cpu, I_SWI);
 }
 
@@ -4,7 +4,15 @@
 
 void cpu_fetch_instr(ArmCore* cpu) {
     cpu->cur_instr = cpu->next_instr;
-    if (cpu->cpsr.t) {
+    if (cpu->block && cpu->pc - cpu->block->start < cpu->block->size) {
+        u32 isz = cpu->block->thumb ? 2 : 4;
+        cpu->next_instr =
+            cpu->block->instrs[(cpu->pc - cpu->block->start) / isz];
+        cpu->cycles += cpu->fetch_cycles;
+        cpu->cur_instr_addr += isz;
+        cpu->next_instr_addr += isz;
+        cpu->pc += isz;
+    } else if (cpu->cpsr.t) {
         cpu->next_instr = thumb_lookup[cpu->fetch16(cpu, cpu->pc)];
         cpu->cur_instr_addr += 2;
         cpu->next_instr_addr += 2;
@@ -18,6 +26,20 @@ void cpu_fetch_instr(ArmCore* cpu) {
 }
 
 void cpu_flush(ArmCore* cpu) {
+    if (cpu->block) {
+        u32 isz = cpu->cpsr.t ? 2 : 4;
+        cpu->pc &= ~(isz - 1);
+        ArmBlock* block = arm_get_block(cpu, cpu->pc);
+        if (block && block->size >= 2 * isz) {
+            cpu->cur_instr_addr = cpu->pc;
+            cpu->cur_instr = block->instrs[0];
+            cpu->next_instr_addr = cpu->pc + isz;
+            cpu->next_instr = block->instrs[1];
+            cpu->pc += 2 * isz;
+            cpu->cycles += 2 * cpu->fetch_cycles;
+            return;
+        }
+    }
     if (cpu->cpsr.t) {
         cpu->pc &= ~1;
         cpu->cur_instr_addr = cpu->pc;
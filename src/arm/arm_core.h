@@ -28,7 +28,42 @@ typedef enum {
     I_FIQ
 } CpuInterrupt;
 
+typedef enum { CPU_INTERP, CPU_CACHED, CPU_JIT } CpuBackend;
+
+#define BLOCKMAX 32
+#define BLOCKCACHESIZE (1 << 12)
+#define BLOCKPAGEBITS 8
+
+#define PAGEBITS 12
+#define PAGESIZE (1 << PAGEBITS)
+#define PAGETABLESIZE (1 << (28 - PAGEBITS))
+
+#define PT_PAGE(table, addr)                                                   \
+    ((addr) >> 28 ? NULL : (table)[(addr) >> PAGEBITS])
+
+typedef struct {
+    u8* read[PAGETABLESIZE];
+    u8* write[PAGETABLESIZE];
+    u32* gen[PAGETABLESIZE];
+    u32 nogen[PAGESIZE >> BLOCKPAGEBITS];
+} PageTable;
+
 typedef struct _ArmCore ArmCore;
+typedef struct _JitState JitState;
+
+typedef struct {
+    u32 start;
+    u32 size;
+    u32 len;
+    bool thumb;
+    u32* page;
+    u32 gen;
+    bool idle;
+    ArmExecFunc funcs[BLOCKMAX + 2];
+    ArmInstr instrs[BLOCKMAX + 2];
+    void (*code)(ArmCore* cpu);
+    u32 code_epoch;
+} ArmBlock;
 
 typedef struct _ArmCore {
     union {
@@ -82,13 +117,28 @@ typedef struct _ArmCore {
     u32 (*cp15_read)(ArmCore* cpu, u32 cn, u32 cm, u32 cp);
     void (*cp15_write)(ArmCore* cpu, u32 cn, u32 cm, u32 cp, u32 data);
 
+    u32* (*code_page)(ArmCore* cpu, u32 addr);
+
+    bool (*hle_swi)(ArmCore* cpu, u32 num);
+    bool hle_wait;
+
     bool v5;
     u32 vector_base;
 
     int cycles;
+    int fetch_cycles;
 
     bool irq;
 
+    ArmBlock* block;
+    ArmBlock blocks[BLOCKCACHESIZE];
+    JitState* jit;
+
+    bool idle;
+    u32 idle_addr;
+    u32 idle_r[16];
+    u32 idle_cpsr;
+
 #ifdef CPULOG
 #define LOGMAX (1 << 15)
     struct {
@@ -100,6 +150,10 @@ typedef struct _ArmCore {
 
 } ArmCore;
 
+ArmBlock* arm_get_block(ArmCore* cpu, u32 addr);
+void arm_exec_block(ArmCore* cpu);
+void arm_check_idle(ArmCore* cpu, u32 start);
+
 void cpu_fetch_instr(ArmCore* cpu);
 void cpu_flush(ArmCore* cpu);
 
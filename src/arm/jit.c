@@ -0,0 +1,660 @@
+#include "jit.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <sys/mman.h>
+
+#define CPUOFF(f) ((u32) offsetof(ArmCore, f))
+#define BLOCKOFF(f) ((u32) offsetof(ArmBlock, f))
+#define REGOFF(n) (CPUOFF(r) + 4 * (n))
+
+#define HOSTPAGE 4096
+#define NOSYNC ((u32) -1)
+
+enum { EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+
+enum { CARRY_KEEP, CARRY_CLEAR, CARRY_SET, CARRY_ESI };
+
+static void emit8(JitState* j, u8 b) {
+    *j->code_ptr++ = b;
+}
+
+static void emit32(JitState* j, u32 w) {
+    memcpy(j->code_ptr, &w, 4);
+    j->code_ptr += 4;
+}
+
+static void emit64(JitState* j, u64 d) {
+    memcpy(j->code_ptr, &d, 8);
+    j->code_ptr += 8;
+}
+
+static void emit_bytes(JitState* j, const char* s, int n) {
+    memcpy(j->code_ptr, s, n);
+    j->code_ptr += n;
+}
+
+// op reg, [rbx + off]
+static void emit_mem(JitState* j, u8 op, u8 reg, u32 off) {
+    emit8(j, op);
+    emit8(j, 0x83 | reg << 3);
+    emit32(j, off);
+}
+
+// mov dword [rbx + off], imm
+static void emit_store_imm(JitState* j, u32 off, u32 imm) {
+    emit_bytes(j, "\xc7\x83", 2);
+    emit32(j, off);
+    emit32(j, imm);
+}
+
+static void emit_add_cycles(JitState* j, u32 n) {
+    if (!n) return;
+    // add dword [rbx + cycles], n
+    emit_bytes(j, "\x81\x83", 2);
+    emit32(j, CPUOFF(cycles));
+    emit32(j, n);
+}
+
+static u8* emit_jcc(JitState* j, u8 cc) {
+    emit8(j, 0x0f);
+    emit8(j, 0x80 | cc);
+    emit32(j, 0);
+    return j->code_ptr;
+}
+
+static void patch_rel(u8* src, u8* dst) {
+    u32 rel = dst - src;
+    memcpy(src - 4, &rel, 4);
+}
+
+static void patch_jcc(JitState* j, u8* src) {
+    patch_rel(src, j->code_ptr);
+}
+
+static void emit_call(JitState* j, void* func) {
+    // mov rax, func; call rax
+    emit_bytes(j, "\x48\xb8", 2);
+    emit64(j, (u64) func);
+    emit_bytes(j, "\xff\xd0", 2);
+}
+
+static void emit_call_cpu(JitState* j, u32 off) {
+    // mov rdi, rbx; call [rbx + off]
+    emit_bytes(j, "\x48\x89\xdf\xff\x93", 5);
+    emit32(j, off);
+}
+
+static void emit_load_cpsr(JitState* j) {
+    emit_mem(j, 0x8b, EAX, CPUOFF(cpsr));
+}
+
+static void emit_nv_to_ecx(JitState* j) {
+    // mov ecx, eax; shr ecx, 3; xor ecx, eax; and ecx, 1 << 28
+    emit_bytes(j, "\x89\xc1\xc1\xe9\x03\x31\xc1\x81\xe1", 9);
+    emit32(j, 1 << 28);
+}
+
+#define JZ 0x4
+#define JNZ 0x5
+
+static u8* emit_cond(JitState* j, u32 cond) {
+    static const u32 flag[] = {1 << 30, 1 << 29, 1 << 31, 1 << 28};
+    if (cond < C_HI) {
+        // test dword [rbx + cpsr], flag
+        emit_bytes(j, "\xf7\x83", 2);
+        emit32(j, CPUOFF(cpsr));
+        emit32(j, flag[cond >> 1]);
+        return emit_jcc(j, (cond & 1) ? JNZ : JZ);
+    }
+    emit_load_cpsr(j);
+    switch (cond) {
+        case C_HI:
+        case C_LS:
+            // and eax, c | z; cmp eax, c
+            emit8(j, 0x25);
+            emit32(j, 3 << 29);
+            emit8(j, 0x3d);
+            emit32(j, 1 << 29);
+            return emit_jcc(j, cond == C_HI ? JNZ : JZ);
+        case C_GE:
+        case C_LT:
+            emit_nv_to_ecx(j);
+            return emit_jcc(j, cond == C_GE ? JNZ : JZ);
+        case C_GT:
+        case C_LE:
+            emit_nv_to_ecx(j);
+            // and eax, z; or ecx, eax
+            emit8(j, 0x25);
+            emit32(j, 1 << 30);
+            emit_bytes(j, "\x09\xc1", 2);
+            return emit_jcc(j, cond == C_GT ? JNZ : JZ);
+    }
+    return NULL;
+}
+
+// stores the fetch state the interpreter has on entry to instruction idx
+static void emit_sync(JitState* j, u32 idx, u32 cycles) {
+    ArmBlock* block = j->block;
+    u32 isz = block->thumb ? 2 : 4;
+    u32 addr = block->start + idx * isz;
+    emit_store_imm(j, CPUOFF(cur_instr), block->instrs[idx].w);
+    emit_store_imm(j, CPUOFF(next_instr), block->instrs[idx + 1].w);
+    emit_store_imm(j, CPUOFF(cur_instr_addr), addr);
+    emit_store_imm(j, CPUOFF(next_instr_addr), addr + isz);
+    emit_store_imm(j, CPUOFF(pc), addr + 2 * isz);
+    emit_add_cycles(j, cycles);
+}
+
+static void sync_state(JitState* j, u32 idx) {
+    if (j->synced == idx) return;
+    emit_sync(j, idx, j->pending);
+    j->synced = idx;
+    j->pending = 0;
+}
+
+static void emit_exit_jcc(JitState* j, u8 cc, u32 idx) {
+    JitExit* e = &j->exits[j->nexits++];
+    e->src = emit_jcc(j, cc) - j->buf;
+    e->idx = j->synced == idx ? NOSYNC : idx;
+    e->cycles = j->pending;
+}
+
+static bool writes_memory(ArmExecFunc func, ArmInstr instr) {
+    if (func == exec_arm_swap) return true;
+    if (func == exec_arm_single_trans) return !instr.single_trans.l;
+    if (func == exec_arm_half_trans) return !instr.half_trans.l;
+    if (func == exec_arm_block_trans) return !instr.block_trans.l;
+    return false;
+}
+
+// immediate shifts by #0 other than LSL stand for #32 and RRX
+static bool simple_shift(u32 shift) {
+    return (shift >> 3) || !(shift & 0b110);
+}
+
+static bool native_data_proc(ArmInstr instr) {
+    u32 op = instr.data_proc.opcode;
+    if (instr.data_proc.rd == 15) return false;
+    if (op != A_MOV && op != A_MVN && instr.data_proc.rn == 15) return false;
+    if (instr.data_proc.i) return true;
+    u32 shift = instr.data_proc.op2 >> 4;
+    if ((instr.data_proc.op2 & 0xf) == 15 || (shift & 1)) return false;
+    return simple_shift(shift);
+}
+
+static bool native_single_trans(ArmInstr instr) {
+    if (instr.single_trans.rn == 15 || instr.single_trans.rd == 15)
+        return false;
+    if (!instr.single_trans.i) return true;
+    if ((instr.single_trans.offset & 0xf) == 15) return false;
+    return simple_shift(instr.single_trans.offset >> 4);
+}
+
+static bool native_branch(ArmBlock* block, ArmInstr instr) {
+    return instr.cond != 0xf && !(block->thumb && instr.branch.l);
+}
+
+static bool is_native(ArmBlock* block, u32 i) {
+#ifdef CPULOG
+    return false;
+#endif
+    ArmInstr instr = block->instrs[i];
+    ArmExecFunc func = block->funcs[i];
+    u32 isz = block->thumb ? 2 : 4;
+    if (instr.cond == 0xf || i + 2 >= block->size / isz) return false;
+    if (func == exec_arm_data_proc || func == exec_arm_mov)
+        return native_data_proc(instr);
+    if (func == exec_arm_single_trans) return native_single_trans(instr);
+    return false;
+}
+
+// shifts edx by an immediate, leaving the shifter carry in esi
+static int emit_shift_imm(JitState* j, u32 shift) {
+    static const u8 ext[] = {4, 5, 7, 1};
+    u32 amt = shift >> 3;
+    if (!amt) return CARRY_KEEP;
+    // shl/shr/sar/ror edx, amt; sbb esi, esi
+    emit8(j, 0xc1);
+    emit8(j, 0xc0 | ext[(shift >> 1) & 0b11] << 3 | EDX);
+    emit8(j, amt);
+    emit_bytes(j, "\x19\xf6", 2);
+    return CARRY_ESI;
+}
+
+static int emit_shifter(JitState* j, ArmInstr instr) {
+    u32 op2 = instr.data_proc.op2;
+    if (!instr.data_proc.i) {
+        emit_mem(j, 0x8b, EDX, REGOFF(op2 & 0xf));
+        return emit_shift_imm(j, op2 >> 4);
+    }
+    u32 rot = 0;
+    if (!j->block->thumb) {
+        rot = (op2 >> 8) * 2;
+        op2 &= 0xff;
+        if (rot) op2 = (op2 >> rot) | (op2 << (32 - rot));
+    }
+    // mov edx, op2
+    emit8(j, 0xba);
+    emit32(j, op2);
+    if (!rot) return CARRY_KEEP;
+    return op2 >> 31 ? CARRY_SET : CARRY_CLEAR;
+}
+
+static void emit_data_proc(JitState* j, ArmInstr instr) {
+    u32 op = instr.data_proc.opcode;
+    bool test = op >= A_TST && op <= A_CMN;
+    if (test && !instr.data_proc.s) return;
+
+    int carry = emit_shifter(j, instr);
+    if (op != A_MOV && op != A_MVN)
+        emit_mem(j, 0x8b, EAX, REGOFF(instr.data_proc.rn));
+    if (op == A_ADC || op == A_SBC || op == A_RSC) {
+        // bt dword [rbx + cpsr], 29
+        emit_bytes(j, "\x0f\xba\xa3", 3);
+        emit32(j, CPUOFF(cpsr));
+        emit8(j, 29);
+        // cmc
+        if (op != A_ADC) emit8(j, 0xf5);
+    }
+    // the x86 op leaves the result in eax
+    switch (op) {
+        case A_AND:
+        case A_TST:
+            emit_bytes(j, "\x21\xd0", 2);
+            break;
+        case A_EOR:
+        case A_TEQ:
+            emit_bytes(j, "\x31\xd0", 2);
+            break;
+        case A_SUB:
+        case A_CMP:
+            emit_bytes(j, "\x29\xd0", 2);
+            break;
+        case A_RSB:
+            // sub edx, eax; mov eax, edx
+            emit_bytes(j, "\x29\xc2\x89\xd0", 4);
+            break;
+        case A_ADD:
+        case A_CMN:
+            emit_bytes(j, "\x01\xd0", 2);
+            break;
+        case A_ADC:
+            emit_bytes(j, "\x11\xd0", 2);
+            break;
+        case A_SBC:
+            emit_bytes(j, "\x19\xd0", 2);
+            break;
+        case A_RSC:
+            // sbb edx, eax; mov eax, edx
+            emit_bytes(j, "\x19\xc2\x89\xd0", 4);
+            break;
+        case A_ORR:
+            emit_bytes(j, "\x09\xd0", 2);
+            break;
+        case A_MOV:
+            emit_bytes(j, "\x89\xd0", 2);
+            break;
+        case A_BIC:
+            // not edx; and eax, edx
+            emit_bytes(j, "\xf7\xd2\x21\xd0", 4);
+            break;
+        case A_MVN:
+            // not edx; mov eax, edx
+            emit_bytes(j, "\xf7\xd2\x89\xd0", 4);
+            break;
+    }
+    if (!test) emit_mem(j, 0x89, EAX, REGOFF(instr.data_proc.rd));
+    if (!instr.data_proc.s) return;
+
+    bool arith = (op >= A_SUB && op <= A_RSC) || op == A_CMP || op == A_CMN;
+    u32 mask = 3u << 30;
+    if (arith) {
+        // pushfq; pop rcx; mov eax, ecx; mov edx, ecx
+        emit_bytes(j, "\x9c\x59\x89\xc8\x89\xca", 6);
+        // and ecx, sf | zf; shl ecx, 24; and eax, cf; shl eax, 29
+        emit_bytes(j, "\x81\xe1", 2);
+        emit32(j, 0xc0);
+        emit_bytes(j, "\xc1\xe1\x18\x83\xe0\x01\xc1\xe0\x1d", 9);
+        // arm subtraction sets c when there is no borrow
+        if (op != A_ADD && op != A_ADC && op != A_CMN) {
+            // xor eax, 1 << 29
+            emit8(j, 0x35);
+            emit32(j, 1 << 29);
+        }
+        // and edx, of; shl edx, 17; or ecx, eax; or ecx, edx
+        emit_bytes(j, "\x81\xe2", 2);
+        emit32(j, 0x800);
+        emit_bytes(j, "\xc1\xe2\x11\x09\xc1\x09\xd1", 7);
+        mask = 0xfu << 28;
+    } else {
+        // test eax, eax; pushfq; pop rcx; and ecx, sf | zf; shl ecx, 24
+        emit_bytes(j, "\x85\xc0\x9c\x59\x81\xe1", 6);
+        emit32(j, 0xc0);
+        emit_bytes(j, "\xc1\xe1\x18", 3);
+        if (carry == CARRY_ESI) {
+            // and esi, 1 << 29; or ecx, esi
+            emit_bytes(j, "\x81\xe6", 2);
+            emit32(j, 1 << 29);
+            emit_bytes(j, "\x09\xf1", 2);
+        } else if (carry == CARRY_SET) {
+            // or ecx, 1 << 29
+            emit_bytes(j, "\x81\xc9", 2);
+            emit32(j, 1 << 29);
+        }
+        if (carry != CARRY_KEEP) mask |= 1 << 29;
+    }
+    // and dword [rbx + cpsr], ~mask; or [rbx + cpsr], ecx
+    emit_bytes(j, "\x81\xa3", 2);
+    emit32(j, CPUOFF(cpsr));
+    emit32(j, ~mask);
+    emit_mem(j, 0x09, ECX, CPUOFF(cpsr));
+}
+
+static void emit_single_trans(JitState* j, ArmInstr instr) {
+    u32 rn = instr.single_trans.rn;
+    u32 rd = instr.single_trans.rd;
+    if (instr.single_trans.i) {
+        emit_mem(j, 0x8b, EDX, REGOFF(instr.single_trans.offset & 0xf));
+        emit_shift_imm(j, instr.single_trans.offset >> 4);
+        // neg edx
+        if (!instr.single_trans.u) emit_bytes(j, "\xf7\xda", 2);
+    } else {
+        u32 offset = instr.single_trans.offset;
+        // mov edx, offset
+        emit8(j, 0xba);
+        emit32(j, instr.single_trans.u ? offset : -offset);
+    }
+    // mov eax, [rn]; lea ecx, [rax + rdx]; mov esi, ecx or eax
+    emit_mem(j, 0x8b, EAX, REGOFF(rn));
+    emit_bytes(j, "\x8d\x0c\x10", 3);
+    emit_bytes(j, instr.single_trans.p ? "\x89\xce" : "\x89\xc6", 2);
+
+    bool wback = instr.single_trans.w || !instr.single_trans.p;
+    if (instr.single_trans.l) {
+        if (wback) emit_mem(j, 0x89, ECX, REGOFF(rn));
+        if (instr.single_trans.b) {
+            // xor edx, edx
+            emit_bytes(j, "\x31\xd2", 2);
+            emit_call_cpu(j, CPUOFF(read8));
+        } else {
+            emit_call_cpu(j, CPUOFF(read32));
+        }
+        emit_mem(j, 0x89, EAX, REGOFF(rd));
+    } else {
+        emit_mem(j, 0x8b, EDX, REGOFF(rd));
+        if (wback) emit_mem(j, 0x89, ECX, REGOFF(rn));
+        if (instr.single_trans.b) {
+            // movzx edx, dl
+            emit_bytes(j, "\x0f\xb6\xd2", 3);
+            emit_call_cpu(j, CPUOFF(write8));
+        } else {
+            emit_call_cpu(j, CPUOFF(write32));
+        }
+    }
+}
+
+static void emit_branch(JitState* j, ArmCore* cpu, u32 i) {
+    ArmBlock* block = j->block;
+    ArmInstr instr = block->instrs[i];
+    u32 isz = block->thumb ? 2 : 4;
+    u32 pc = block->start + (i + 2) * isz;
+    u32 offset = (s32) (instr.branch.offset << 8) >> 8;
+    offset *= isz;
+    if (instr.branch.l) {
+        emit_store_imm(j, CPUOFF(lr), pc - 4);
+        emit_add_cycles(j, cpu->fetch_cycles);
+    }
+    emit_store_imm(j, CPUOFF(pc), pc + offset);
+    // mov rdi, rbx
+    emit_bytes(j, "\x48\x89\xdf", 3);
+    emit_call(j, cpu_flush);
+}
+
+#ifdef CPULOG
+static void jit_log(ArmCore* cpu, ArmInstr instr) {
+    cpu->log[cpu->log_idx].addr = cpu->cur_instr_addr;
+    cpu->log[cpu->log_idx].instr = instr;
+    cpu->log_idx = (cpu->log_idx + 1) % LOGMAX;
+}
+#endif
+
+// instructions without a native translation call their handler with the
+// fetch state written back
+static void emit_call_instr(JitState* j, ArmCore* cpu, u32 i) {
+    ArmBlock* block = j->block;
+    ArmInstr instr = block->instrs[i];
+    bool branch = block->funcs[i] == exec_arm_branch &&
+                  native_branch(block, instr);
+
+    // a taken branch refetches everything but the cycle count
+    if (branch && instr.cond == C_AL) {
+        emit_add_cycles(j, j->pending);
+        j->pending = 0;
+    } else {
+        sync_state(j, i);
+    }
+
+#ifdef CPULOG
+    // mov rdi, rbx; mov esi, instr
+    emit_bytes(j, "\x48\x89\xdf\xbe", 4);
+    emit32(j, instr.w);
+    emit_call(j, jit_log);
+#endif
+
+    if (!cpu->fetch_cycles) {
+        // mov r12d, [rbx + cycles]
+        emit_bytes(j, "\x44\x8b\xa3", 3);
+        emit32(j, CPUOFF(cycles));
+    }
+
+    u8* skip = NULL;
+    if (instr.cond < C_AL) skip = emit_cond(j, instr.cond);
+    if (branch) {
+        emit_branch(j, cpu, i);
+    } else {
+        emit_bytes(j, "\x48\x89\xdf\xbe", 4);
+        emit32(j, instr.w);
+        emit_call(j, block->funcs[i]);
+    }
+    if (skip) {
+        // jmp done
+        emit8(j, 0xe9);
+        emit32(j, 0);
+        u8* done = j->code_ptr;
+        patch_jcc(j, skip);
+        emit_bytes(j, "\x48\x89\xdf", 3);
+        emit_call(j, cpu_fetch_instr);
+        patch_jcc(j, done);
+    }
+
+    if (!cpu->fetch_cycles) {
+        // cmp [rbx + cycles], r12d; jne +7; add dword [rbx + cycles], 1
+        emit_bytes(j, "\x44\x39\xa3", 3);
+        emit32(j, CPUOFF(cycles));
+        emit_bytes(j, "\x75\x07\x83\x83", 4);
+        emit32(j, CPUOFF(cycles));
+        emit8(j, 1);
+    }
+    j->synced = i + 1;
+
+    // handlers that raise an exception or write pc leave the block
+    if (i + 1 < block->len) {
+        u32 isz = block->thumb ? 2 : 4;
+        // cmp dword [rbx + pc], pc
+        emit_bytes(j, "\x81\xbb", 2);
+        emit32(j, CPUOFF(pc));
+        emit32(j, block->start + (i + 3) * isz);
+        emit_exit_jcc(j, JNZ, i + 1);
+    }
+}
+
+static void emit_instr(JitState* j, ArmCore* cpu, u32 i) {
+    ArmBlock* block = j->block;
+    ArmInstr instr = block->instrs[i];
+    ArmExecFunc func = block->funcs[i];
+
+    if (is_native(block, i)) {
+        u8* skip = NULL;
+        if (instr.cond < C_AL) skip = emit_cond(j, instr.cond);
+        if (func == exec_arm_single_trans) {
+            emit_single_trans(j, instr);
+            j->pending += cpu->fetch_cycles;
+        } else {
+            emit_data_proc(j, instr);
+            // the core charges a cycle for instructions that take none
+            j->pending += cpu->fetch_cycles ? cpu->fetch_cycles : 1;
+        }
+        if (skip && func == exec_arm_single_trans && !cpu->fetch_cycles) {
+            // a skipped transfer still takes the core's minimum cycle
+            emit8(j, 0xe9);
+            emit32(j, 0);
+            u8* done = j->code_ptr;
+            patch_jcc(j, skip);
+            emit_add_cycles(j, 1);
+            patch_jcc(j, done);
+        } else if (skip) {
+            patch_jcc(j, skip);
+        }
+    } else {
+        emit_call_instr(j, cpu, i);
+    }
+
+    if (i + 1 < block->len && writes_memory(func, instr)) {
+        // cmp [rbx + block], r13
+        emit_bytes(j, "\x4c\x39\xab", 3);
+        emit32(j, CPUOFF(block));
+        emit_exit_jcc(j, JNZ, i + 1);
+        // mov rax, [r13 + page]; mov eax, [rax]; cmp eax, [r13 + gen]
+        emit_bytes(j, "\x49\x8b\x85", 3);
+        emit32(j, BLOCKOFF(page));
+        emit_bytes(j, "\x8b\x00\x41\x3b\x85", 5);
+        emit32(j, BLOCKOFF(gen));
+        emit_exit_jcc(j, JNZ, i + 1);
+    }
+}
+
+static void (*jit_compile(ArmCore* cpu, ArmBlock* block))(ArmCore*) {
+    JitState* j = cpu->jit;
+    if (j->used + JITBLOCKMAX > JITBUFSIZE) {
+        j->used = 0;
+        j->epoch++;
+    }
+
+    // only the pages being emitted to are ever writable
+    u32 first = j->used & ~(HOSTPAGE - 1);
+    u32 last = (j->used + JITBLOCKMAX + HOSTPAGE - 1) & ~(HOSTPAGE - 1);
+    if (mprotect(j->buf + first, last - first, PROT_READ | PROT_WRITE))
+        return NULL;
+
+    j->code_ptr = j->buf + j->used;
+    j->block = block;
+    j->synced = 0;
+    j->pending = 0;
+    j->nexits = 0;
+    u8* entry = j->code_ptr;
+
+    // push rbx; push r12; push r13; mov rbx, rdi
+    emit_bytes(j, "\x53\x41\x54\x41\x55\x48\x89\xfb", 8);
+    // mov r13, block; mov [rbx + block], r13
+    emit_bytes(j, "\x49\xbd", 2);
+    emit64(j, (u64) block);
+    emit_bytes(j, "\x4c\x89\xab", 3);
+    emit32(j, CPUOFF(block));
+
+    for (u32 i = 0; i < block->len; i++) {
+        emit_instr(j, cpu, i);
+    }
+    sync_state(j, block->len);
+
+    u8* epilogue = j->code_ptr;
+    // mov qword [rbx + block], 0; pop r13; pop r12; pop rbx; ret
+    emit_bytes(j, "\x48\xc7\x83", 3);
+    emit32(j, CPUOFF(block));
+    emit32(j, 0);
+    emit_bytes(j, "\x41\x5d\x41\x5c\x5b\xc3", 6);
+
+    // exits taken with fetch state still pending get a stub that stores it
+    u8* stub = NULL;
+    for (u32 i = 0; i < j->nexits; i++) {
+        JitExit* e = &j->exits[i];
+        if (e->idx == NOSYNC) {
+            patch_rel(j->buf + e->src, epilogue);
+            continue;
+        }
+        if (!i || e->idx != j->exits[i - 1].idx) {
+            stub = j->code_ptr;
+            emit_sync(j, e->idx, e->cycles);
+            // jmp epilogue
+            emit8(j, 0xe9);
+            emit32(j, 0);
+            patch_rel(j->code_ptr, epilogue);
+        }
+        patch_rel(j->buf + e->src, stub);
+    }
+
+    mprotect(j->buf + first, last - first, PROT_READ | PROT_EXEC);
+    j->used = (j->code_ptr - j->buf + 15) & ~15;
+    block->code_epoch = j->epoch;
+    return (void (*)(ArmCore*)) entry;
+}
+
+JitState* jit_create() {
+    JitState* jit = calloc(1, sizeof *jit);
+    if (!jit) return NULL;
+    jit->buf = mmap(NULL, JITBUFSIZE, PROT_READ | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->buf == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    jit->epoch = 1;
+    return jit;
+}
+
+void jit_destroy(JitState* jit) {
+    if (!jit) return;
+    munmap(jit->buf, JITBUFSIZE);
+    free(jit);
+}
+
+void arm_exec_jit(ArmCore* cpu) {
+    // translated code assumes pc is two instructions ahead
+    u32 isz = cpu->cpsr.t ? 2 : 4;
+    if (!cpu->jit || cpu->pc != cpu->cur_instr_addr + 2 * isz) {
+        arm_exec_block(cpu);
+        return;
+    }
+    ArmBlock* block = arm_get_block(cpu, cpu->cur_instr_addr);
+    if (!block) {
+        arm_exec_instr(cpu);
+        return;
+    }
+    if (!block->code || block->code_epoch != cpu->jit->epoch) {
+        block->code = jit_compile(cpu, block);
+        if (!block->code) {
+            arm_exec_block(cpu);
+            return;
+        }
+    }
+    u32 start = block->start;
+    block->code(cpu);
+    if (block->idle) arm_check_idle(cpu, start);
+}
+
+#else
+
+JitState* jit_create() {
+    return NULL;
+}
+
+void jit_destroy(JitState* jit) {}
+
+void arm_exec_jit(ArmCore* cpu) {
+    arm_exec_block(cpu);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "arm_core.h"
+
+#define JITBUFSIZE (1 << 24)
+#define JITBLOCKMAX (BLOCKMAX << 9)
+
+typedef struct {
+    u32 src;
+    u32 idx;
+    u32 cycles;
+} JitExit;
+
+struct _JitState {
+    u8* buf;
+    u32 used;
+    u32 epoch;
+
+    u8* code_ptr;
+    ArmBlock* block;
+    // first instruction whose fetch state is not yet stored to the core, and
+    // the fetch cycles owed for the instructions before it
+    u32 synced;
+    u32 pending;
+    JitExit exits[3 * BLOCKMAX];
+    u32 nexits;
+};
+
+JitState* jit_create();
+void jit_destroy(JitState* jit);
+
+void arm_exec_jit(ArmCore* cpu);
+
+#endif
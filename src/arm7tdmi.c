@@ -4,7 +4,11 @@
 
 #include "arm/arm.h"
 #include "arm/arm_core.h"
+#include "arm/jit.h"
+#include "bios.h"
 #include "bus7.h"
+#include "emulator_state.h"
+#include "fastmem.h"
 #include "nds.h"
 #include "arm/thumb.h"
 #include "types.h"
@@ -21,27 +25,73 @@ void arm7_init(Arm7TDMI* cpu) {
     cpu->c.fetch32 = (void*) arm7_fetch32;
     cpu->c.cp15_read = NULL;
     cpu->c.cp15_write = NULL;
+    cpu->c.code_page = (void*) arm7_code_page;
+    if (ntremu.hle_bios) cpu->c.hle_swi = (void*) bios7_swi;
+
+    cpu->c.fetch_cycles = 1;
 }
 
-void arm7_step(Arm7TDMI* cpu) {
+bool arm7_step(Arm7TDMI* cpu) {
     cpu->c.cycles = 0;
     if (!cpu->c.cpsr.i && cpu->c.irq) {
         cpu_handle_interrupt((ArmCore*) cpu, I_IRQ);
-        return;
+        return true;
+    }
+    if (ntremu.cpu_backend == CPU_JIT) {
+        arm_exec_jit((ArmCore*) cpu);
+    } else if (ntremu.cpu_backend != CPU_INTERP) {
+        arm_exec_block((ArmCore*) cpu);
+    } else {
+        arm_exec_instr((ArmCore*) cpu);
     }
-    arm_exec_instr((ArmCore*) cpu);
+    if (cpu->c.idle) {
+        cpu->c.idle = false;
+        return false;
+    }
+    return true;
+}
+
+// IO must trap, PAL and OAM mirror every 2KB which a host page cannot alias,
+// the BIOS lives outside the NDS memfd, and nothing from 0x10000000 up is
+// mapped, so these would fault on every access and go straight to the slow
+// path instead
+#define FASTMEM_REGIONS                                                        \
+    (0xffff & ~(1 << R_BIOS7 | 1 << R_IO | 1 << R_PAL | 1 << R_OAM))
+
+static inline bool fastmem_region(u32 addr) {
+    if (addr >> 28 || !(FASTMEM_REGIONS >> (addr >> 24) & 1)) return false;
+    // shared WRAM goes through the locked bus path while threaded
+    return !(cpu7_threaded && addr - 0x3000000 < 0x800000);
 }
 
+#define READ(size, addr)                                                       \
+    if (!fastmem_region(addr) ||                                               \
+        !fastmem_read##size(cpu->fastmem, addr, &data)) {                      \
+        u8* page = PT_PAGE(cpu->pages.read, addr);                             \
+        if (page) data = *(u##size*) &page[(addr) % PAGESIZE];                 \
+        else data = bus7_read##size(cpu->master, addr);                        \
+    }
+
+#define WRITE(size, addr, data)                                                \
+    u8* page = PT_PAGE(cpu->pages.write, addr);                                \
+    if (page) {                                                                \
+        *(u##size*) &page[(addr) % PAGESIZE] = data;                           \
+        cpu->pages.gen[(addr) >> PAGEBITS][((addr) % PAGESIZE) >>              \
+                                           BLOCKPAGEBITS]++;                   \
+    } else bus7_write##size(cpu->master, addr, data);
+
 u32 arm7_read8(Arm7TDMI* cpu, u32 addr, bool sx) {
     cpu->c.cycles++;
-    u32 data = bus7_read8(cpu->master, addr);
+    u32 data;
+    READ(8, addr);
     if (sx) data = (s8) data;
     return data;
 }
 
 u32 arm7_read16(Arm7TDMI* cpu, u32 addr, bool sx) {
     cpu->c.cycles++;
-    u32 data = bus7_read16(cpu->master, addr & ~1);
+    u32 data;
+    READ(16, addr & ~1);
     if (addr & 1) {
         if (sx) {
             data = ((s16) data) >> 8;
@@ -52,7 +102,8 @@ u32 arm7_read16(Arm7TDMI* cpu, u32 addr, bool sx) {
 
 u32 arm7_read32(Arm7TDMI* cpu, u32 addr) {
     cpu->c.cycles++;
-    u32 data = bus7_read32(cpu->master, addr & ~3);
+    u32 data;
+    READ(32, addr & ~3);
     if (addr & 0b11) {
         data =
             (data >> (8 * (addr & 0b11))) | (data << (32 - 8 * (addr & 0b11)));
@@ -62,21 +113,23 @@ u32 arm7_read32(Arm7TDMI* cpu, u32 addr) {
 
 void arm7_write8(Arm7TDMI* cpu, u32 addr, u8 b) {
     cpu->c.cycles++;
-    bus7_write8(cpu->master, addr, b);
+    WRITE(8, addr, b);
 }
 
 void arm7_write16(Arm7TDMI* cpu, u32 addr, u16 h) {
     cpu->c.cycles++;
-    bus7_write16(cpu->master, addr & ~1, h);
+    WRITE(16, addr & ~1, h);
 }
 
 void arm7_write32(Arm7TDMI* cpu, u32 addr, u32 w) {
     cpu->c.cycles++;
-    bus7_write32(cpu->master, addr & ~3, w);
+    WRITE(32, addr & ~3, w);
 }
 
 u16 arm7_fetch16(Arm7TDMI* cpu, u32 addr) {
     cpu->c.cycles++;
+    u8* page = PT_PAGE(cpu->pages.read, addr);
+    if (page) return *(u16*) &page[(addr & ~1) % PAGESIZE];
     u16 data = bus7_read16(cpu->master, addr & ~1);
     if (cpu->master->memerr && !cpu->master->cpuerr) {
         printf("Invalid CPU7 (thumb) instruction fetch at 0x%08x\n", addr);
@@ -87,6 +140,8 @@ u16 arm7_fetch16(Arm7TDMI* cpu, u32 addr) {
 
 u32 arm7_fetch32(Arm7TDMI* cpu, u32 addr) {
     cpu->c.cycles++;
+    u8* page = PT_PAGE(cpu->pages.read, addr);
+    if (page) return *(u32*) &page[(addr & ~3) % PAGESIZE];
     u32 data = bus7_read32(cpu->master, addr & ~3);
     if (cpu->master->memerr && !cpu->master->cpuerr) {
         printf("Invalid CPU7 instruction fetch at 0x%08x\n", addr);
@@ -94,3 +149,99 @@ u32 arm7_fetch32(Arm7TDMI* cpu, u32 addr) {
     }
     return data;
 }
+
+u32* arm7_code_page(Arm7TDMI* cpu, u32 addr) {
+    NDS* nds = cpu->master;
+    switch (addr >> 24) {
+        case R_BIOS7:
+            if (addr < BIOS7SIZE) return &nds->biosgen;
+            break;
+        case R_RAM:
+            return &nds->ramgen[(addr % RAMSIZE) >> BLOCKPAGEBITS];
+        case R_WRAM:
+            if (addr < 0x3800000) {
+                switch (nds->io7.wramstat) {
+                    case 0:
+                        break;
+                    case 1:
+                        return &nds->wramgen[(addr % (WRAMSIZE / 2)) >>
+                                             BLOCKPAGEBITS];
+                    case 2:
+                        return &nds->wramgen[(WRAMSIZE / 2 +
+                                              addr % (WRAMSIZE / 2)) >>
+                                             BLOCKPAGEBITS];
+                    case 3:
+                        return &nds->wramgen[(addr % WRAMSIZE) >>
+                                             BLOCKPAGEBITS];
+                }
+            }
+            return &nds->wram7gen[(addr % WRAM7SIZE) >> BLOCKPAGEBITS];
+    }
+    return NULL;
+}
+
+void arm7_map_pages(Arm7TDMI* cpu, u32 start, u32 end) {
+    NDS* nds = cpu->master;
+    for (u32 i = start >> PAGEBITS; i < end >> PAGEBITS; i++) {
+        u32 addr = i << PAGEBITS;
+        u8* read = NULL;
+        u8* write = NULL;
+        u32* gen = cpu->pages.nogen;
+        switch (addr >> 24) {
+            case R_BIOS7:
+                if (addr < BIOS7SIZE) read = &nds->bios7[addr];
+                break;
+            case R_RAM:
+                read = write = &nds->ram[addr % RAMSIZE];
+                gen = &nds->ramgen[(addr % RAMSIZE) >> BLOCKPAGEBITS];
+                break;
+            case R_WRAM:
+                read = write = &nds->wram7[addr % WRAM7SIZE];
+                gen = &nds->wram7gen[(addr % WRAM7SIZE) >> BLOCKPAGEBITS];
+                if (addr < 0x3800000 && cpu7_threaded) {
+                    // shared WRAM goes through the bus under the IO lock
+                    read = write = NULL;
+                    gen = cpu->pages.nogen;
+                } else if (addr < 0x3800000) {
+                    switch (nds->io7.wramstat) {
+                        case 1:
+                            read = write = &nds->wram0[addr % (WRAMSIZE / 2)];
+                            gen = &nds->wramgen[(addr % (WRAMSIZE / 2)) >>
+                                                BLOCKPAGEBITS];
+                            break;
+                        case 2:
+                            read = write = &nds->wram1[addr % (WRAMSIZE / 2)];
+                            gen = &nds->wramgen[(WRAMSIZE / 2 +
+                                                 addr % (WRAMSIZE / 2)) >>
+                                                BLOCKPAGEBITS];
+                            break;
+                        case 3:
+                            read = write = &nds->wram[addr % WRAMSIZE];
+                            gen = &nds->wramgen[(addr % WRAMSIZE) >>
+                                                BLOCKPAGEBITS];
+                            break;
+                    }
+                }
+                break;
+            case R_VRAM: {
+                VRAMBank b = nds->vramstate.arm7[(addr & VRAMABCDSIZE) ? 1 : 0];
+                if (b) {
+                    read = write =
+                        &nds->vrambanks[b - 1][addr % VRAMABCDSIZE];
+                    gen = vram_gen(nds, write);
+                }
+                break;
+            }
+            case R_GBAROM:
+            case R_GBAROMEX:
+                read = write = &nds->expansionram[addr % (1 << 25)];
+                break;
+        }
+        cpu->pages.read[i] = read;
+        cpu->pages.write[i] = write;
+        cpu->pages.gen[i] = gen;
+    }
+    if (cpu->fastmem)
+        fastmem_map(cpu->fastmem, nds->memfd, nds, sizeof *nds,
+                    cpu->pages.read, start, end);
+}
@@ -12,11 +12,14 @@ typedef struct _Arm7TDMI {
 
     NDS* master;
 
+    PageTable pages;
+    u8* fastmem;
+
 } Arm7TDMI;
 
 void arm7_init(Arm7TDMI* cpu);
 
-void arm7_step(Arm7TDMI* cpu);
+bool arm7_step(Arm7TDMI* cpu);
 
 u32 arm7_read8(Arm7TDMI* cpu, u32 addr, bool sx);
 u32 arm7_read16(Arm7TDMI* cpu, u32 addr, bool sx);
@@ -29,4 +32,7 @@ void arm7_write32(Arm7TDMI* cpu, u32 addr, u32 w);
 u16 arm7_fetch16(Arm7TDMI* cpu, u32 addr);
 u32 arm7_fetch32(Arm7TDMI* cpu, u32 addr);
 
+u32* arm7_code_page(Arm7TDMI* cpu, u32 addr);
+void arm7_map_pages(Arm7TDMI* cpu, u32 start, u32 end);
+
 #endif
\ No newline at end of file
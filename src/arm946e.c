@@ -4,8 +4,12 @@
 
 #include "arm/arm.h"
 #include "arm/arm_core.h"
+#include "arm/jit.h"
 #include "arm/thumb.h"
+#include "bios.h"
 #include "bus9.h"
+#include "emulator_state.h"
+#include "fastmem.h"
 #include "nds.h"
 #include "types.h"
 
@@ -23,6 +27,8 @@ void arm9_init(Arm946E* cpu) {
     cpu->c.fetch32 = (void*) arm9_fetch32;
     cpu->c.cp15_read = (void*) cp15_read;
     cpu->c.cp15_write = (void*) cp15_write;
+    cpu->c.code_page = (void*) arm9_code_page;
+    if (ntremu.hle_bios) cpu->c.hle_swi = (void*) bios9_swi;
 
     cpu->c.v5 = true;
     cpu->c.vector_base = 0xffff0000;
@@ -39,21 +45,43 @@ bool arm9_step(Arm946E* cpu) {
     }
     if (!cpu->c.cpsr.i && cpu->c.irq) {
         cpu_handle_interrupt((ArmCore*) cpu, I_IRQ);
+    } else if (ntremu.cpu_backend == CPU_JIT) {
+        arm_exec_jit((ArmCore*) cpu);
+    } else if (ntremu.cpu_backend == CPU_CACHED) {
+        arm_exec_block((ArmCore*) cpu);
     } else {
         arm_exec_instr((ArmCore*) cpu);
     }
+    if (cpu->c.idle) {
+        cpu->c.idle = false;
+        return false;
+    }
     if (cpu->c.cycles == 0) cpu->c.cycles = 1;
     return true;
 }
 
+// IO must trap, PAL and OAM mirror every 2KB which a host page cannot alias,
+// and nothing from 0x10000000 up is mapped, so these would fault on every
+// access and go straight to the slow path instead
+#define FASTMEM_REGIONS (0xffff & ~(1 << R_IO | 1 << R_PAL | 1 << R_OAM))
+
+static inline bool fastmem_region(u32 addr) {
+    return !(addr >> 28) && (FASTMEM_REGIONS >> (addr >> 24) & 1);
+}
+
 #define READ(size, addr)                                                       \
-    if (cpu->cp15_control.itcm_on && !cpu->cp15_control.itcm_load &&           \
-        (addr) < cpu->itcm_virtsize)                                           \
-        data = *(u##size*) &cpu->itcm[(addr) % ITCMSIZE];                      \
-    else if (cpu->cp15_control.dtcm_on && !cpu->cp15_control.dtcm_load &&      \
-             (addr) - cpu->dtcm_base < cpu->dtcm_virtsize)                     \
-        data = *(u##size*) &cpu->dtcm[(addr) % DTCMSIZE];                      \
-    else data = bus9_read##size(cpu->master, addr);
+    if (!fastmem_region(addr) ||                                               \
+        !fastmem_read##size(cpu->fastmem, addr, &data)) {                      \
+        u8* page = PT_PAGE(cpu->pages.read, addr);                             \
+        if (page) data = *(u##size*) &page[(addr) % PAGESIZE];                 \
+        else if (cpu->cp15_control.itcm_on && !cpu->cp15_control.itcm_load &&  \
+                 (addr) < cpu->itcm_virtsize)                                  \
+            data = *(u##size*) &cpu->itcm[(addr) % ITCMSIZE];                  \
+        else if (cpu->cp15_control.dtcm_on && !cpu->cp15_control.dtcm_load &&  \
+                 (addr) - cpu->dtcm_base < cpu->dtcm_virtsize)                 \
+            data = *(u##size*) &cpu->dtcm[(addr) % DTCMSIZE];                  \
+        else data = bus9_read##size(cpu->master, addr);                        \
+    }
 
 u32 arm9_read8(Arm946E* cpu, u32 addr, bool sx) {
     cpu->c.cycles++;
@@ -82,17 +110,30 @@ u32 arm9_read32(Arm946E* cpu, u32 addr) {
     return data;
 }
 
-#define WRITE(size, addr)                                                      \
-    if (cpu->cp15_control.itcm_on && (addr) < cpu->itcm_virtsize)              \
+#define SLOWWRITE(size, addr)                                                  \
+    if (cpu->cp15_control.itcm_on && (addr) < cpu->itcm_virtsize) {            \
         *(u##size*) &cpu->itcm[(addr) % ITCMSIZE] = data;                      \
-    else if (cpu->cp15_control.dtcm_on &&                                      \
-             (addr) - cpu->dtcm_base < cpu->dtcm_virtsize)                     \
+        cpu->itcmgen[((addr) % ITCMSIZE) >> BLOCKPAGEBITS]++;                  \
+    } else if (cpu->cp15_control.dtcm_on &&                                    \
+               (addr) - cpu->dtcm_base < cpu->dtcm_virtsize)                   \
         *(u##size*) &cpu->dtcm[(addr) % DTCMSIZE] = data;                      \
     else bus9_write##size(cpu->master, addr, data);
 
+#define WRITE(size, addr)                                                      \
+    u8* page = PT_PAGE(cpu->pages.write, addr);                                \
+    if (page) {                                                                \
+        *(u##size*) &page[(addr) % PAGESIZE] = data;                           \
+        cpu->pages.gen[(addr) >> PAGEBITS][((addr) % PAGESIZE) >>              \
+                                           BLOCKPAGEBITS]++;                   \
+    } else SLOWWRITE(size, addr)
+
 void arm9_write8(Arm946E* cpu, u32 addr, u8 data) {
     cpu->c.cycles++;
-    WRITE(8, addr);
+    if (addr >> 24 == R_VRAM) {
+        SLOWWRITE(8, addr);
+    } else {
+        WRITE(8, addr);
+    }
 }
 
 void arm9_write16(Arm946E* cpu, u32 addr, u16 data) {
@@ -107,8 +148,11 @@ void arm9_write32(Arm946E* cpu, u32 addr, u32 data) {
 
 u16 arm9_fetch16(Arm946E* cpu, u32 addr) {
     u16 data;
-    if (cpu->cp15_control.itcm_on && !cpu->cp15_control.itcm_load &&
-        addr < cpu->itcm_virtsize)
+    u8* page = PT_PAGE(cpu->pages.read, addr);
+    if (page && (u32) (page - cpu->dtcm) >= DTCMSIZE)
+        data = *(u16*) &page[(addr & ~1) % PAGESIZE];
+    else if (cpu->cp15_control.itcm_on && !cpu->cp15_control.itcm_load &&
+             addr < cpu->itcm_virtsize)
         data = *(u16*) &cpu->itcm[(addr & ~1) % ITCMSIZE];
     else {
         data = bus9_read16(cpu->master, addr & ~1);
@@ -122,8 +166,11 @@ u16 arm9_fetch16(Arm946E* cpu, u32 addr) {
 
 u32 arm9_fetch32(Arm946E* cpu, u32 addr) {
     u32 data;
-    if (cpu->cp15_control.itcm_on && !cpu->cp15_control.itcm_load &&
-        addr < cpu->itcm_virtsize)
+    u8* page = PT_PAGE(cpu->pages.read, addr);
+    if (page && (u32) (page - cpu->dtcm) >= DTCMSIZE)
+        data = *(u32*) &page[(addr & ~3) % PAGESIZE];
+    else if (cpu->cp15_control.itcm_on && !cpu->cp15_control.itcm_load &&
+             addr < cpu->itcm_virtsize)
         data = *(u32*) &cpu->itcm[(addr & ~3) % ITCMSIZE];
     else {
         data = bus9_read32(cpu->master, addr & ~3);
@@ -135,6 +182,98 @@ u32 arm9_fetch32(Arm946E* cpu, u32 addr) {
     return data;
 }
 
+u32* arm9_code_page(Arm946E* cpu, u32 addr) {
+    if (cpu->cp15_control.itcm_on && !cpu->cp15_control.itcm_load &&
+        addr < cpu->itcm_virtsize)
+        return &cpu->itcmgen[(addr % ITCMSIZE) >> BLOCKPAGEBITS];
+    NDS* nds = cpu->master;
+    switch (addr >> 24) {
+        case R_RAM:
+            return &nds->ramgen[(addr % RAMSIZE) >> BLOCKPAGEBITS];
+        case R_WRAM:
+            switch (nds->io9.wramcnt) {
+                case 0:
+                    return &nds->wramgen[(addr % WRAMSIZE) >> BLOCKPAGEBITS];
+                case 1:
+                    return &nds->wramgen[(WRAMSIZE / 2 +
+                                          addr % (WRAMSIZE / 2)) >>
+                                         BLOCKPAGEBITS];
+                case 2:
+                    return &nds->wramgen[(addr % (WRAMSIZE / 2)) >>
+                                         BLOCKPAGEBITS];
+            }
+            break;
+        default:
+            if (addr >= 0xffff0000 && addr < (0xffff0000 + BIOS9SIZE))
+                return &nds->biosgen;
+    }
+    return NULL;
+}
+
+void arm9_map_pages(Arm946E* cpu, u32 start, u32 end) {
+    NDS* nds = cpu->master;
+    for (u32 i = start >> PAGEBITS; i < end >> PAGEBITS; i++) {
+        u32 addr = i << PAGEBITS;
+        u8* read = NULL;
+        u8* write = NULL;
+        u32* gen = cpu->pages.nogen;
+        switch (addr >> 24) {
+            case R_RAM:
+                read = write = &nds->ram[addr % RAMSIZE];
+                gen = &nds->ramgen[(addr % RAMSIZE) >> BLOCKPAGEBITS];
+                break;
+            case R_WRAM:
+                switch (nds->io9.wramcnt) {
+                    case 0:
+                        read = write = &nds->wram[addr % WRAMSIZE];
+                        gen = &nds->wramgen[(addr % WRAMSIZE) >> BLOCKPAGEBITS];
+                        break;
+                    case 1:
+                        read = write = &nds->wram1[addr % (WRAMSIZE / 2)];
+                        gen = &nds->wramgen[(WRAMSIZE / 2 +
+                                             addr % (WRAMSIZE / 2)) >>
+                                            BLOCKPAGEBITS];
+                        break;
+                    case 2:
+                        read = write = &nds->wram0[addr % (WRAMSIZE / 2)];
+                        gen = &nds->wramgen[(addr % (WRAMSIZE / 2)) >>
+                                            BLOCKPAGEBITS];
+                        break;
+                }
+                break;
+            case R_VRAM:
+                read = write = get_vram(nds, (addr >> 21) & 7, addr & 0xfffff);
+                if (write) gen = vram_gen(nds, write);
+                if (ppu_threaded || ppu_deferred) write = NULL;
+                break;
+            case R_GBAROM:
+            case R_GBAROMEX:
+                read = write = &nds->expansionram[addr % (1 << 25)];
+                break;
+        }
+        if (cpu->cp15_control.itcm_on && addr < cpu->itcm_virtsize) {
+            write = addr + PAGESIZE <= cpu->itcm_virtsize
+                        ? &cpu->itcm[addr % ITCMSIZE]
+                        : NULL;
+            gen = &cpu->itcmgen[(addr % ITCMSIZE) >> BLOCKPAGEBITS];
+            if (!cpu->cp15_control.itcm_load) read = write;
+        } else if (cpu->cp15_control.dtcm_on &&
+                   addr - cpu->dtcm_base < cpu->dtcm_virtsize) {
+            write = addr - cpu->dtcm_base + PAGESIZE <= cpu->dtcm_virtsize
+                        ? &cpu->dtcm[addr % DTCMSIZE]
+                        : NULL;
+            gen = cpu->pages.nogen;
+            if (!cpu->cp15_control.dtcm_load) read = write;
+        }
+        cpu->pages.read[i] = read;
+        cpu->pages.write[i] = write;
+        cpu->pages.gen[i] = gen;
+    }
+    if (cpu->fastmem)
+        fastmem_map(cpu->fastmem, nds->memfd, nds, sizeof *nds,
+                    cpu->pages.read, start, end);
+}
+
 u32 cp15_read(Arm946E* cpu, u32 cn, u32 cm, u32 cp) {
     switch (cn) {
         case 0:
@@ -205,6 +344,7 @@ void cp15_write(Arm946E* cpu, u32 cn, u32 cm, u32 cp, u32 data) {
                     cpu->c.vector_base = 0x00000000;
                 }
                 cpu->c.v5 = !cpu->cp15_control.v4mode;
+                arm9_map_pages(cpu, 0, 1 << 28);
                 return;
             }
             break;
@@ -224,6 +364,7 @@ void cp15_write(Arm946E* cpu, u32 cn, u32 cm, u32 cp, u32 data) {
                 } else if (cp == 1) {
                     cpu->itcm_virtsize = virtsize;
                 }
+                arm9_map_pages(cpu, 0, 1 << 28);
                 return;
             }
             break;
@@ -32,8 +32,13 @@ typedef struct _Arm946E {
         };
     } cp15_control;
 
-    u8 itcm[ITCMSIZE];
-    u8 dtcm[DTCMSIZE];
+    u8 itcm[ITCMSIZE] __attribute__((aligned(PAGESIZE)));
+    u8 dtcm[DTCMSIZE] __attribute__((aligned(PAGESIZE)));
+
+    u32 itcmgen[ITCMSIZE >> BLOCKPAGEBITS];
+
+    PageTable pages;
+    u8* fastmem;
 
     u32 itcm_virtsize;
     u32 dtcm_base;
@@ -58,6 +63,9 @@ void arm9_write32(Arm946E* cpu, u32 addr, u32 w);
 u16 arm9_fetch16(Arm946E* cpu, u32 addr);
 u32 arm9_fetch32(Arm946E* cpu, u32 addr);
 
+u32* arm9_code_page(Arm946E* cpu, u32 addr);
+void arm9_map_pages(Arm946E* cpu, u32 start, u32 end);
+
 u32 cp15_read(Arm946E* cpu, u32 cn, u32 cm, u32 cp);
 void cp15_write(Arm946E* cpu, u32 cn, u32 cm, u32 cp, u32 data);
 
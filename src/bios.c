@@ -0,0 +1,381 @@
+#include "bios.h"
+
+#include <string.h>
+
+#include "io.h"
+#include "nds.h"
+
+#define SWI_CYCLES 20
+#define DIV_CYCLES 40
+
+static u32 bios_read(ArmCore* cpu, u32 addr, u32 unit) {
+    if (unit == 4) return cpu->read32(cpu, addr);
+    else return cpu->read16(cpu, addr, false);
+}
+
+static void bios_write(ArmCore* cpu, u32 addr, u32 data, u32 unit) {
+    if (unit == 4) cpu->write32(cpu, addr, data);
+    else cpu->write16(cpu, addr, data);
+}
+
+static void bios_copy(ArmCore* cpu, PageTable* pages, u32 dst, u32 src,
+                      u32 len, u32 unit, bool fill) {
+    dst &= ~(unit - 1);
+    src &= ~(unit - 1);
+    u32 value = fill ? bios_read(cpu, src, unit) : 0;
+    while (len) {
+        u32 n = PAGESIZE - dst % PAGESIZE;
+        if (!fill && PAGESIZE - src % PAGESIZE < n)
+            n = PAGESIZE - src % PAGESIZE;
+        if (len < n) n = len;
+
+        u8* d = PT_PAGE(pages->write, dst);
+        u8* s = fill ? NULL : PT_PAGE(pages->read, src);
+        if (d && fill) {
+            d += dst % PAGESIZE;
+            if (unit == 4) {
+                for (u32 i = 0; i < n; i += 4) *(u32*) &d[i] = value;
+            } else {
+                for (u32 i = 0; i < n; i += 2) *(u16*) &d[i] = value;
+            }
+            cpu->cycles += n / unit;
+        } else if (d && s && (dst <= src || dst >= src + n)) {
+            memmove(d + dst % PAGESIZE, s + src % PAGESIZE, n);
+            cpu->cycles += 2 * n / unit;
+        } else {
+            for (u32 i = 0; i < n; i += unit) {
+                bios_write(cpu, dst + i,
+                           fill ? value : bios_read(cpu, src + i, unit), unit);
+            }
+            d = NULL;
+        }
+        if (d) {
+            u32* gen = pages->gen[dst >> PAGEBITS];
+            for (u32 i = (dst % PAGESIZE) >> BLOCKPAGEBITS;
+                 i <= ((dst + n - 1) % PAGESIZE) >> BLOCKPAGEBITS; i++) {
+                gen[i]++;
+            }
+        }
+
+        dst += n;
+        if (!fill) src += n;
+        len -= n;
+    }
+}
+
+static void bios_cpu_set(ArmCore* cpu, PageTable* pages) {
+    u32 unit = cpu->r[2] & (1 << 26) ? 4 : 2;
+    bios_copy(cpu, pages, cpu->r[1], cpu->r[0], (cpu->r[2] & 0x1fffff) * unit,
+              unit, cpu->r[2] & (1 << 24));
+}
+
+static void bios_cpu_fast_set(ArmCore* cpu, PageTable* pages) {
+    u32 len = ((cpu->r[2] & 0x1fffff) + 7) & ~7;
+    bios_copy(cpu, pages, cpu->r[1], cpu->r[0], len * 4, 4,
+              cpu->r[2] & (1 << 24));
+}
+
+static bool bios_div(ArmCore* cpu) {
+    s32 num = cpu->r[0];
+    s32 den = cpu->r[1];
+    if (den == 0 || (num == INT_MIN && den == -1)) return false;
+    s32 quot = num / den;
+    cpu->r[0] = quot;
+    cpu->r[1] = num % den;
+    cpu->r[3] = quot < 0 ? -quot : quot;
+    cpu->cycles += DIV_CYCLES;
+    return true;
+}
+
+static void bios_sqrt(ArmCore* cpu) {
+    u32 num = cpu->r[0];
+    u32 res = 0;
+    for (u32 bit = 1 << 30; bit; bit >>= 2) {
+        if (num >= res + bit) {
+            num -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+    }
+    cpu->r[0] = res;
+    cpu->cycles += DIV_CYCLES;
+}
+
+static void bios_crc16(ArmCore* cpu) {
+    static const u16 val[8] = {0xc0c1, 0xc181, 0xc301, 0xc601,
+                               0xcc01, 0xd801, 0xf001, 0xa001};
+    u32 crc = cpu->r[0] & 0xffff;
+    u32 addr = cpu->r[1] & ~1;
+    for (u32 i = 0; i < (cpu->r[2] & ~1); i += 2) {
+        u32 h = cpu->read16(cpu, addr + i, false);
+        for (int b = 0; b < 2; b++, h >>= 8) {
+            crc ^= h & 0xff;
+            for (int j = 0; j < 8; j++) {
+                bool carry = crc & 1;
+                crc >>= 1;
+                if (carry) crc ^= val[j] << (7 - j);
+            }
+        }
+    }
+    cpu->r[0] = crc;
+}
+
+// byte cursor over guest memory that resolves the host page once per page
+// and only falls back to the bus for unmapped pages
+typedef struct {
+    ArmCore* cpu;
+    u8** table;
+    u32** gen;
+    u32 addr;
+    u32 start;
+    u8* ptr;
+    u32 left;
+    u32 host;
+} BiosStream;
+
+static void stream_seek(BiosStream* s, u32 addr) {
+    s->addr = addr;
+    s->start = addr;
+    s->ptr = PT_PAGE(s->table, addr);
+    if (s->ptr) s->ptr += addr % PAGESIZE;
+    s->left = PAGESIZE - addr % PAGESIZE;
+}
+
+static void stream_init(BiosStream* s, ArmCore* cpu, u8** table, u32** gen,
+                        u32 addr) {
+    s->cpu = cpu;
+    s->table = table;
+    s->gen = gen;
+    s->host = 0;
+    stream_seek(s, addr);
+}
+
+// counts the host bytes for the cycle charge and bumps the code generations
+// covered by host writes
+static void stream_flush(BiosStream* s) {
+    if (!s->ptr || s->addr == s->start) return;
+    s->host += s->addr - s->start;
+    if (s->gen) {
+        u32* gen = s->gen[s->start >> PAGEBITS];
+        for (u32 i = (s->start % PAGESIZE) >> BLOCKPAGEBITS;
+             i <= ((s->addr - 1) % PAGESIZE) >> BLOCKPAGEBITS; i++) {
+            gen[i]++;
+        }
+    }
+    s->start = s->addr;
+}
+
+static void stream_next_page(BiosStream* s) {
+    stream_flush(s);
+    stream_seek(s, s->addr);
+}
+
+static u8 stream_get(BiosStream* s) {
+    if (!s->left) stream_next_page(s);
+    s->left--;
+    if (s->ptr) {
+        s->addr++;
+        return *s->ptr++;
+    }
+    return s->cpu->read8(s->cpu, s->addr++, false);
+}
+
+static void stream_put(BiosStream* s, u8 b) {
+    if (!s->left) stream_next_page(s);
+    s->left--;
+    if (s->ptr) {
+        s->addr++;
+        *s->ptr++ = b;
+    } else {
+        s->cpu->write8(s->cpu, s->addr++, b);
+    }
+}
+
+static void stream_skip(BiosStream* s, u32 n) {
+    s->addr += n;
+    s->ptr += n;
+    s->left -= n;
+}
+
+// copies forward a byte at a time when the ranges overlap, so lz77
+// references shorter than their length repeat as on hardware
+static void stream_copy(BiosStream* d, BiosStream* s, u32 n) {
+    if (d->ptr && s->ptr && n <= d->left && n <= s->left) {
+        if (s->ptr + n <= d->ptr || d->ptr + n <= s->ptr) {
+            memcpy(d->ptr, s->ptr, n);
+        } else {
+            for (u32 i = 0; i < n; i++) d->ptr[i] = s->ptr[i];
+        }
+        stream_skip(d, n);
+        stream_skip(s, n);
+    } else {
+        while (n--) stream_put(d, stream_get(s));
+    }
+}
+
+static void stream_fill(BiosStream* d, u8 b, u32 n) {
+    if (d->ptr && n <= d->left) {
+        memset(d->ptr, b, n);
+        stream_skip(d, n);
+    } else {
+        while (n--) stream_put(d, b);
+    }
+}
+
+static void bios_lz77_uncomp(ArmCore* cpu, PageTable* pages) {
+    u32 len = cpu->read32(cpu, cpu->r[0]) >> 8;
+    BiosStream in, out, ref;
+    stream_init(&in, cpu, pages->read, NULL, cpu->r[0] + 4);
+    stream_init(&out, cpu, pages->write, pages->gen, cpu->r[1]);
+    u32 cycles = 0;
+    while (len) {
+        u8 flags = stream_get(&in);
+        for (int i = 0; i < 8 && len; i++, flags <<= 1) {
+            if (flags & 0x80) {
+                u32 b = stream_get(&in) << 8;
+                b |= stream_get(&in);
+                u32 n = (b >> 12) + 3;
+                if (n > len) n = len;
+                stream_init(&ref, cpu, pages->read, NULL,
+                            out.addr - (b & 0xfff) - 1);
+                stream_copy(&out, &ref, n);
+                stream_flush(&ref);
+                cycles += ref.host;
+                len -= n;
+            } else {
+                stream_put(&out, stream_get(&in));
+                len--;
+            }
+        }
+    }
+    stream_flush(&in);
+    stream_flush(&out);
+    cpu->cycles += cycles + in.host + out.host;
+}
+
+static void bios_rl_uncomp(ArmCore* cpu, PageTable* pages) {
+    u32 len = cpu->read32(cpu, cpu->r[0]) >> 8;
+    BiosStream in, out;
+    stream_init(&in, cpu, pages->read, NULL, cpu->r[0] + 4);
+    stream_init(&out, cpu, pages->write, pages->gen, cpu->r[1]);
+    while (len) {
+        u8 flag = stream_get(&in);
+        u32 n = flag & 0x80 ? (flag & 0x7f) + 3 : (flag & 0x7f) + 1;
+        if (n > len) n = len;
+        if (flag & 0x80) stream_fill(&out, stream_get(&in), n);
+        else stream_copy(&out, &in, n);
+        len -= n;
+    }
+    stream_flush(&in);
+    stream_flush(&out);
+    cpu->cycles += in.host + out.host;
+}
+
+static bool bios_swi(ArmCore* cpu, PageTable* pages, u32 num) {
+    switch (num) {
+        case SWI_WAITBYLOOP:
+            cpu->cycles += 4 * cpu->r[0];
+            cpu->r[0] = 0;
+            break;
+        case SWI_DIV:
+            if (!bios_div(cpu)) return false;
+            break;
+        case SWI_CPUSET:
+            bios_cpu_set(cpu, pages);
+            break;
+        case SWI_CPUFASTSET:
+            bios_cpu_fast_set(cpu, pages);
+            break;
+        case SWI_SQRT:
+            bios_sqrt(cpu);
+            break;
+        case SWI_GETCRC16:
+            bios_crc16(cpu);
+            break;
+        case SWI_LZ77UNCOMP:
+            bios_lz77_uncomp(cpu, pages);
+            break;
+        case SWI_RLUNCOMP:
+            bios_rl_uncomp(cpu, pages);
+            break;
+        default:
+            return false;
+    }
+    cpu->cycles += SWI_CYCLES;
+    cpu_fetch_instr(cpu);
+    return true;
+}
+
+static bool bios_intr_wait(ArmCore* cpu, u32 flagaddr, u32 num) {
+    bool discard = (num == SWI_VBLANKINTRWAIT || cpu->r[0]) && !cpu->hle_wait;
+    u32 mask = num == SWI_VBLANKINTRWAIT ? 1 : cpu->r[1];
+    cpu->write32(cpu, R_IO << 24 | IME, 1);
+    u32 flags = cpu->read32(cpu, flagaddr);
+    cpu->cycles += SWI_CYCLES;
+    if (!discard && (flags & mask)) {
+        cpu->write32(cpu, flagaddr, flags & ~mask);
+        cpu->hle_wait = false;
+        cpu_fetch_instr(cpu);
+        return false;
+    }
+    if (discard) cpu->write32(cpu, flagaddr, flags & ~mask);
+    cpu->hle_wait = true;
+    cpu->pc = cpu->cur_instr_addr;
+    cpu_flush(cpu);
+    return true;
+}
+
+bool bios9_swi(Arm946E* cpu, u32 num) {
+    switch (num) {
+        case SWI_INTRWAIT:
+        case SWI_VBLANKINTRWAIT:
+            if (bios_intr_wait(&cpu->c, cpu->dtcm_base + 0x3ff8, num)) {
+                cp15_write(cpu, 7, 0, 4, 0);
+            }
+            return true;
+        case SWI_HALT:
+            cp15_write(cpu, 7, 0, 4, 0);
+            cpu_fetch_instr(&cpu->c);
+            return true;
+        default:
+            return bios_swi(&cpu->c, &cpu->pages, num);
+    }
+}
+
+bool bios7_swi(Arm7TDMI* cpu, u32 num) {
+    switch (num) {
+        case SWI_INTRWAIT:
+        case SWI_VBLANKINTRWAIT:
+            if (bios_intr_wait(&cpu->c, 0x0380fff8, num)) {
+                arm7_write8(cpu, R_IO << 24 | HALTCNT, 0x80);
+            }
+            return true;
+        case SWI_HALT:
+            arm7_write8(cpu, R_IO << 24 | HALTCNT, 0x80);
+            cpu_fetch_instr(&cpu->c);
+            return true;
+        default:
+            return bios_swi(&cpu->c, &cpu->pages, num);
+    }
+}
+
+static const u32 stub9[] = {
+    0xeafffffe, 0xeafffffe, 0xe1b0f00e, 0xeafffffe, 0xeafffffe, 0xeafffffe,
+    0xea000000, 0xeafffffe, 0xe92d500f, 0xee190f11, 0xe1a00620, 0xe1a00600,
+    0xe2800901, 0xe1a0e00f, 0xe510f004, 0xe8bd500f, 0xe25ef004,
+};
+
+static const u32 stub7[] = {
+    0xeafffffe, 0xeafffffe, 0xe1b0f00e, 0xeafffffe, 0xeafffffe,
+    0xeafffffe, 0xea000000, 0xeafffffe, 0xe92d500f, 0xe3a00301,
+    0xe1a0e00f, 0xe510f004, 0xe8bd500f, 0xe25ef004,
+};
+
+void bios9_stub(u8* bios) {
+    memcpy(bios, stub9, sizeof stub9);
+}
+
+void bios7_stub(u8* bios) {
+    memcpy(bios, stub7, sizeof stub7);
+}
@@ -0,0 +1,28 @@
+#ifndef BIOS_H
+#define BIOS_H
+
+#include "arm7tdmi.h"
+#include "arm946e.h"
+#include "types.h"
+
+enum {
+    SWI_WAITBYLOOP = 0x03,
+    SWI_INTRWAIT = 0x04,
+    SWI_VBLANKINTRWAIT = 0x05,
+    SWI_HALT = 0x06,
+    SWI_DIV = 0x09,
+    SWI_CPUSET = 0x0b,
+    SWI_CPUFASTSET = 0x0c,
+    SWI_SQRT = 0x0d,
+    SWI_GETCRC16 = 0x0e,
+    SWI_LZ77UNCOMP = 0x11,
+    SWI_RLUNCOMP = 0x14,
+};
+
+bool bios9_swi(Arm946E* cpu, u32 num);
+bool bios7_swi(Arm7TDMI* cpu, u32 num);
+
+void bios9_stub(u8* bios);
+void bios7_stub(u8* bios);
+
+#endif
@@ -2,6 +2,27 @@
 
 #include "nds.h"
 
+static inline u8* wram7_ptr(NDS* nds, u32 addr, u32** gen) {
+    if (addr < 0x3800000) {
+        switch (nds->io7.wramstat) {
+            case 0:
+                break;
+            case 1:
+                *gen = &nds->wramgen[(addr % (WRAMSIZE / 2)) >> BLOCKPAGEBITS];
+                return &nds->wram0[addr % (WRAMSIZE / 2)];
+            case 2:
+                *gen = &nds->wramgen[(WRAMSIZE / 2 + addr % (WRAMSIZE / 2)) >>
+                                     BLOCKPAGEBITS];
+                return &nds->wram1[addr % (WRAMSIZE / 2)];
+            case 3:
+                *gen = &nds->wramgen[(addr % WRAMSIZE) >> BLOCKPAGEBITS];
+                return &nds->wram[addr % WRAMSIZE];
+        }
+    }
+    *gen = &nds->wram7gen[(addr % WRAM7SIZE) >> BLOCKPAGEBITS];
+    return &nds->wram7[addr % WRAM7SIZE];
+}
+
 #define BUS7READDECL(size)                                                     \
     u##size bus7_read##size(NDS* nds, u32 addr) {                              \
         nds->memerr = false;                                                   \
@@ -12,24 +33,25 @@
             case R_RAM:                                                        \
                 return *(u##size*) (&nds->ram[addr % RAMSIZE]);                \
                 break;                                                         \
-            case R_WRAM:                                                       \
-                if (addr < 0x3800000) {                                        \
-                    switch (nds->io7.wramstat) {                               \
-                        case 0:                                                \
-                            break;                                             \
-                        case 1:                                                \
-                            return *(u##size*) &nds                            \
-                                        ->wram0[addr % (WRAMSIZE / 2)];        \
-                        case 2:                                                \
-                            return *(u##size*) &nds                            \
-                                        ->wram1[addr % (WRAMSIZE / 2)];        \
-                        case 3:                                                \
-                            return *(u##size*) &nds->wram[addr % WRAMSIZE];    \
-                    }                                                          \
+            case R_WRAM: {                                                     \
+                u32* gen;                                                      \
+                if (nds->cpu7_parallel && addr < 0x3800000) {                  \
+                    nds_lock_io(nds, CPU7);                                    \
+                    u##size data = *(u##size*) wram7_ptr(nds, addr, &gen);     \
+                    nds_unlock_io(nds, CPU7);                                  \
+                    return data;                                               \
                 }                                                              \
-                return *(u##size*) (&nds->wram7[addr % WRAM7SIZE]);            \
+                return *(u##size*) wram7_ptr(nds, addr, &gen);                 \
                 break;                                                         \
+            }                                                                  \
             case R_IO:                                                         \
+                nds_count_ipc(nds, addr);                                      \
+                if (nds->cpu7_parallel) {                                      \
+                    nds_lock_io(nds, CPU7);                                    \
+                    u##size data = io7_read##size(&nds->io7, addr & 0xffffff); \
+                    nds_unlock_io(nds, CPU7);                                  \
+                    return data;                                               \
+                }                                                              \
                 return io7_read##size(&nds->io7, addr & 0xffffff);             \
                 break;                                                         \
             case R_VRAM: {                                                     \
@@ -55,36 +77,37 @@
         switch (addr >> 24) {                                                  \
             case R_RAM:                                                        \
                 *(u##size*) (&nds->ram[addr % RAMSIZE]) = data;                \
+                nds->ramgen[(addr % RAMSIZE) >> BLOCKPAGEBITS]++;              \
                 break;                                                         \
-            case R_WRAM:                                                       \
-                if (addr < 0x3800000) {                                        \
-                    switch (nds->io7.wramstat) {                               \
-                        case 0:                                                \
-                            break;                                             \
-                        case 1:                                                \
-                            *(u##size*) &nds->wram0[addr % (WRAMSIZE / 2)] =   \
-                                data;                                          \
-                            return;                                            \
-                        case 2:                                                \
-                            *(u##size*) &nds->wram1[addr % (WRAMSIZE / 2)] =   \
-                                data;                                          \
-                            return;                                            \
-                        case 3:                                                \
-                            *(u##size*) &nds->wram[addr % WRAMSIZE] = data;    \
-                            return;                                            \
-                    }                                                          \
+            case R_WRAM: {                                                     \
+                u32* gen;                                                      \
+                if (nds->cpu7_parallel && addr < 0x3800000) {                  \
+                    nds_lock_io(nds, CPU7);                                    \
+                    *(u##size*) wram7_ptr(nds, addr, &gen) = data;             \
+                    (*gen)++;                                                  \
+                    nds_unlock_io(nds, CPU7);                                  \
+                    break;                                                     \
                 }                                                              \
-                *(u##size*) (&nds->wram7[addr % WRAM7SIZE]) = data;            \
+                *(u##size*) wram7_ptr(nds, addr, &gen) = data;                 \
+                (*gen)++;                                                      \
                 break;                                                         \
+            }                                                                  \
             case R_IO:                                                         \
-                io7_write##size(&nds->io7, addr & 0xffffff, data);             \
+                nds_count_ipc(nds, addr);                                      \
+                if (nds->cpu7_parallel) {                                      \
+                    nds_lock_io(nds, CPU7);                                    \
+                    io7_write##size(&nds->io7, addr & 0xffffff, data);         \
+                    nds_unlock_io(nds, CPU7);                                  \
+                } else io7_write##size(&nds->io7, addr & 0xffffff, data);      \
                 break;                                                         \
             case R_VRAM: {                                                     \
                 int ofs = (addr & VRAMABCDSIZE) ? 1 : 0;                       \
                 VRAMBank b = nds->vramstate.arm7[ofs];                         \
-                if (b)                                                         \
-                    *(u##size*) &nds->vrambanks[b - 1][addr % VRAMABCDSIZE] =  \
-                        data;                                                  \
+                if (b) {                                                       \
+                    u8* p = &nds->vrambanks[b - 1][addr % VRAMABCDSIZE];       \
+                    *(u##size*) p = data;                                      \
+                    (*vram_gen(nds, p))++;                                     \
+                }                                                              \
                 break;                                                         \
             }                                                                  \
             case R_GBAROM:                                                     \
@@ -99,4 +122,27 @@ BUS7READDECL(32)
 
 BUS7WRITEDECL(8)
 BUS7WRITEDECL(16)
-BUS7WRITEDECL(32)
\ No newline at end of file
+BUS7WRITEDECL(32)
+u8* bus7_get_ptr(NDS* nds, u32 addr, u32* len, u32** gen) {
+    *len = PAGESIZE - addr % PAGESIZE;
+    *gen = NULL;
+    switch (addr >> 24) {
+        case R_RAM:
+            *gen = &nds->ramgen[(addr % RAMSIZE) >> BLOCKPAGEBITS];
+            return &nds->ram[addr % RAMSIZE];
+        case R_WRAM:
+            if (nds->cpu7_parallel && addr < 0x3800000) break;
+            return wram7_ptr(nds, addr, gen);
+        case R_VRAM: {
+            VRAMBank b = nds->vramstate.arm7[(addr & VRAMABCDSIZE) ? 1 : 0];
+            if (!b) break;
+            u8* p = &nds->vrambanks[b - 1][addr % VRAMABCDSIZE];
+            *gen = vram_gen(nds, p);
+            return p;
+        }
+        case R_GBAROM:
+        case R_GBAROMEX:
+            return &nds->expansionram[addr % (1 << 25)];
+    }
+    return NULL;
+}
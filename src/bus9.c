@@ -22,6 +22,13 @@
                 }                                                              \
                 break;                                                         \
             case R_IO:                                                         \
+                nds_count_ipc(nds, addr);                                      \
+                if (nds->cpu7_parallel) {                                      \
+                    nds_lock_io(nds, CPU9);                                    \
+                    u##size data = io9_read##size(&nds->io9, addr & 0xffffff); \
+                    nds_unlock_io(nds, CPU9);                                  \
+                    return data;                                               \
+                }                                                              \
                 return io9_read##size(&nds->io9, addr & 0xffffff);             \
                 break;                                                         \
             case R_PAL:                                                        \
@@ -50,31 +57,46 @@
         switch (addr >> 24) {                                                  \
             case R_RAM:                                                        \
                 *(u##size*) (&nds->ram[addr % RAMSIZE]) = data;                \
+                nds->ramgen[(addr % RAMSIZE) >> BLOCKPAGEBITS]++;              \
                 break;                                                         \
             case R_WRAM:                                                       \
                 switch (nds->io9.wramcnt) {                                    \
                     case 0:                                                    \
                         *(u##size*) &nds->wram[addr % WRAMSIZE] = data;        \
+                        nds->wramgen[(addr % WRAMSIZE) >> BLOCKPAGEBITS]++;    \
                         break;                                                 \
                     case 1:                                                    \
                         *(u##size*) &nds->wram1[addr % (WRAMSIZE / 2)] = data; \
+                        nds->wramgen[(WRAMSIZE / 2 + addr % (WRAMSIZE / 2)) >> \
+                                     BLOCKPAGEBITS]++;                         \
                         break;                                                 \
                     case 2:                                                    \
                         *(u##size*) &nds->wram0[addr % (WRAMSIZE / 2)] = data; \
+                        nds->wramgen[(addr % (WRAMSIZE / 2)) >>                \
+                                     BLOCKPAGEBITS]++;                         \
                         break;                                                 \
                 }                                                              \
                 break;                                                         \
             case R_IO:                                                         \
-                io9_write##size(&nds->io9, addr & 0xffffff, data);             \
+                nds_count_ipc(nds, addr);                                      \
+                if (nds->cpu7_parallel) {                                      \
+                    nds_lock_io(nds, CPU9);                                    \
+                    io9_write##size(&nds->io9, addr & 0xffffff, data);         \
+                    nds_unlock_io(nds, CPU9);                                  \
+                } else io9_write##size(&nds->io9, addr & 0xffffff, data);      \
                 break;                                                         \
             case R_PAL:                                                        \
+                if (ppu_pending) ppu_wait_lines();                             \
                 *(u##size*) (&nds->pal[addr % (2 * PALSIZE)]) = data;          \
                 break;                                                         \
             case R_VRAM:                                                       \
+                if (ppu_pending) ppu_wait_vram(addr);                          \
                 vram_write##size(nds, (addr >> 21) & 7, addr & 0xfffff, data); \
                 break;                                                         \
             case R_OAM:                                                        \
+                if (ppu_pending) ppu_wait_lines();                             \
                 *(u##size*) (&nds->oam[addr % (2 * OAMSIZE)]) = data;          \
+                nds->oamgen[(addr % (2 * OAMSIZE)) >> BLOCKPAGEBITS]++;        \
                 break;                                                         \
             case R_GBAROM:                                                     \
             case R_GBAROMEX:                                                   \
@@ -89,4 +111,48 @@ BUS9READDECL(32)
 
 BUS9WRITEDECL(8)
 BUS9WRITEDECL(16)
-BUS9WRITEDECL(32)
\ No newline at end of file
+BUS9WRITEDECL(32)
+u8* bus9_get_ptr(NDS* nds, u32 addr, u32* len, u32** gen) {
+    *len = PAGESIZE - addr % PAGESIZE;
+    *gen = NULL;
+    switch (addr >> 24) {
+        case R_RAM:
+            *gen = &nds->ramgen[(addr % RAMSIZE) >> BLOCKPAGEBITS];
+            return &nds->ram[addr % RAMSIZE];
+        case R_WRAM:
+            switch (nds->io9.wramcnt) {
+                case 0:
+                    *gen = &nds->wramgen[(addr % WRAMSIZE) >> BLOCKPAGEBITS];
+                    return &nds->wram[addr % WRAMSIZE];
+                case 1:
+                    *gen = &nds->wramgen[(WRAMSIZE / 2 +
+                                          addr % (WRAMSIZE / 2)) >>
+                                         BLOCKPAGEBITS];
+                    return &nds->wram1[addr % (WRAMSIZE / 2)];
+                case 2:
+                    *gen =
+                        &nds->wramgen[(addr % (WRAMSIZE / 2)) >> BLOCKPAGEBITS];
+                    return &nds->wram0[addr % (WRAMSIZE / 2)];
+            }
+            break;
+        case R_PAL:
+            if (ppu_pending) ppu_wait_lines();
+            *len = 2 * PALSIZE - addr % (2 * PALSIZE);
+            return &nds->pal[addr % (2 * PALSIZE)];
+        case R_VRAM: {
+            if (ppu_pending) ppu_wait_vram(addr);
+            u8* p = get_vram(nds, (addr >> 21) & 7, addr & 0xfffff);
+            if (p) *gen = vram_gen(nds, p);
+            return p;
+        }
+        case R_OAM:
+            if (ppu_pending) ppu_wait_lines();
+            *len = 2 * OAMSIZE - addr % (2 * OAMSIZE);
+            *gen = &nds->oamgen[(addr % (2 * OAMSIZE)) >> BLOCKPAGEBITS];
+            return &nds->oam[addr % (2 * OAMSIZE)];
+        case R_GBAROM:
+        case R_GBAROMEX:
+            return &nds->expansionram[addr % (1 << 25)];
+    }
+    return NULL;
+}
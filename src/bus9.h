@@ -13,4 +13,6 @@ void bus9_write8(NDS* nds, u32 addr, u8 data);
 void bus9_write16(NDS* nds, u32 addr, u16 data);
 void bus9_write32(NDS* nds, u32 addr, u32 data);
 
+u8* bus9_get_ptr(NDS* nds, u32 addr, u32* len, u32** gen);
+
 #endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "dma.h"
 
+#include <string.h>
+
 #include "bus7.h"
 #include "bus9.h"
 #include "nds.h"
@@ -16,6 +18,45 @@ void update_addr(u32* addr, int adcnt, int wsize) {
     }
 }
 
+u32 dma_bulk(NDS* nds, u8* (*get_ptr)(NDS*, u32, u32*, u32**), u32* sptr,
+             u32* dptr, u32 len, int sadcnt, int dadcnt, u32 wsize) {
+    if (sadcnt == DMA_ADCNT_DEC || dadcnt == DMA_ADCNT_DEC ||
+        dadcnt == DMA_ADCNT_FIX)
+        return 0;
+
+    u32 slen, dlen;
+    u32* gen;
+    u8* src = get_ptr(nds, *sptr, &slen, &gen);
+    u8* dst = get_ptr(nds, *dptr, &dlen, &gen);
+    if (!src || !dst) return 0;
+
+    u32 n = dlen / wsize;
+    if (sadcnt != DMA_ADCNT_FIX && slen / wsize < n) n = slen / wsize;
+    if (len < n) n = len;
+    if (!n) return 0;
+
+    u32 bytes = n * wsize;
+    if (sadcnt == DMA_ADCNT_FIX) {
+        if (wsize == 4) {
+            u32 data = *(u32*) src;
+            for (u32 i = 0; i < bytes; i += 4) *(u32*) &dst[i] = data;
+        } else {
+            u16 data = *(u16*) src;
+            for (u32 i = 0; i < bytes; i += 2) *(u16*) &dst[i] = data;
+        }
+    } else {
+        if (dst > src && dst < src + bytes) return 0;
+        memmove(dst, src, bytes);
+        *sptr += bytes;
+    }
+    if (gen) {
+        u32 last = (*dptr % (1 << BLOCKPAGEBITS) + bytes - 1) >> BLOCKPAGEBITS;
+        for (u32 i = 0; i <= last; i++) gen[i]++;
+    }
+    *dptr += bytes;
+    return n;
+}
+
 void dma7_enable(DMAController* dmac, int i) {
     dmac->dma[i].sptr = dmac->master->io7.dma[i].sad;
     dmac->dma[i].dptr = dmac->master->io7.dma[i].dad;
@@ -55,25 +96,24 @@ void dma7_run(DMAController* dmac, int i) {
     if (i < 3) dmac->dma[i].dptr %= 1 << 27;
     else dmac->dma[i].dptr %= 1 << 28;
 
-    if (dmac->master->io7.dma[i].cnt.wsize) {
-        do {
-            dma7_trans32(dmac, i, dmac->dma[i].dptr, dmac->dma[i].sptr);
-            update_addr(&dmac->dma[i].sptr, dmac->master->io7.dma[i].cnt.sadcnt,
-                        4);
-            update_addr(&dmac->dma[i].dptr, dmac->master->io7.dma[i].cnt.dadcnt,
-                        4);
-            dmac->master->sched.now += 1;
-        } while (--dmac->dma[i].len);
-    } else {
-        do {
-            dma7_trans16(dmac, i, dmac->dma[i].dptr, dmac->dma[i].sptr);
-            update_addr(&dmac->dma[i].sptr, dmac->master->io7.dma[i].cnt.sadcnt,
-                        2);
-            update_addr(&dmac->dma[i].dptr, dmac->master->io7.dma[i].cnt.dadcnt,
-                        2);
-            dmac->master->sched.now += 1;
-        } while (--dmac->dma[i].len);
-    }
+    int sadcnt = dmac->master->io7.dma[i].cnt.sadcnt;
+    int dadcnt = dmac->master->io7.dma[i].cnt.dadcnt;
+    u32 wsize = dmac->master->io7.dma[i].cnt.wsize ? 4 : 2;
+    do {
+        u32 n = dma_bulk(dmac->master, bus7_get_ptr, &dmac->dma[i].sptr,
+                         &dmac->dma[i].dptr, dmac->dma[i].len, sadcnt, dadcnt,
+                         wsize);
+        if (!n) {
+            if (wsize == 4)
+                dma7_trans32(dmac, i, dmac->dma[i].dptr, dmac->dma[i].sptr);
+            else dma7_trans16(dmac, i, dmac->dma[i].dptr, dmac->dma[i].sptr);
+            update_addr(&dmac->dma[i].sptr, sadcnt, wsize);
+            update_addr(&dmac->dma[i].dptr, dadcnt, wsize);
+            n = 1;
+        }
+        dmac->master->sched.now += n;
+        dmac->dma[i].len -= n;
+    } while (dmac->dma[i].len);
 
     if (!dmac->master->io7.dma[i].cnt.repeat) {
         dmac->master->io7.dma[i].cnt.enable = 0;
@@ -122,25 +162,24 @@ void dma9_run(DMAController* dmac, int i) {
     dmac->dma[i].sptr %= 1 << 28;
     dmac->dma[i].dptr %= 1 << 28;
 
-    if (dmac->master->io9.dma[i].cnt.wsize) {
-        do {
-            dma9_trans32(dmac, i, dmac->dma[i].dptr, dmac->dma[i].sptr);
-            update_addr(&dmac->dma[i].sptr, dmac->master->io9.dma[i].cnt.sadcnt,
-                        4);
-            update_addr(&dmac->dma[i].dptr, dmac->master->io9.dma[i].cnt.dadcnt,
-                        4);
-            dmac->master->sched.now += 1;
-        } while (--dmac->dma[i].len);
-    } else {
-        do {
-            dma9_trans16(dmac, i, dmac->dma[i].dptr, dmac->dma[i].sptr);
-            update_addr(&dmac->dma[i].sptr, dmac->master->io9.dma[i].cnt.sadcnt,
-                        2);
-            update_addr(&dmac->dma[i].dptr, dmac->master->io9.dma[i].cnt.dadcnt,
-                        2);
-            dmac->master->sched.now += 1;
-        } while (--dmac->dma[i].len);
-    }
+    int sadcnt = dmac->master->io9.dma[i].cnt.sadcnt;
+    int dadcnt = dmac->master->io9.dma[i].cnt.dadcnt;
+    u32 wsize = dmac->master->io9.dma[i].cnt.wsize ? 4 : 2;
+    do {
+        u32 n = dma_bulk(dmac->master, bus9_get_ptr, &dmac->dma[i].sptr,
+                         &dmac->dma[i].dptr, dmac->dma[i].len, sadcnt, dadcnt,
+                         wsize);
+        if (!n) {
+            if (wsize == 4)
+                dma9_trans32(dmac, i, dmac->dma[i].dptr, dmac->dma[i].sptr);
+            else dma9_trans16(dmac, i, dmac->dma[i].dptr, dmac->dma[i].sptr);
+            update_addr(&dmac->dma[i].sptr, sadcnt, wsize);
+            update_addr(&dmac->dma[i].dptr, dadcnt, wsize);
+            n = 1;
+        }
+        dmac->master->sched.now += n;
+        dmac->dma[i].len -= n;
+    } while (dmac->dma[i].len);
 
     if (!dmac->master->io9.dma[i].cnt.repeat) {
         dmac->master->io9.dma[i].cnt.enable = 0;
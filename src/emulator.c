@@ -8,6 +8,7 @@
 #include <unistd.h>
 
 #include "arm/arm.h"
+#include "bios.h"
 #include "emulator_state.h"
 #include "nds.h"
 #include "arm/thumb.h"
@@ -19,9 +20,20 @@ EmulatorState ntremu;
 
 const char usage[] = "ntremu [options] <romfile>\n"
                      "-b -- boot from firmware\n"
+                     "-c -- use the cached block interpreter\n"
                      "-d -- run the debugger\n"
+                     "-e -- render the 2d engines on worker threads\n"
+                     "-f -- map guest memory into host fastmem arenas\n"
+                     "-g -- run the 3d geometry engine on its own thread\n"
+                     "-j -- use the x86-64 recompiler\n"
+                     "-l -- emulate common bios calls natively\n"
                      "-p <path> -- path to bios/firmware files\n"
+                     "-q <cycles> -- fixed cpu slice length\n"
+                     "-r <n> -- number of 3d render threads\n"
                      "-s <path> -- path to SD card image for DLDI\n"
+                     "-t -- run the arm7 on its own thread\n"
+                     "-v -- render 2d frames at vblank from a register log\n"
+                     "-x -- use the fixed-point 3d rasterizer\n"
                      "-h -- print help";
 
 int emulator_init(int argc, char** argv) {
@@ -46,24 +58,35 @@ int emulator_init(int argc, char** argv) {
 
     close(dirfd);
 
-    if (bios7fd < 0 || bios9fd < 0 || firmwarefd < 0) {
+    if ((bios7fd < 0 || bios9fd < 0 || firmwarefd < 0) &&
+        (!ntremu.hle_bios || ntremu.bootbios)) {
         eprintf("Missing bios or firmware. Make sure 'bios7.bin','bios9.bin', "
                 "and 'firmware.bin' exist.\n");
         return -1;
     }
 
-    ntremu.bios7 =
-        mmap(NULL, BIOS7SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, bios7fd, 0);
-    ntremu.bios9 =
-        mmap(NULL, BIOS9SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, bios9fd, 0);
-    ntremu.firmware = mmap(NULL, FIRMWARESIZE, PROT_READ | PROT_WRITE,
-                           MAP_SHARED, firmwarefd, 0);
+    ntremu.bios7 = mmap(NULL, BIOS7SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | (bios7fd < 0 ? MAP_ANONYMOUS : 0),
+                        bios7fd, 0);
+    ntremu.bios9 = mmap(NULL, BIOS9SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | (bios9fd < 0 ? MAP_ANONYMOUS : 0),
+                        bios9fd, 0);
+    ntremu.firmware =
+        mmap(NULL, FIRMWARESIZE, PROT_READ | PROT_WRITE,
+             firmwarefd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED,
+             firmwarefd, 0);
+    if (bios7fd < 0) bios7_stub(ntremu.bios7);
+    if (bios9fd < 0) bios9_stub(ntremu.bios9);
 
     close(bios7fd);
     close(bios9fd);
     close(firmwarefd);
 
-    ntremu.nds = malloc(sizeof *ntremu.nds);
+    ntremu.nds = create_nds(ntremu.fastmem);
+    if (!ntremu.nds) {
+        eprintf("Out of memory\n");
+        return -1;
+    }
     ntremu.card = create_card(ntremu.romfile);
     if (!ntremu.card) {
         eprintf("Invalid rom file\n");
@@ -100,7 +123,7 @@ int emulator_init(int argc, char** argv) {
 void emulator_quit() {
     close(ntremu.dldi_sd_fd);
     destroy_card(ntremu.card);
-    free(ntremu.nds);
+    destroy_nds(ntremu.nds);
     munmap(ntremu.bios7, BIOS7SIZE);
     munmap(ntremu.bios9, BIOS9SIZE);
     munmap(ntremu.firmware, FIRMWARESIZE);
@@ -122,6 +145,24 @@ void read_args(int argc, char** argv) {
                     case 'b':
                         ntremu.bootbios = true;
                         break;
+                    case 'e':
+                        ntremu.ppu_threads = true;
+                        break;
+                    case 'c':
+                        ntremu.cpu_backend = CPU_CACHED;
+                        break;
+                    case 'f':
+                        ntremu.fastmem = true;
+                        break;
+                    case 'g':
+                        ntremu.geometry_thread = true;
+                        break;
+                    case 'j':
+                        ntremu.cpu_backend = CPU_JIT;
+                        break;
+                    case 'l':
+                        ntremu.hle_bios = true;
+                        break;
                     case 'p':
                         if (!f[1] && i + 1 < argc) {
                             ntremu.biosPath = argv[++i];
@@ -129,6 +170,20 @@ void read_args(int argc, char** argv) {
                             eprintf("Missing argument for '-p'\n");
                         }
                         break;
+                    case 'q':
+                        if (!f[1] && i + 1 < argc) {
+                            ntremu.quantum = atoi(argv[++i]);
+                        } else {
+                            eprintf("Missing argument for '-q'\n");
+                        }
+                        break;
+                    case 'r':
+                        if (!f[1] && i + 1 < argc) {
+                            ntremu.render_threads = atoi(argv[++i]);
+                        } else {
+                            eprintf("Missing argument for '-r'\n");
+                        }
+                        break;
                     case 's':
                         if (!f[1] && i + 1 < argc) {
                             ntremu.sd_path = argv[++i];
@@ -136,6 +191,15 @@ void read_args(int argc, char** argv) {
                             eprintf("Missing argument for '-s'\n");
                         }
                         break;
+                    case 't':
+                        ntremu.cpu7_thread = true;
+                        break;
+                    case 'v':
+                        ntremu.ppu_deferred = true;
+                        break;
+                    case 'x':
+                        ntremu.fixed_raster = true;
+                        break;
                     case 'h':
                         eprintf(usage);
                         exit(0);
@@ -147,6 +211,10 @@ void read_args(int argc, char** argv) {
             ntremu.romfile = argv[i];
         }
     }
+    if (ntremu.debugger) {
+        ntremu.cpu_backend = CPU_INTERP;
+        ntremu.cpu7_thread = false;
+    }
 }
 
 void hotkey_press(SDL_KeyCode key) {
@@ -186,6 +254,7 @@ void hotkey_press(SDL_KeyCode key) {
                 ntremu.freecam_mtx.p[2][2] = 1;
                 ntremu.freecam_mtx.p[3][3] = 1;
             }
+            ntremu.freecam_gen++;
             break;
         case SDLK_u:
             ntremu.abs_touch = !ntremu.abs_touch;
@@ -329,6 +398,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_Q]) {
         mat4 m = {0};
@@ -340,6 +410,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_DOWN]) {
         mat4 m = {0};
@@ -352,6 +423,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_UP]) {
         mat4 m = {0};
@@ -364,6 +436,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_A]) {
         mat4 m = {0};
@@ -375,6 +448,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_D]) {
         mat4 m = {0};
@@ -386,6 +460,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_LEFT]) {
         mat4 m = {0};
@@ -398,6 +473,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_RIGHT]) {
         mat4 m = {0};
@@ -410,6 +486,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_W]) {
         mat4 m = {0};
@@ -421,6 +498,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
     if (keys[SDL_SCANCODE_S]) {
         mat4 m = {0};
@@ -432,6 +510,7 @@ void update_input_freecam() {
         mat4 tmp;
         matmul2(&m, &ntremu.freecam_mtx, &tmp);
         ntremu.freecam_mtx = tmp;
+        ntremu.freecam_gen++;
     }
 
     ntremu.nds->io7.keyinput.keys = 0x3ff;
@@ -1,6 +1,7 @@
 #ifndef EMULATOR_STATE_H
 #define EMULATOR_STATE_H
 
+#include "arm/arm_core.h"
 #include "gamecard.h"
 #include "nds.h"
 #include "types.h"
@@ -19,6 +20,14 @@ typedef struct {
     bool frame_adv;
     bool abs_touch;
 
+    CpuBackend cpu_backend;
+    bool fastmem;
+    bool hle_bios;
+    bool cpu7_thread;
+    bool ppu_threads;
+    bool ppu_deferred;
+    u32 quantum;
+
     u32 breakpoint;
 
     NDS* nds;
@@ -31,9 +40,13 @@ typedef struct {
     int dldi_sd_fd;
     u64 dldi_sd_size;
 
+    int render_threads;
+    bool fixed_raster;
+    bool geometry_thread;
     bool wireframe;
     bool freecam;
     mat4 freecam_mtx;
+    u32 freecam_gen;
 
 } EmulatorState;
 
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "fastmem.h"
+
+#include <stdlib.h>
+
+#include "arm/arm_core.h"
+
+#ifdef FASTMEM
+#include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+typedef struct {
+    s32 insn;
+    s32 fixup;
+} FastmemFixup;
+
+extern FastmemFixup __start_fastmem_fixup[];
+extern FastmemFixup __stop_fastmem_fixup[];
+
+#define MAX_ARENAS 8
+
+static struct sigaction old_sigsegv;
+static bool handler_installed;
+static u8* arenas[MAX_ARENAS];
+
+static bool in_arena(u8* addr) {
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        u8* a = __atomic_load_n(&arenas[i], __ATOMIC_RELAXED);
+        if (a && addr >= a && addr < a + FASTMEMSIZE) return true;
+    }
+    return false;
+}
+
+static void fastmem_handler(int sig, siginfo_t* info, void* ctx) {
+    ucontext_t* uc = ctx;
+    u8* rip = (u8*) uc->uc_mcontext.gregs[REG_RIP];
+    if (in_arena(info->si_addr)) {
+        for (FastmemFixup* f = __start_fastmem_fixup;
+             f < __stop_fastmem_fixup; f++) {
+            if ((u8*) &f->insn + f->insn == rip) {
+                uc->uc_mcontext.gregs[REG_RIP] =
+                    (greg_t) ((u8*) &f->fixup + f->fixup);
+                return;
+            }
+        }
+    }
+    if (old_sigsegv.sa_flags & SA_SIGINFO) {
+        old_sigsegv.sa_sigaction(sig, info, ctx);
+    } else if (old_sigsegv.sa_handler != SIG_DFL &&
+               old_sigsegv.sa_handler != SIG_IGN) {
+        old_sigsegv.sa_handler(sig);
+    } else {
+        // returning refaults into the default action
+        signal(SIGSEGV, SIG_DFL);
+    }
+}
+
+void* fastmem_alloc(size_t size, int* fd) {
+    *fd = memfd_create("ntremu", 0);
+    if (*fd < 0) return NULL;
+    void* p = MAP_FAILED;
+    if (ftruncate(*fd, size) == 0) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    }
+    if (p == MAP_FAILED) {
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+    return p;
+}
+
+void fastmem_free(void* p, size_t size, int fd) {
+    munmap(p, size);
+    close(fd);
+}
+
+u8* fastmem_create() {
+    u8* arena = mmap(NULL, FASTMEMSIZE, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED) return NULL;
+    int slot = 0;
+    while (slot < MAX_ARENAS && arenas[slot]) slot++;
+    if (slot == MAX_ARENAS) {
+        munmap(arena, FASTMEMSIZE);
+        return NULL;
+    }
+    __atomic_store_n(&arenas[slot], arena, __ATOMIC_RELAXED);
+    if (!handler_installed) {
+        struct sigaction sa = {0};
+        sa.sa_sigaction = fastmem_handler;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGSEGV, &sa, &old_sigsegv);
+        handler_installed = true;
+    }
+    return arena;
+}
+
+void fastmem_destroy(u8* arena) {
+    if (!arena) return;
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        if (arenas[i] == arena)
+            __atomic_store_n(&arenas[i], NULL, __ATOMIC_RELAXED);
+    }
+    munmap(arena, FASTMEMSIZE);
+}
+
+static s64 page_offset(u8* page, void* base, size_t size) {
+    if (!page) return -1;
+    s64 ofs = page - (u8*) base;
+    if (ofs < 0 || ofs >= size || ofs % PAGESIZE) return -1;
+    return ofs;
+}
+
+static void map_run(u8* addr, u64 len, int fd, s64 ofs) {
+    if (ofs < 0) {
+        mmap(addr, len, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+    } else {
+        mmap(addr, len, PROT_READ, MAP_SHARED | MAP_FIXED, fd, ofs);
+    }
+}
+
+void fastmem_map(u8* arena, int fd, void* base, size_t size, u8** pages,
+                 u32 start, u32 end) {
+    u32 first = start >> PAGEBITS;
+    u32 last = end >> PAGEBITS;
+    if (first >= last) return;
+    u32 run = first;
+    s64 runofs = page_offset(pages[first], base, size);
+    for (u32 i = first + 1; i <= last; i++) {
+        s64 ofs = i < last ? page_offset(pages[i], base, size) : -2;
+        if (ofs == -2 ||
+            (runofs < 0 ? ofs != -1
+                        : ofs != runofs + (s64) (i - run) * PAGESIZE)) {
+            map_run(arena + ((u64) run << PAGEBITS),
+                    (u64) (i - run) << PAGEBITS, fd, runofs);
+            run = i;
+            runofs = ofs;
+        }
+    }
+}
+
+#else
+
+void* fastmem_alloc(size_t size, int* fd) {
+    *fd = -1;
+    return NULL;
+}
+
+void fastmem_free(void* p, size_t size, int fd) {}
+
+u8* fastmem_create() {
+    return NULL;
+}
+
+void fastmem_destroy(u8* arena) {}
+
+void fastmem_map(u8* arena, int fd, void* base, size_t size, u8** pages,
+                 u32 start, u32 end) {}
+
+#endif
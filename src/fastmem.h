@@ -0,0 +1,56 @@
+#ifndef FASTMEM_H
+#define FASTMEM_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+#if defined(__linux__) && defined(__x86_64__)
+#define FASTMEM
+#endif
+
+#define FASTMEMSIZE (1ull << 32)
+
+void* fastmem_alloc(size_t size, int* fd);
+void fastmem_free(void* p, size_t size, int fd);
+
+u8* fastmem_create();
+void fastmem_destroy(u8* arena);
+void fastmem_map(u8* arena, int fd, void* base, size_t size, u8** pages,
+                 u32 start, u32 end);
+
+#ifdef FASTMEM
+
+#define FASTMEMREADDECL(size, insn)                                            \
+    static inline bool fastmem_read##size(u8* arena, u32 addr, u32* data) {    \
+        if (!arena) return false;                                              \
+        u32 fault = 0;                                                         \
+        asm volatile("1: " insn " (%2,%3), %0\n"                               \
+                     "2:\n"                                                    \
+                     ".pushsection .text.unlikely, \"ax\"\n"                   \
+                     "3: movl $1, %1\n"                                        \
+                     "jmp 2b\n"                                                \
+                     ".popsection\n"                                           \
+                     ".pushsection fastmem_fixup, \"a\"\n"                     \
+                     ".long 1b - ., 3b - .\n"                                  \
+                     ".popsection"                                             \
+                     : "=r"(*data), "+r"(fault)                                \
+                     : "r"(arena), "r"((u64) addr)                             \
+                     : "memory");                                              \
+        return !fault;                                                         \
+    }
+
+#else
+
+#define FASTMEMREADDECL(size, insn)                                            \
+    static inline bool fastmem_read##size(u8* arena, u32 addr, u32* data) {    \
+        return false;                                                          \
+    }
+
+#endif
+
+FASTMEMREADDECL(8, "movzbl")
+FASTMEMREADDECL(16, "movzwl")
+FASTMEMREADDECL(32, "movl")
+
+#endif
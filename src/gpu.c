@@ -2,16 +2,70 @@
 
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #include "emulator_state.h"
 #include "io.h"
 #include "nds.h"
 
-pthread_t gpu_thread;
-pthread_mutex_t gpu_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t gpu_cond = PTHREAD_COND_INITIALIZER;
+#define GEOM_SPIN 4096
+
+static pthread_t gpu_thread;
+static pthread_mutex_t gpu_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gpu_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t frame_done_cond = PTHREAD_COND_INITIALIZER;
+static bool gpu_quit;
+
+static pthread_t render_threads[MAX_RENDER_THREADS - 1];
+static int n_render_threads;
+static GPU* render_gpu;
+static pthread_mutex_t render_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t render_done = PTHREAD_COND_INITIALIZER;
+static void (*render_job)(GPU* gpu, int tile);
+static u32 render_gen;
+static int render_pending;
+static int render_next;
+static bool render_quit;
+
+static u16 tile_polys[TILES_X * TILES_Y][MAX_POLY];
+static int tile_n_polys[TILES_X * TILES_Y];
+static struct poly_setup poly_setups[MAX_POLY];
+static struct interp_attrs* edge_buf;
+static int edge_buf_size;
+
+static pthread_t geom_thread;
+static pthread_mutex_t geom_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t geom_cond = PTHREAD_COND_INITIALIZER;
+static bool geom_threaded;
+static bool geom_sleeping;
+static bool geom_quit;
+
+static RING(u8, GX_RING_CMDS) gx_cmds;
+static RING(u32, GX_RING_PARAMS) gx_params;
+static u32 gx_done;
+
+static TexCacheEntry texcache[TEXCACHE_SETS][TEXCACHE_WAYS];
+static u32 texcache_frame;
+
+typedef u32 (*DepthMaskFunc)(float* buf, int n, s32 d, s32 dd, float scale,
+                             bool equal);
+
+static u32 depth_mask_scalar(float* buf, int n, s32 d, s32 dd, float scale,
+                             bool equal);
+static DepthMaskFunc span_depth_mask = depth_mask_scalar;
+
+typedef u32 (*ShadeSpanFunc)(GPU* gpu, struct poly_setup* ps, int x, int y,
+                             u32 mask, s32 d, s32 dd, float scale,
+                             struct interp_fixed* f0, struct interp_fixed* df);
+
+static ShadeSpanFunc select_shade_span();
+static ShadeSpanFunc span_shade;
 
 const int cmd_parms[8][16] = {{0},
                               {1, 0, 1, 1, 1, 0, 16, 12, 16, 12, 9, 3, 3},
@@ -22,36 +76,269 @@ const int cmd_parms[8][16] = {{0},
                               {1},
                               {3, 2, 1}};
 
+static void run_tiles(GPU* gpu, void (*job)(GPU* gpu, int tile)) {
+    int tile;
+    while ((tile = __atomic_fetch_add(&render_next, 1, __ATOMIC_RELAXED)) <
+           TILES_X * TILES_Y) {
+        job(gpu, tile);
+    }
+}
+
+static void* render_thread_run(void* data) {
+    u32 gen = 0;
+    pthread_mutex_lock(&render_mutex);
+    while (true) {
+        while (render_gen == gen && !render_quit) {
+            pthread_cond_wait(&render_start, &render_mutex);
+        }
+        if (render_quit) break;
+        gen = render_gen;
+        pthread_mutex_unlock(&render_mutex);
+        run_tiles(render_gpu, render_job);
+        pthread_mutex_lock(&render_mutex);
+        if (--render_pending == 0) pthread_cond_signal(&render_done);
+    }
+    pthread_mutex_unlock(&render_mutex);
+    return NULL;
+}
+
+static void run_jobs(GPU* gpu, void (*job)(GPU* gpu, int tile)) {
+    render_next = 0;
+    if (!n_render_threads) {
+        run_tiles(gpu, job);
+        return;
+    }
+    pthread_mutex_lock(&render_mutex);
+    render_gpu = gpu;
+    render_job = job;
+    render_pending = n_render_threads;
+    render_gen++;
+    pthread_cond_broadcast(&render_start);
+    pthread_mutex_unlock(&render_mutex);
+
+    run_tiles(gpu, job);
+
+    pthread_mutex_lock(&render_mutex);
+    while (render_pending) {
+        pthread_cond_wait(&render_done, &render_mutex);
+    }
+    pthread_mutex_unlock(&render_mutex);
+}
+
+static u32 depth_mask_scalar(float* buf, int n, s32 d, s32 dd, float scale,
+                             bool equal) {
+    u32 mask = 0;
+    for (int j = 0; j < n; j++, d += dd) {
+        float depth = d * scale;
+        bool pass = equal ? fabsf(depth - buf[j]) <= 0.125f : depth < buf[j];
+        mask |= pass << j;
+    }
+    return mask;
+}
+
+#ifdef __x86_64__
+__attribute__((target("sse4.1"))) static u32
+depth_mask_sse4(float* buf, int n, s32 d, s32 dd, float scale, bool equal) {
+    __m128i vd = _mm_add_epi32(
+        _mm_set1_epi32(d),
+        _mm_mullo_epi32(_mm_set1_epi32(dd), _mm_setr_epi32(0, 1, 2, 3)));
+    __m128i vstep = _mm_set1_epi32(4 * dd);
+    __m128 vscale = _mm_set1_ps(scale);
+    __m128 vabs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 vtol = _mm_set1_ps(0.125f);
+    u32 mask = 0;
+    for (int j = 0; j < SPAN_STEP; j += 4) {
+        __m128 depth = _mm_mul_ps(_mm_cvtepi32_ps(vd), vscale);
+        __m128 cur = _mm_loadu_ps(&buf[j]);
+        __m128 pass;
+        if (equal) {
+            pass = _mm_cmple_ps(_mm_and_ps(_mm_sub_ps(depth, cur), vabs), vtol);
+        } else {
+            pass = _mm_cmplt_ps(depth, cur);
+        }
+        mask |= _mm_movemask_ps(pass) << j;
+        vd = _mm_add_epi32(vd, vstep);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) static u32
+depth_mask_avx2(float* buf, int n, s32 d, s32 dd, float scale, bool equal) {
+    __m256i vd = _mm256_add_epi32(
+        _mm256_set1_epi32(d),
+        _mm256_mullo_epi32(_mm256_set1_epi32(dd),
+                           _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+    __m256i vstep = _mm256_set1_epi32(8 * dd);
+    __m256 vscale = _mm256_set1_ps(scale);
+    __m256 vabs = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 vtol = _mm256_set1_ps(0.125f);
+    u32 mask = 0;
+    for (int j = 0; j < SPAN_STEP; j += 8) {
+        __m256 depth = _mm256_mul_ps(_mm256_cvtepi32_ps(vd), vscale);
+        __m256 cur = _mm256_loadu_ps(&buf[j]);
+        __m256 pass;
+        if (equal) {
+            pass = _mm256_cmp_ps(
+                _mm256_and_ps(_mm256_sub_ps(depth, cur), vabs), vtol,
+                _CMP_LE_OQ);
+        } else {
+            pass = _mm256_cmp_ps(depth, cur, _CMP_LT_OQ);
+        }
+        mask |= _mm256_movemask_ps(pass) << j;
+        vd = _mm256_add_epi32(vd, vstep);
+    }
+    return mask;
+}
+#endif
+
+static DepthMaskFunc select_depth_mask() {
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return depth_mask_avx2;
+    if (__builtin_cpu_supports("sse4.1")) return depth_mask_sse4;
+#endif
+    return depth_mask_scalar;
+}
+
 void* gpu_thread_run(void* data) {
     GPU* gpu = data;
     pthread_mutex_lock(&gpu_mutex);
     while (true) {
-        pthread_cond_wait(&gpu_cond, &gpu_mutex);
+        while (gpu->frame_done == gpu->frame_submitted && !gpu_quit) {
+            pthread_cond_wait(&gpu_cond, &gpu_mutex);
+        }
+        if (gpu_quit) break;
+        u32 frame = gpu->frame_done;
+        pthread_mutex_unlock(&gpu_mutex);
+
+        gpu->rendering = &gpu->frames[frame % GPU_FRAMES];
+        gpu->screen_back = gpu->rendering->framebuffer;
+        gpu->screen_last =
+            gpu->frames[(frame + GPU_FRAMES - 1) % GPU_FRAMES].framebuffer;
         gpu_render(gpu);
+
+        pthread_mutex_lock(&gpu_mutex);
+        __atomic_store_n(&gpu->frame_done, frame + 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&frame_done_cond);
     }
+    pthread_mutex_unlock(&gpu_mutex);
     return NULL;
 }
 
+static void wait_frame(GPU* gpu, u32 frame) {
+    if ((s32) (__atomic_load_n(&gpu->frame_done, __ATOMIC_ACQUIRE) - frame) >= 0)
+        return;
+    gpu->render_waits++;
+    pthread_mutex_lock(&gpu_mutex);
+    while ((s32) (gpu->frame_done - frame) < 0) {
+        pthread_cond_wait(&frame_done_cond, &gpu_mutex);
+    }
+    pthread_mutex_unlock(&gpu_mutex);
+}
+
+static void gx_run(GPU* gpu) {
+    while (gx_done != RING_tail(gx_cmds)) {
+        gxcmd_execute(gpu);
+        __atomic_store_n(&gx_done, gx_done + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void gx_kick() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&geom_sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&geom_mutex);
+        pthread_cond_signal(&geom_cond);
+        pthread_mutex_unlock(&geom_mutex);
+    }
+}
+
+static void* geom_thread_run(void* data) {
+    GPU* gpu = data;
+    while (true) {
+        for (int i = 0; gx_done == RING_tail(gx_cmds) &&
+                        !__atomic_load_n(&geom_quit, __ATOMIC_ACQUIRE);
+             i++) {
+            if (i < GEOM_SPIN) continue;
+            pthread_mutex_lock(&geom_mutex);
+            __atomic_store_n(&geom_sleeping, true, __ATOMIC_SEQ_CST);
+            while (gx_done == __atomic_load_n(&gx_cmds.tail, __ATOMIC_SEQ_CST) &&
+                   !geom_quit) {
+                pthread_cond_wait(&geom_cond, &geom_mutex);
+            }
+            geom_sleeping = false;
+            pthread_mutex_unlock(&geom_mutex);
+            break;
+        }
+        if (__atomic_load_n(&geom_quit, __ATOMIC_ACQUIRE)) return NULL;
+        gx_run(gpu);
+    }
+}
+
 void init_gpu_thread(GPU* gpu) {
+    span_depth_mask = select_depth_mask();
+    span_shade = select_shade_span();
+
+    gpu_quit = false;
     pthread_create(&gpu_thread, NULL, gpu_thread_run, gpu);
-    pthread_detach(gpu_thread);
+
+    n_render_threads = ntremu.render_threads - 1;
+    if (n_render_threads < 0) n_render_threads = 0;
+    if (n_render_threads > MAX_RENDER_THREADS - 1)
+        n_render_threads = MAX_RENDER_THREADS - 1;
+    render_quit = false;
+    for (long i = 0; i < n_render_threads; i++) {
+        pthread_create(&render_threads[i], NULL, render_thread_run, NULL);
+    }
+
+    if (ntremu.geometry_thread) {
+        geom_quit = false;
+        pthread_create(&geom_thread, NULL, geom_thread_run, gpu);
+        geom_threaded = true;
+    }
 }
 
 void destroy_gpu_thread() {
-    pthread_cancel(gpu_thread);
-    pthread_mutex_destroy(&gpu_mutex);
-    pthread_cond_destroy(&gpu_cond);
+    if (geom_threaded) {
+        pthread_mutex_lock(&geom_mutex);
+        geom_quit = true;
+        pthread_cond_signal(&geom_cond);
+        pthread_mutex_unlock(&geom_mutex);
+        pthread_join(geom_thread, NULL);
+        geom_threaded = false;
+    }
+
+    pthread_mutex_lock(&render_mutex);
+    render_quit = true;
+    pthread_cond_broadcast(&render_start);
+    pthread_mutex_unlock(&render_mutex);
+    for (int i = 0; i < n_render_threads; i++) {
+        pthread_join(render_threads[i], NULL);
+    }
+    n_render_threads = 0;
+
+    pthread_mutex_lock(&gpu_mutex);
+    gpu_quit = true;
+    pthread_cond_signal(&gpu_cond);
+    pthread_mutex_unlock(&gpu_mutex);
+    pthread_join(gpu_thread, NULL);
 }
 
 void gpu_init_ptrs(GPU* gpu) {
-    gpu->screen = gpu->framebuffers[0];
-    gpu->screen_back = gpu->framebuffers[1];
+    gpu->rendering = &gpu->frames[GPU_FRAMES - 1];
+    gpu->screen = gpu->rendering->framebuffer;
+    gpu->screen_back = gpu->rendering->framebuffer;
+    gpu->screen_last = gpu->rendering->framebuffer;
 
-    gpu->vertexram = gpu->vertexrambufs[0];
-    gpu->vertexram_rendering = gpu->vertexrambufs[1];
+    gpu->vertexram = &gpu->frames[0].vertexram;
+    gpu->polygonram = gpu->frames[0].polygonram;
+}
 
-    gpu->polygonram = gpu->polygonrambufs[0];
-    gpu->polygonram_rendering = gpu->polygonrambufs[1];
+void gpu_reset_texcache() {
+    for (int i = 0; i < TEXCACHE_SETS; i++) {
+        for (int j = 0; j < TEXCACHE_WAYS; j++) {
+            texcache[i][j].key = 0;
+        }
+    }
 }
 
 void gxfifo_write(GPU* gpu, u32 command) {
@@ -94,14 +381,95 @@ void gxfifo_write(GPU* gpu, u32 command) {
 }
 
 void gxcmd_execute_all(GPU* gpu) {
-    if (!gpu->params_pending) {
-        while (!gpu->blocked && gpu->cmd_fifo.size) {
-            gxcmd_execute(gpu);
+    if (gpu->params_pending) return;
+    while (!gpu->blocked && gpu->cmd_fifo.size) {
+        u8 cmd;
+        FIFO_pop(gpu->cmd_fifo, cmd);
+        u8 h = cmd >> 4;
+        u8 l = cmd & 0xf;
+        int nparms = 0;
+        if (h < 8) nparms = cmd_parms[h][l];
+
+        if (cmd == SWAP_BUFFERS) {
+            gxcmd_wait(gpu);
+            u32 p0;
+            FIFO_pop(gpu->param_fifo, p0);
+            gpu->blocked = true;
+            gpu->w_buffer = p0 & 2;
+            gpu->autosort = !(p0 & 1);
+            if (gpu->drawing || gpu->master->io7.vcount >= NDS_SCREEN_H) {
+                gpu->pending_swapbuffers = true;
+            } else {
+                swap_buffers(gpu);
+            }
+        } else {
+            if (gx_cmds.tail - RING_head(gx_cmds) == GX_RING_CMDS ||
+                gx_params.tail - RING_head(gx_params) + nparms >
+                    GX_RING_PARAMS) {
+                gxcmd_wait(gpu);
+            }
+            for (int i = 0; i < nparms; i++) {
+                u32 p;
+                FIFO_pop(gpu->param_fifo, p);
+                RING_push(gx_params, p);
+            }
+            RING_push(gx_cmds, cmd);
         }
+
+        if (nparms) {
+            gpu->master->io9.gxstat.gxfifo_size -= nparms;
+        } else {
+            gpu->master->io9.gxstat.gxfifo_size--;
+        }
+    }
+
+    if (geom_threaded) gx_kick();
+    else gx_run(gpu);
+}
+
+void gxcmd_wait(GPU* gpu) {
+    if (!geom_threaded) {
+        gx_run(gpu);
+        return;
+    }
+    gx_kick();
+    for (int i = 0; __atomic_load_n(&gx_done, __ATOMIC_ACQUIRE) != gx_cmds.tail;
+         i++) {
+        if (i >= GEOM_SPIN) sched_yield();
     }
 }
 
+void gpu_sync(GPU* gpu) {
+    gxcmd_wait(gpu);
+    IO* io = &gpu->master->io9;
+    if (gpu->ram_overflow) io->disp3dcnt.ram_overflow = 1;
+    if (gpu->mtxstk_error) io->gxstat.mtxstk_error = 1;
+    gpu->ram_overflow = false;
+    gpu->mtxstk_error = false;
+    io->gxstat.boxtest = gpu->boxtest;
+    io->gxstat.projstk_size = gpu->projstk_size;
+    io->gxstat.mtxstk_size = gpu->mtxstk_size;
+    io->ram_count.n_verts = gpu->n_verts;
+    io->ram_count.n_polys = gpu->n_polys;
+    memcpy(io->pos_result, gpu->pos_result, sizeof gpu->pos_result);
+    memcpy(io->vec_result, gpu->vec_result, sizeof gpu->vec_result);
+}
+
 void matmul(mat4* dst, mat4* src) {
+#ifdef __x86_64__
+    __m128 s0 = _mm_loadu_ps(src->p[0]);
+    __m128 s1 = _mm_loadu_ps(src->p[1]);
+    __m128 s2 = _mm_loadu_ps(src->p[2]);
+    __m128 s3 = _mm_loadu_ps(src->p[3]);
+    for (int i = 0; i < 4; i++) {
+        __m128 sum = _mm_setzero_ps();
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(dst->p[i][0]), s0));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(dst->p[i][1]), s1));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(dst->p[i][2]), s2));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(dst->p[i][3]), s3));
+        _mm_storeu_ps(dst->p[i], sum);
+    }
+#else
     mat4 res;
     for (int i = 0; i < 4; i++) {
         for (int j = 0; j < 4; j++) {
@@ -113,31 +481,66 @@ void matmul(mat4* dst, mat4* src) {
         }
     }
     *dst = res;
+#endif
 }
 
-void vecmul(mat4* src, vec4* dst) {
-    vec4 res;
+static void vecmul_n(mat4* src, vec4* dst, int n) {
+#ifdef __x86_64__
+    vec4 zero = {0};
+    __m128 v0 = _mm_loadu_ps(dst[0].p);
+    __m128 v1 = _mm_loadu_ps(n > 1 ? dst[1].p : zero.p);
+    __m128 v2 = _mm_loadu_ps(n > 2 ? dst[2].p : zero.p);
+    __m128 v3 = _mm_loadu_ps(n > 3 ? dst[3].p : zero.p);
+    _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+    __m128 res[4];
     for (int i = 0; i < 4; i++) {
-        float sum = 0;
-        for (int k = 0; k < 4; k++) {
-            sum += src->p[i][k] * dst->p[k];
+        __m128 sum = _mm_setzero_ps();
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(src->p[i][0]), v0));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(src->p[i][1]), v1));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(src->p[i][2]), v2));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(src->p[i][3]), v3));
+        res[i] = sum;
+    }
+    _MM_TRANSPOSE4_PS(res[0], res[1], res[2], res[3]);
+    for (int j = 0; j < n; j++) {
+        _mm_storeu_ps(dst[j].p, res[j]);
+    }
+#else
+    for (int j = 0; j < n; j++) {
+        vec4 res;
+        for (int i = 0; i < 4; i++) {
+            float sum = 0;
+            for (int k = 0; k < 4; k++) {
+                sum += src->p[i][k] * dst[j].p[k];
+            }
+            res.p[i] = sum;
         }
-        res.p[i] = sum;
+        dst[j] = res;
     }
-    *dst = res;
+#endif
 }
 
-void update_mtxs(GPU* gpu) {
-    if (!gpu->mtx_dirty) return;
+void vecmul(mat4* src, vec4* dst) {
+    vecmul_n(src, dst, 1);
+}
+
+static void update_clipmtx(GPU* gpu) {
+    if (!gpu->mtx_dirty && gpu->freecam_gen == ntremu.freecam_gen) return;
     gpu->mtx_dirty = false;
+    gpu->freecam_gen = ntremu.freecam_gen;
 
     gpu->clipmtx = gpu->projmtx;
+    if (ntremu.freecam) matmul(&gpu->clipmtx, &ntremu.freecam_mtx);
     matmul(&gpu->clipmtx, &gpu->posmtx);
+}
+
+void update_mtxs(GPU* gpu) {
+    mat4 clipmtx = gpu->projmtx;
+    matmul(&clipmtx, &gpu->posmtx);
 
     for (int i = 0; i < 4; i++) {
         for (int j = 0; j < 4; j++) {
-            gpu->master->io9.clipmtx_result[j][i] =
-                gpu->clipmtx.p[i][j] * (1 << 12);
+            gpu->master->io9.clipmtx_result[j][i] = clipmtx.p[i][j] * (1 << 12);
         }
     }
     for (int i = 0; i < 3; i++) {
@@ -146,12 +549,6 @@ void update_mtxs(GPU* gpu) {
                 gpu->vecmtx.p[i][j] * (1 << 12);
         }
     }
-
-    if (ntremu.freecam) {
-        gpu->clipmtx = gpu->projmtx;
-        matmul(&gpu->clipmtx, &ntremu.freecam_mtx);
-        matmul(&gpu->clipmtx, &gpu->posmtx);
-    }
 }
 
 void interp_vtxs(vertex* cur, vertex* prev, float diffcur, float diffprev,
@@ -216,17 +613,44 @@ float calc_area(vec4* v0, vec4* v1, vec4* v2) {
     return ax * by - ay * bx;
 }
 
+static void load_vtx(VertexRAM* vr, u16 i, vertex* v) {
+    v->v = vr->pos[i];
+    v->vt.p[0] = vr->s[i];
+    v->vt.p[1] = vr->t[i];
+    v->vt.p[2] = 0;
+    v->vt.p[3] = 0;
+    v->r = vr->r[i];
+    v->g = vr->g[i];
+    v->b = vr->b[i];
+}
+
+static void store_vtx(VertexRAM* vr, u16 i, vertex* v) {
+    vr->pos[i] = v->v;
+    vr->s[i] = v->vt.p[0];
+    vr->t[i] = v->vt.p[1];
+    vr->r[i] = v->r;
+    vr->g[i] = v->g;
+    vr->b[i] = v->b;
+}
+
+static s16 screen_coord(float f) {
+    int i = f;
+    if (i < INT16_MIN) return INT16_MIN;
+    if (i > INT16_MAX) return INT16_MAX;
+    return i;
+}
+
 bool add_poly(GPU* gpu, int n_orig, bool strip) {
     if (gpu->n_polys == MAX_POLY) {
-        gpu->master->io9.disp3dcnt.ram_overflow = 1;
+        gpu->ram_overflow = true;
         return false;
     }
 
     vertex vtxs[MAX_POLY_N];
 
     if (strip) {
-        vtxs[0] = *gpu->cur_poly_strip[0];
-        vtxs[1] = *gpu->cur_poly_strip[1];
+        load_vtx(gpu->vertexram, gpu->cur_poly_strip[0], &vtxs[0]);
+        load_vtx(gpu->vertexram, gpu->cur_poly_strip[1], &vtxs[1]);
         for (int i = 2; i < n_orig; i++) {
             vtxs[i] = gpu->cur_poly_vtxs[i];
         }
@@ -247,17 +671,17 @@ bool add_poly(GPU* gpu, int n_orig, bool strip) {
     if ((area < 0 && !gpu->cur_attr.back) || (area > 0 && !gpu->cur_attr.front))
         return false;
 
+    VertexRAM* vr = gpu->vertexram;
     if (!strip || clipped) {
         for (int i = 0; i < n; i++) {
             if (gpu->n_verts == MAX_VTX) {
-                gpu->master->io9.disp3dcnt.ram_overflow = 1;
+                gpu->ram_overflow = true;
                 return false;
             }
 
-            gpu->vertexram[gpu->n_verts] = vtxs[i];
-            gpu->polygonram[gpu->n_polys].p[i] = &gpu->vertexram[gpu->n_verts];
-            if (!clipped)
-                gpu->cur_poly_strip[i] = &gpu->vertexram[gpu->n_verts];
+            store_vtx(vr, gpu->n_verts, &vtxs[i]);
+            gpu->polygonram[gpu->n_polys].p[i] = gpu->n_verts;
+            if (!clipped) gpu->cur_poly_strip[i] = gpu->n_verts;
             gpu->n_verts++;
         }
     } else {
@@ -266,39 +690,125 @@ bool add_poly(GPU* gpu, int n_orig, bool strip) {
 
         for (int i = 2; i < n; i++) {
             if (gpu->n_verts == MAX_VTX) {
-                gpu->master->io9.disp3dcnt.ram_overflow = 1;
+                gpu->ram_overflow = true;
                 return false;
             }
 
-            gpu->vertexram[gpu->n_verts] = vtxs[i];
-            gpu->polygonram[gpu->n_polys].p[i] = &gpu->vertexram[gpu->n_verts];
-            gpu->cur_poly_strip[i] = &gpu->vertexram[gpu->n_verts];
+            store_vtx(vr, gpu->n_verts, &vtxs[i]);
+            gpu->polygonram[gpu->n_polys].p[i] = gpu->n_verts;
+            gpu->cur_poly_strip[i] = gpu->n_verts;
             gpu->n_verts++;
         }
     }
 
     gpu->polygonram[gpu->n_polys].n = n;
     for (int i = 0; i < n; i++) {
-        vertex* v = gpu->polygonram[gpu->n_polys].p[i];
-        v->sx = ((v->v.p[0] / v->v.p[3]) + 1) * gpu->view_w / 2 + gpu->view_x;
-        v->sy = (1 - (v->v.p[1] / v->v.p[3])) * gpu->view_h / 2 + gpu->view_y;
+        u16 j = gpu->polygonram[gpu->n_polys].p[i];
+        float* v = vr->pos[j].p;
+        vr->sx[j] = screen_coord(((v[0] / v[3]) + 1) * gpu->view_w / 2 +
+                                 gpu->view_x);
+        vr->sy[j] = screen_coord((1 - (v[1] / v[3])) * gpu->view_h / 2 +
+                                 gpu->view_y);
     }
     gpu->polygonram[gpu->n_polys].attr = gpu->cur_attr;
     gpu->polygonram[gpu->n_polys].texparam = gpu->cur_texparam;
     gpu->polygonram[gpu->n_polys].pltt_base = gpu->cur_pltt_base;
     gpu->n_polys++;
 
-    gpu->master->io9.ram_count.n_verts = gpu->n_verts;
-    gpu->master->io9.ram_count.n_polys = gpu->n_polys;
     return !clipped;
 }
 
+static void decode_vtx(u8 cmd, u32 p0, u32 p1, vec4* v) {
+    switch (cmd) {
+        case VTX_16:
+            v->p[0] = ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
+            v->p[1] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
+            v->p[2] = ((s32) (p1 & 0xffff) << 16) / (float) (1 << 28);
+            v->p[3] = 1;
+            break;
+        case VTX_10:
+            v->p[0] = ((s32) (p0 & 0x3ff) << 22) / (float) (1 << 28);
+            v->p[1] = ((s32) (p0 & (0x3ff << 10)) << 12) / (float) (1 << 28);
+            v->p[2] = ((s32) (p0 & (0x3ff << 20)) << 2) / (float) (1 << 28);
+            v->p[3] = 1;
+            break;
+        case VTX_XY:
+            v->p[0] = ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
+            v->p[1] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
+            break;
+        case VTX_XZ:
+            v->p[0] = ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
+            v->p[2] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
+            break;
+        case VTX_YZ:
+            v->p[1] = ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
+            v->p[2] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
+            break;
+        case VTX_DIFF:
+            v->p[0] += ((s32) (p0 & 0x3ff) << 22 >> 6) / (float) (1 << 28);
+            v->p[1] +=
+                ((s32) (p0 & (0x3ff << 10)) << 12 >> 6) / (float) (1 << 28);
+            v->p[2] +=
+                ((s32) (p0 & (0x3ff << 20)) << 2 >> 6) / (float) (1 << 28);
+            break;
+    }
+}
+
+static bool batch_safe(u8 cmd) {
+    switch (cmd) {
+        case 0:
+        case COLOR:
+        case NORMAL:
+        case TEXCOORD:
+        case POLYGON_ATTR:
+        case TEXIMAGE_PARAM:
+        case PLTT_BASE:
+        case DIF_AMB:
+        case SPE_EMI:
+        case LIGHT_VECTOR:
+        case LIGHT_COLOR:
+        case SHININESS:
+        case BEGIN_VTXS:
+        case END_VTXS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void batch_vtxs(GPU* gpu) {
+    vec4 v = gpu->cur_vtx.v;
+    gpu->vtx_batch[0] = v;
+    gpu->vtx_batch_n = 1;
+    gpu->vtx_batch_i = 0;
+
+    u32 tail = RING_tail(gx_cmds);
+    u32 pi = gx_params.head;
+    for (u32 c = gx_cmds.head; c != tail && gpu->vtx_batch_n < VTX_BATCH;
+         c++) {
+        u8 cmd = RING_at(gx_cmds, c);
+        int nparms = cmd >> 4 < 8 ? cmd_parms[cmd >> 4][cmd & 0xf] : 0;
+        if (VTX_16 <= cmd && cmd <= VTX_DIFF) {
+            decode_vtx(cmd, RING_at(gx_params, pi),
+                       nparms > 1 ? RING_at(gx_params, pi + 1) : 0, &v);
+            gpu->vtx_batch[gpu->vtx_batch_n++] = v;
+        } else if (!batch_safe(cmd)) {
+            break;
+        }
+        pi += nparms;
+    }
+
+    vecmul_n(&gpu->clipmtx, gpu->vtx_batch, gpu->vtx_batch_n);
+}
+
 void add_vtx(GPU* gpu) {
     if (gpu->n_verts == MAX_VTX) {
-        gpu->master->io9.disp3dcnt.ram_overflow = 1;
+        gpu->ram_overflow = true;
+        gpu->vtx_batch_n = 0;
+        gpu->vtx_batch_i = 0;
         return;
     }
-    update_mtxs(gpu);
+    update_clipmtx(gpu);
 
     if (gpu->cur_texparam.transform == TEXTF_VTX) {
         gpu->cur_vtx.vt = gpu->cur_vtx.v;
@@ -310,8 +820,9 @@ void add_vtx(GPU* gpu) {
         gpu->cur_vtx.vt.p[1] += gpu->cur_texcoord.p[1];
     }
 
+    if (gpu->vtx_batch_i == gpu->vtx_batch_n) batch_vtxs(gpu);
     vertex v = gpu->cur_vtx;
-    vecmul(&gpu->clipmtx, &v.v);
+    v.v = gpu->vtx_batch[gpu->vtx_batch_i++];
 
     if (gpu->cur_vtx_ct < 2) {
         gpu->cur_poly_vtxs[gpu->cur_vtx_ct++] = v;
@@ -361,10 +872,12 @@ void add_vtx(GPU* gpu) {
                     } else {
                         if (gpu->tri_orient) {
                             gpu->cur_poly_vtxs[0] = gpu->cur_poly_vtxs[2];
-                            gpu->cur_poly_vtxs[1] = *gpu->cur_poly_strip[1];
+                            load_vtx(gpu->vertexram, gpu->cur_poly_strip[1],
+                                     &gpu->cur_poly_vtxs[1]);
                         } else {
                             gpu->cur_poly_vtxs[1] = gpu->cur_poly_vtxs[2];
-                            gpu->cur_poly_vtxs[0] = *gpu->cur_poly_strip[0];
+                            load_vtx(gpu->vertexram, gpu->cur_poly_strip[0],
+                                     &gpu->cur_poly_vtxs[0]);
                         }
                         gpu->cur_vtx_ct = 2;
                     }
@@ -392,49 +905,70 @@ void add_vtx(GPU* gpu) {
 }
 
 void normalize_vtxs(GPU* gpu) {
-    for (int i = 0; i < gpu->n_verts; i++) {
-        float w = gpu->vertexram[i].v.p[3];
-        gpu->vertexram[i].v.p[3] = 1 / w;
-        gpu->vertexram[i].v.p[0] /= w;
-        gpu->vertexram[i].v.p[1] /= w;
-        gpu->vertexram[i].v.p[2] /= w;
-        gpu->vertexram[i].vt.p[0] /= w;
-        gpu->vertexram[i].vt.p[1] /= w;
-        gpu->vertexram[i].r /= w;
-        gpu->vertexram[i].g /= w;
-        gpu->vertexram[i].b /= w;
+    VertexRAM* vr = gpu->vertexram;
+    int i = 0;
+#ifdef __x86_64__
+    __m128 one = _mm_set1_ps(1);
+    for (; i + 4 <= gpu->n_verts; i += 4) {
+        __m128 p[4];
+        for (int j = 0; j < 4; j++) {
+            p[j] = _mm_loadu_ps(vr->pos[i + j].p);
+            __m128 w = _mm_shuffle_ps(p[j], p[j], _MM_SHUFFLE(3, 3, 3, 3));
+            __m128 q = _mm_div_ps(p[j], w);
+            __m128 hi = _mm_unpackhi_ps(q, _mm_div_ps(one, w));
+            _mm_storeu_ps(vr->pos[i + j].p,
+                          _mm_shuffle_ps(q, hi, _MM_SHUFFLE(3, 0, 1, 0)));
+        }
+        __m128 w = _mm_movehl_ps(_mm_unpackhi_ps(p[2], p[3]),
+                                 _mm_unpackhi_ps(p[0], p[1]));
+        _mm_storeu_ps(&vr->s[i], _mm_div_ps(_mm_loadu_ps(&vr->s[i]), w));
+        _mm_storeu_ps(&vr->t[i], _mm_div_ps(_mm_loadu_ps(&vr->t[i]), w));
+        _mm_storeu_ps(&vr->r[i], _mm_div_ps(_mm_loadu_ps(&vr->r[i]), w));
+        _mm_storeu_ps(&vr->g[i], _mm_div_ps(_mm_loadu_ps(&vr->g[i]), w));
+        _mm_storeu_ps(&vr->b[i], _mm_div_ps(_mm_loadu_ps(&vr->b[i]), w));
+    }
+#endif
+    for (; i < gpu->n_verts; i++) {
+        float w = vr->pos[i].p[3];
+        vr->pos[i].p[3] = 1 / w;
+        vr->pos[i].p[0] /= w;
+        vr->pos[i].p[1] /= w;
+        vr->pos[i].p[2] /= w;
+        vr->s[i] /= w;
+        vr->t[i] /= w;
+        vr->r[i] /= w;
+        vr->g[i] /= w;
+        vr->b[i] /= w;
     }
 }
 
 void gxcmd_execute(GPU* gpu) {
     u8 cmd;
-    FIFO_pop(gpu->cmd_fifo, cmd);
+    RING_pop(gx_cmds, cmd);
     u32 p0, p1, p2;
     switch (cmd) {
         case MTX_MODE:
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             gpu->mtx_mode = p0 & 3;
             break;
         case MTX_PUSH:
             switch (gpu->mtx_mode) {
                 case MM_PROJ:
                     if (gpu->projstk_size == 1)
-                        gpu->master->io9.gxstat.mtxstk_error = 1;
+                        gpu->mtxstk_error = true;
                     else {
                         gpu->projmtx_stk[gpu->projstk_size++] = gpu->projmtx;
                     }
-                    gpu->master->io9.gxstat.projstk_size = gpu->projstk_size;
                     break;
                 case MM_POS:
                 case MM_POSVEC:
                     if (gpu->mtxstk_size == 31)
-                        gpu->master->io9.gxstat.mtxstk_error = 1;
+                        gpu->mtxstk_error = true;
                     else {
                         gpu->posmtx_stk[gpu->mtxstk_size] = gpu->posmtx;
                         gpu->vecmtx_stk[gpu->mtxstk_size] = gpu->vecmtx;
                         gpu->mtxstk_size++;
                     }
-                    gpu->master->io9.gxstat.mtxstk_size = gpu->mtxstk_size;
                     break;
                 case MM_TEX:
                     gpu->texmtx_stack[0] = gpu->texmtx;
@@ -442,12 +976,11 @@ void gxcmd_execute(GPU* gpu) {
             }
             break;
         case MTX_POP:
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             switch (gpu->mtx_mode) {
                 case MM_PROJ:
                     gpu->projstk_size = 0;
                     gpu->projmtx = gpu->projmtx_stk[gpu->projstk_size];
-                    gpu->master->io9.gxstat.projstk_size = gpu->projstk_size;
                     break;
                 case MM_POS:
                 case MM_POSVEC:
@@ -455,7 +988,6 @@ void gxcmd_execute(GPU* gpu) {
                     gpu->mtxstk_size &= 31;
                     gpu->posmtx = gpu->posmtx_stk[gpu->mtxstk_size];
                     gpu->vecmtx = gpu->vecmtx_stk[gpu->mtxstk_size];
-                    gpu->master->io9.gxstat.mtxstk_size = gpu->mtxstk_size;
                     break;
                 case MM_TEX:
                     gpu->texmtx = gpu->texmtx_stack[0];
@@ -464,7 +996,7 @@ void gxcmd_execute(GPU* gpu) {
             gpu->mtx_dirty = true;
             break;
         case MTX_STORE:
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             switch (gpu->mtx_mode) {
                 case MM_PROJ:
                     gpu->projmtx_stk[0] = gpu->projmtx;
@@ -482,7 +1014,7 @@ void gxcmd_execute(GPU* gpu) {
             }
             break;
         case MTX_RESTORE:
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             switch (gpu->mtx_mode) {
                 case MM_PROJ:
                     gpu->projmtx = gpu->projmtx_stk[0];
@@ -529,7 +1061,7 @@ void gxcmd_execute(GPU* gpu) {
             for (int j = 0; j < 4; j++) {
                 for (int i = 0; i < 4; i++) {
                     s32 p;
-                    FIFO_pop(gpu->param_fifo, p);
+                    RING_pop(gx_params, p);
                     m.p[i][j] = (s32) p / (float) (1 << 12);
                 }
             }
@@ -556,7 +1088,7 @@ void gxcmd_execute(GPU* gpu) {
             for (int j = 0; j < 4; j++) {
                 for (int i = 0; i < 3; i++) {
                     s32 p;
-                    FIFO_pop(gpu->param_fifo, p);
+                    RING_pop(gx_params, p);
                     m.p[i][j] = p / (float) (1 << 12);
                 }
             }
@@ -585,7 +1117,7 @@ void gxcmd_execute(GPU* gpu) {
             for (int j = 0; j < 4; j++) {
                 for (int i = 0; i < 4; i++) {
                     s32 p;
-                    FIFO_pop(gpu->param_fifo, p);
+                    RING_pop(gx_params, p);
                     m.p[i][j] = p / (float) (1 << 12);
                 }
             }
@@ -612,7 +1144,7 @@ void gxcmd_execute(GPU* gpu) {
             for (int j = 0; j < 4; j++) {
                 for (int i = 0; i < 3; i++) {
                     s32 p;
-                    FIFO_pop(gpu->param_fifo, p);
+                    RING_pop(gx_params, p);
                     m.p[i][j] = p / (float) (1 << 12);
                 }
             }
@@ -641,7 +1173,7 @@ void gxcmd_execute(GPU* gpu) {
             for (int j = 0; j < 3; j++) {
                 for (int i = 0; i < 3; i++) {
                     s32 p;
-                    FIFO_pop(gpu->param_fifo, p);
+                    RING_pop(gx_params, p);
                     m.p[i][j] = p / (float) (1 << 12);
                 }
             }
@@ -669,11 +1201,11 @@ void gxcmd_execute(GPU* gpu) {
         case MTX_SCALE: {
             mat4 m = {0};
             s32 p;
-            FIFO_pop(gpu->param_fifo, p);
+            RING_pop(gx_params, p);
             m.p[0][0] = p / (float) (1 << 12);
-            FIFO_pop(gpu->param_fifo, p);
+            RING_pop(gx_params, p);
             m.p[1][1] = p / (float) (1 << 12);
-            FIFO_pop(gpu->param_fifo, p);
+            RING_pop(gx_params, p);
             m.p[2][2] = p / (float) (1 << 12);
             m.p[3][3] = 1;
             switch (gpu->mtx_mode) {
@@ -697,11 +1229,11 @@ void gxcmd_execute(GPU* gpu) {
             m.p[1][1] = 1;
             m.p[2][2] = 1;
             s32 p;
-            FIFO_pop(gpu->param_fifo, p);
+            RING_pop(gx_params, p);
             m.p[0][3] = p / (float) (1 << 12);
-            FIFO_pop(gpu->param_fifo, p);
+            RING_pop(gx_params, p);
             m.p[1][3] = p / (float) (1 << 12);
-            FIFO_pop(gpu->param_fifo, p);
+            RING_pop(gx_params, p);
             m.p[2][3] = p / (float) (1 << 12);
             m.p[3][3] = 1;
             switch (gpu->mtx_mode) {
@@ -724,7 +1256,7 @@ void gxcmd_execute(GPU* gpu) {
         }
         case COLOR: {
             u16 color;
-            FIFO_pop(gpu->param_fifo, color);
+            RING_pop(gx_params, color);
             gpu->cur_vtx.r = color & 0x1f;
             gpu->cur_vtx.g = (color >> 5) & 0x1f;
             gpu->cur_vtx.b = (color >> 10) & 0x1f;
@@ -732,7 +1264,7 @@ void gxcmd_execute(GPU* gpu) {
         }
         case NORMAL: {
             vec4 normal;
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             normal.p[0] = ((s32) (p0 & 0x3ff) << 22) / (float) (u32) (1 << 31);
             normal.p[1] =
                 ((s32) (p0 & (0x3ff << 10)) << 12) / (float) (u32) (1 << 31);
@@ -796,7 +1328,7 @@ void gxcmd_execute(GPU* gpu) {
             break;
         }
         case TEXCOORD:
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             gpu->cur_texcoord.p[0] =
                 ((s32) (p0 & 0xffff) << 16) / (float) (1 << 20);
             gpu->cur_texcoord.p[1] =
@@ -809,70 +1341,32 @@ void gxcmd_execute(GPU* gpu) {
             }
             break;
         case VTX_16:
-            FIFO_pop(gpu->param_fifo, p0);
-            FIFO_pop(gpu->param_fifo, p1);
-            gpu->cur_vtx.v.p[0] =
-                ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[1] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[2] =
-                ((s32) (p1 & 0xffff) << 16) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[3] = 1;
+            RING_pop(gx_params, p0);
+            RING_pop(gx_params, p1);
+            decode_vtx(cmd, p0, p1, &gpu->cur_vtx.v);
             add_vtx(gpu);
             break;
         case VTX_10:
-            FIFO_pop(gpu->param_fifo, p0);
-            gpu->cur_vtx.v.p[0] =
-                ((s32) (p0 & 0x3ff) << 22) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[1] =
-                ((s32) (p0 & (0x3ff << 10)) << 12) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[2] =
-                ((s32) (p0 & (0x3ff << 20)) << 2) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[3] = 1;
-            add_vtx(gpu);
-            break;
         case VTX_XY:
-            FIFO_pop(gpu->param_fifo, p0);
-            gpu->cur_vtx.v.p[0] =
-                ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[1] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
-            add_vtx(gpu);
-            break;
         case VTX_XZ:
-            FIFO_pop(gpu->param_fifo, p0);
-            gpu->cur_vtx.v.p[0] =
-                ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[2] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
-            add_vtx(gpu);
-            break;
         case VTX_YZ:
-            FIFO_pop(gpu->param_fifo, p0);
-            gpu->cur_vtx.v.p[1] =
-                ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[2] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
-            add_vtx(gpu);
-            break;
         case VTX_DIFF:
-            FIFO_pop(gpu->param_fifo, p0);
-            gpu->cur_vtx.v.p[0] +=
-                ((s32) (p0 & 0x3ff) << 22 >> 6) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[1] +=
-                ((s32) (p0 & (0x3ff << 10)) << 12 >> 6) / (float) (1 << 28);
-            gpu->cur_vtx.v.p[2] +=
-                ((s32) (p0 & (0x3ff << 20)) << 2 >> 6) / (float) (1 << 28);
+            RING_pop(gx_params, p0);
+            decode_vtx(cmd, p0, 0, &gpu->cur_vtx.v);
             add_vtx(gpu);
             break;
         case POLYGON_ATTR:
-            FIFO_pop(gpu->param_fifo, gpu->next_attr.w);
+            RING_pop(gx_params, gpu->next_attr.w);
             break;
         case TEXIMAGE_PARAM:
-            FIFO_pop(gpu->param_fifo, gpu->cur_texparam.w);
+            RING_pop(gx_params, gpu->cur_texparam.w);
             break;
         case PLTT_BASE:
-            FIFO_pop(gpu->param_fifo, gpu->cur_pltt_base);
+            RING_pop(gx_params, gpu->cur_pltt_base);
             gpu->cur_pltt_base &= 0x1fff;
             break;
         case DIF_AMB:
-            FIFO_pop(gpu->param_fifo, gpu->cur_mtl0.w);
+            RING_pop(gx_params, gpu->cur_mtl0.w);
             if (gpu->cur_mtl0.vtx_color) {
                 gpu->cur_vtx.r = gpu->cur_mtl0.dif_r;
                 gpu->cur_vtx.g = gpu->cur_mtl0.dif_g;
@@ -880,10 +1374,10 @@ void gxcmd_execute(GPU* gpu) {
             }
             break;
         case SPE_EMI:
-            FIFO_pop(gpu->param_fifo, gpu->cur_mtl1.w);
+            RING_pop(gx_params, gpu->cur_mtl1.w);
             break;
         case LIGHT_VECTOR: {
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             int l = p0 >> 30;
             gpu->lightvec[l].p[0] =
                 ((s32) (p0 & 0x3ff) << 22) / (float) (u32) (1 << 31);
@@ -899,41 +1393,28 @@ void gxcmd_execute(GPU* gpu) {
             break;
         }
         case LIGHT_COLOR: {
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             int l = p0 >> 30;
             gpu->lightcol[l] = p0;
             break;
         }
         case SHININESS:
             for (int i = 0; i < 128; i += 4) {
-                FIFO_pop(gpu->param_fifo, *(u32*) &gpu->shininess[i]);
+                RING_pop(gx_params, *(u32*) &gpu->shininess[i]);
             }
             break;
         case BEGIN_VTXS:
             gpu->cur_attr = gpu->next_attr;
             gpu->cur_vtx_ct = 0;
             gpu->tri_orient = false;
-            FIFO_pop(gpu->param_fifo, gpu->poly_mode);
+            RING_pop(gx_params, gpu->poly_mode);
             gpu->poly_mode &= 3;
             break;
         case END_VTXS:
             break;
-        case SWAP_BUFFERS: {
-            gpu->blocked = true;
-            FIFO_pop(gpu->param_fifo, p0);
-            gpu->w_buffer = p0 & 2;
-            gpu->autosort = !(p0 & 1);
-
-            if (gpu->drawing || gpu->master->io7.vcount >= NDS_SCREEN_H) {
-                gpu->pending_swapbuffers = true;
-                break;
-            }
-            swap_buffers(gpu);
-            break;
-        }
         case VIEWPORT: {
             int x0, y0, x1, y1;
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             x0 = p0 & 0xff;
             y0 = (p0 >> 8) & 0xff;
             x1 = (p0 >> 0x10) & 0xff;
@@ -945,10 +1426,10 @@ void gxcmd_execute(GPU* gpu) {
             break;
         }
         case BOX_TEST: {
-            update_mtxs(gpu);
-            FIFO_pop(gpu->param_fifo, p0);
-            FIFO_pop(gpu->param_fifo, p1);
-            FIFO_pop(gpu->param_fifo, p2);
+            update_clipmtx(gpu);
+            RING_pop(gx_params, p0);
+            RING_pop(gx_params, p1);
+            RING_pop(gx_params, p2);
             vec4 p;
             p.p[0] = ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
             p.p[1] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
@@ -971,38 +1452,38 @@ void gxcmd_execute(GPU* gpu) {
             static const int box_faces[6][4] = {{0, 1, 3, 2}, {0, 2, 6, 4},
                                                 {0, 4, 5, 1}, {7, 6, 4, 5},
                                                 {7, 5, 1, 3}, {7, 3, 2, 6}};
-            gpu->master->io9.gxstat.boxtest = 0;
+            gpu->boxtest = false;
             for (int i = 0; i < 6; i++) {
                 face[0].v = box[box_faces[i][0]];
                 face[1].v = box[box_faces[i][1]];
                 face[2].v = box[box_faces[i][2]];
                 face[3].v = box[box_faces[i][3]];
                 if (clip_poly(face, 4)) {
-                    gpu->master->io9.gxstat.boxtest = 1;
+                    gpu->boxtest = true;
                     break;
                 }
             }
             break;
         }
         case POS_TEST:
-            FIFO_pop(gpu->param_fifo, p0);
-            FIFO_pop(gpu->param_fifo, p1);
+            RING_pop(gx_params, p0);
+            RING_pop(gx_params, p1);
             gpu->cur_vtx.v.p[0] =
                 ((s32) (p0 & 0xffff) << 16) / (float) (1 << 28);
             gpu->cur_vtx.v.p[1] = (s32) (p0 & 0xffff0000) / (float) (1 << 28);
             gpu->cur_vtx.v.p[2] =
                 ((s32) (p1 & 0xffff) << 16) / (float) (1 << 28);
             gpu->cur_vtx.v.p[3] = 1;
-            update_mtxs(gpu);
+            update_clipmtx(gpu);
             vec4 pos = gpu->cur_vtx.v;
             vecmul(&gpu->clipmtx, &pos);
-            gpu->master->io9.pos_result[0] = pos.p[0] * (1 << 12);
-            gpu->master->io9.pos_result[1] = pos.p[1] * (1 << 12);
-            gpu->master->io9.pos_result[2] = pos.p[2] * (1 << 12);
-            gpu->master->io9.pos_result[3] = pos.p[3] * (1 << 12);
+            gpu->pos_result[0] = pos.p[0] * (1 << 12);
+            gpu->pos_result[1] = pos.p[1] * (1 << 12);
+            gpu->pos_result[2] = pos.p[2] * (1 << 12);
+            gpu->pos_result[3] = pos.p[3] * (1 << 12);
             break;
         case VEC_TEST: {
-            FIFO_pop(gpu->param_fifo, p0);
+            RING_pop(gx_params, p0);
             vec4 v;
             v.p[0] = ((s32) (p0 & 0x3ff) << 22) / (float) (u32) (1 << 31);
             v.p[1] =
@@ -1011,48 +1492,64 @@ void gxcmd_execute(GPU* gpu) {
                 ((s32) (p0 & (0x3ff << 20)) << 2) / (float) (u32) (1 << 31);
             v.p[3] = 0;
             vecmul(&gpu->vecmtx, &v);
-            gpu->master->io9.vec_result[0] = v.p[0] * (1 << 12);
-            gpu->master->io9.vec_result[1] = v.p[1] * (1 << 12);
-            gpu->master->io9.vec_result[2] = v.p[2] * (1 << 12);
+            gpu->vec_result[0] = v.p[0] * (1 << 12);
+            gpu->vec_result[1] = v.p[1] * (1 << 12);
+            gpu->vec_result[2] = v.p[2] * (1 << 12);
         }
     }
-
-    u8 h = cmd >> 4;
-    u8 l = cmd & 0xf;
-    int nparms = 0;
-    if (h < 8) nparms = cmd_parms[h][l];
-    if (nparms) {
-        gpu->master->io9.gxstat.gxfifo_size -= nparms;
-    } else {
-        gpu->master->io9.gxstat.gxfifo_size--;
-    }
 }
 
 void swap_buffers(GPU* gpu) {
     normalize_vtxs(gpu);
 
-    void* tmp = gpu->vertexram;
-    gpu->vertexram = gpu->vertexram_rendering;
-    gpu->vertexram_rendering = tmp;
-    tmp = gpu->polygonram;
-    gpu->polygonram = gpu->polygonram_rendering;
-    gpu->polygonram_rendering = tmp;
-    gpu->n_polys_rendering = gpu->n_polys;
+    u32 frame = gpu->frame_submitted;
+    GPUFrame* f = &gpu->frames[frame % GPU_FRAMES];
+    f->n_polys = gpu->n_polys;
+    f->w_buffer = gpu->w_buffer;
+    f->io.disp3dcnt = gpu->master->io9.disp3dcnt;
+    memcpy(&f->io.b[EDGE_COLOR], &gpu->master->io9.b[EDGE_COLOR],
+           TOON_TABLE + 0x40 - EDGE_COLOR);
+
+    if (gpu->screen == f->framebuffer) {
+        wait_frame(gpu, frame - 1);
+        gpu->screen = gpu->frames[(frame - 2) % GPU_FRAMES].framebuffer;
+        gpu->frame_shown = frame - 1;
+    }
+
+    pthread_mutex_lock(&gpu_mutex);
+    __atomic_store_n(&gpu->frame_submitted, frame + 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&gpu_cond);
+    pthread_mutex_unlock(&gpu_mutex);
+
+    wait_frame(gpu, frame - 1);
+    gpu->vertexram = &gpu->frames[(frame + 1) % GPU_FRAMES].vertexram;
+    gpu->polygonram = gpu->frames[(frame + 1) % GPU_FRAMES].polygonram;
     gpu->n_verts = 0;
     gpu->n_polys = 0;
     gpu->master->io9.ram_count.w = 0;
 
     gpu->drawing = true;
+}
 
-    pthread_cond_signal(&gpu_cond);
-    pthread_mutex_unlock(&gpu_mutex);
+void gpu_show_frame(GPU* gpu) {
+    if (gpu->frame_shown == gpu->frame_presented) return;
+    wait_frame(gpu, gpu->frame_presented);
+    gpu->screen =
+        gpu->frames[(gpu->frame_presented - 1) % GPU_FRAMES].framebuffer;
+    gpu->frame_shown = gpu->frame_presented;
 }
 
-void render_line(GPU* gpu, vertex* v0, vertex* v1) {
-    int x0 = v0->sx;
-    int y0 = v0->sy;
-    int x1 = v1->sx;
-    int y1 = v1->sy;
+void gpu_render_wait(GPU* gpu) {
+    wait_frame(gpu, gpu->frame_submitted);
+}
+
+void render_line(GPU* gpu, u16 v0, u16 v1, int xmin, int xmax, int ymin,
+                 int ymax) {
+    VertexRAM* vr = &gpu->rendering->vertexram;
+    int x0 = vr->sx[v0];
+    int y0 = vr->sy[v0];
+    int x1 = vr->sx[v1];
+    int y1 = vr->sy[v1];
 
     float m = (float) (y1 - y0) / (x1 - x0);
     if (fabsf(m) > 1) {
@@ -1068,7 +1565,8 @@ void render_line(GPU* gpu, vertex* v0, vertex* v1) {
         if (y1 >= NDS_SCREEN_H) y1 = NDS_SCREEN_H - 1;
         for (int y = y0; y <= y1; y++, x += m) {
             int sx = x;
-            if (sx < 0 || sx >= NDS_SCREEN_W) continue;
+            if (sx < xmin || sx >= xmax) continue;
+            if (y < ymin || y >= ymax) continue;
             gpu->screen_back[y][sx] = 0x1f801f;
         }
     } else {
@@ -1083,44 +1581,47 @@ void render_line(GPU* gpu, vertex* v0, vertex* v1) {
         if (x1 >= NDS_SCREEN_W) x1 = NDS_SCREEN_W - 1;
         for (int x = x0; x <= x1; x++, y += m) {
             int sy = y;
-            if (sy < 0 || sy >= NDS_SCREEN_H) continue;
+            if (x < xmin || x >= xmax) continue;
+            if (sy < ymin || sy >= ymax) continue;
             gpu->screen_back[sy][x] = 0x1f801f;
         }
     }
 }
 
-void render_polygon_wireframe(GPU* gpu, poly* p) {
+void render_polygon_wireframe(GPU* gpu, poly* p, int xmin, int xmax, int ymin,
+                              int ymax) {
     for (int i = 0; i < p->n; i++) {
         int next = (i + 1 == p->n) ? 0 : i + 1;
-        render_line(gpu, p->p[i], p->p[next]);
+        render_line(gpu, p->p[i], p->p[next], xmin, xmax, ymin, ymax);
     }
 }
 
-void render_line_attrs(GPU* gpu, vertex* v0, vertex* v1,
-                       struct interp_attrs* left, struct interp_attrs* right) {
+void render_line_attrs(GPU* gpu, u16 v0, u16 v1, struct interp_attrs* left,
+                       struct interp_attrs* right) {
+    VertexRAM* vr = &gpu->rendering->vertexram;
 
-    int x0 = v0->sx;
-    int y0 = v0->sy;
-    int x1 = v1->sx;
-    int y1 = v1->sy;
+    int x0 = vr->sx[v0];
+    int y0 = vr->sy[v0];
+    int x1 = vr->sx[v1];
+    int y1 = vr->sy[v1];
 
     struct interp_attrs i0, i1;
 
-    i0.z = v0->v.p[2];
-    i0.w = v0->v.p[3];
-    i0.s = v0->vt.p[0];
-    i0.t = v0->vt.p[1];
-    i0.r = v0->r;
-    i0.g = v0->g;
-    i0.b = v0->b;
-
-    i1.z = v1->v.p[2];
-    i1.w = v1->v.p[3];
-    i1.s = v1->vt.p[0];
-    i1.t = v1->vt.p[1];
-    i1.r = v1->r;
-    i1.g = v1->g;
-    i1.b = v1->b;
+    i0.z = vr->pos[v0].p[2];
+    i0.w = vr->pos[v0].p[3];
+    i0.s = vr->s[v0];
+    i0.t = vr->t[v0];
+    i0.r = vr->r[v0];
+    i0.g = vr->g[v0];
+    i0.b = vr->b[v0];
+
+    i1.z = vr->pos[v1].p[2];
+    i1.w = vr->pos[v1].p[3];
+    i1.s = vr->s[v1];
+    i1.t = vr->t[v1];
+    i1.r = vr->r[v1];
+    i1.g = vr->g[v1];
+    i1.b = vr->b[v1];
 
     float m = (float) (y1 - y0) / (x1 - x0);
     if (fabsf(m) > 1) {
@@ -1215,25 +1716,621 @@ void render_line_attrs(GPU* gpu, vertex* v0, vertex* v1,
     }
 }
 
-void render_polygon(GPU* gpu, poly* p) {
+static inline bool pixel_depth_test(GPU* gpu, poly* p, int x, int y,
+                                    float depth) {
+    bool depth_test;
+    if (p->attr.depth_test) {
+        depth_test = fabsf(depth - gpu->depth_buf[y][x]) <= 0.125f;
+    } else {
+        depth_test = depth < gpu->depth_buf[y][x];
+    }
+    if (!depth_test && !p->attr.id && p->attr.mode == POLYMODE_SHADOW) {
+        gpu->attr_buf[y][x].stencil = 1;
+    }
+    return depth_test;
+}
 
-    if (p->attr.alpha == 0) {
-        render_polygon_wireframe(gpu, p);
+static u32 decode_texel(GPU* gpu, poly* p, u32 base, u32 palbase, u32 s_shift,
+                        u32 ofs, s32 ss, s32 tt) {
+    u16 color = 0xffff;
+    u8 alpha = 31;
+    switch (p->texparam.format) {
+        case TEX_2BPP: {
+            u32 addr = base + (ofs >> 2);
+            u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
+            col_ind >>= (ofs & 3) << 1;
+            col_ind &= 3;
+            if (!col_ind && p->texparam.color0) alpha = 0;
+            else {
+                u32 paladdr = palbase + col_ind;
+                color = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
+            }
+            break;
+        }
+        case TEX_4BPP: {
+            u32 addr = base + (ofs >> 1);
+            u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
+            col_ind >>= (ofs & 1) << 2;
+            col_ind &= 15;
+            if (!col_ind && p->texparam.color0) alpha = 0;
+            else {
+                u32 paladdr = palbase + col_ind;
+                color = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
+            }
+            break;
+        }
+        case TEX_8BPP: {
+            u32 addr = base + ofs;
+            u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
+            if (!col_ind && p->texparam.color0) alpha = 0;
+            else {
+                u32 paladdr = palbase + col_ind;
+                color = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
+            }
+            break;
+        }
+        case TEX_A3I5: {
+            u32 addr = base + ofs;
+            u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
+            alpha = col_ind >> 5;
+            alpha = alpha << 2 | alpha >> 1;
+            col_ind &= 31;
+            u32 paladdr = palbase + col_ind;
+            color = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
+            break;
+        }
+        case TEX_A5I3: {
+            u32 addr = base + ofs;
+            u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
+            alpha = col_ind >> 3;
+            col_ind &= 7;
+            u32 paladdr = palbase + col_ind;
+            color = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
+            break;
+        }
+        case TEX_COMPRESS: {
+            u32 block_ofs = ((tt >> 2) << (s_shift - 2)) + (ss >> 2);
+            u32 block_addr = base + (block_ofs << 2);
+            u32 row_addr = block_addr + (tt & 3);
+            u8 ind = gpu->texram[row_addr >> 17][row_addr & 0x1ffff];
+            ind >>= (ss & 3) << 1;
+            ind &= 3;
+            u16 palmode = *(u16*) &gpu->texram[1][(block_addr >> 18 << 16) +
+                                        ((block_addr >> 1) & 0xffff)];
+            u32 paladdr = palbase + ((palmode & 0x3fff) << 1);
+            palmode >>= 14;
+            if (palmode < 2 && ind == 3) alpha = 0;
+            else if (ind < 2 || !(palmode & 1)) {
+                paladdr += ind;
+                color = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
+            } else {
+                u16 color0 = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
+                paladdr++;
+                u16 color1 = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
+                u16 r0 = color0 & 0x1f;
+                u16 r1 = color1 & 0x1f;
+                u16 g0 = (color0 >> 5) & 0x1f;
+                u16 g1 = (color1 >> 5) & 0x1f;
+                u16 b0 = (color0 >> 10) & 0x1f;
+                u16 b1 = (color1 >> 10) & 0x1f;
+                if (palmode == 1) {
+                    color = (r0 + r1) / 2 | (g0 + g1) / 2 << 5 |
+                            (b0 + b1) / 2 << 10;
+                } else if (ind == 2) {
+                    color = (5 * r0 + 3 * r1) / 8 |
+                            (5 * g0 + 3 * g1) / 8 << 5 |
+                            (5 * b0 + 3 * b1) / 8 << 10;
+                } else {
+                    color = (3 * r0 + 5 * r1) / 8 |
+                            (3 * g0 + 5 * g1) / 8 << 5 |
+                            (3 * b0 + 5 * b1) / 8 << 10;
+                }
+            }
+
+            break;
+        }
+        case TEX_DIRECT: {
+            u32 addr = base + (ofs << 1);
+            color = *(u16*) &gpu->texram[addr >> 17][addr & 0x1ffff];
+            alpha = (color >> 15) ? 31 : 0;
+            break;
+        }
+    }
+    return color | alpha << 16;
+}
+
+static inline __attribute__((always_inline)) u32
+sample_texture(GPU* gpu, struct poly_setup* ps, s32 ss, s32 tt) {
+    poly* p = ps->p;
+    u32 s_shift = ps->s_shift;
+    u32 t_shift = ps->t_shift;
+    if (p->texparam.s_rep) {
+        bool flip = p->texparam.s_flip && ((ss >> s_shift) & 1);
+        ss &= (1 << s_shift) - 1;
+        if (flip) ss = (1 << s_shift) - 1 - ss;
+    } else {
+        if (ss < 0) ss = 0;
+        if (ss > (1 << s_shift) - 1) ss = (1 << s_shift) - 1;
+    }
+    if (p->texparam.t_rep) {
+        bool flip = p->texparam.t_flip && ((tt >> t_shift) & 1);
+        tt &= (1 << t_shift) - 1;
+        if (flip) tt = (1 << t_shift) - 1 - tt;
+    } else {
+        if (tt < 0) tt = 0;
+        if (tt > (1 << t_shift) - 1) tt = (1 << t_shift) - 1;
+    }
+    u32 ofs = (tt << s_shift) + ss;
+
+    return p->tex ? p->tex[ofs]
+                  : decode_texel(gpu, p, ps->base, ps->palbase, s_shift, ofs,
+                                 ss, tt);
+}
+
+#define PIXEL_COLOR(c)                                                         \
+    (f ? f->c * (1.0f / (1 << COLOR_FRAC)) : i->c / i->w)
+
+static inline __attribute__((always_inline)) void
+render_pixel(GPU* gpu, struct poly_setup* ps, int x, int y, float depth,
+             struct interp_attrs* i, struct interp_fixed* f) {
+    poly* p = ps->p;
+
+    u16 color = 0xffff;
+    u8 alpha = 31;
+    if (gpu->rendering->io.disp3dcnt.texture && p->texparam.format) {
+        u32 texel;
+        if (f) {
+            texel = sample_texture(gpu, ps, f->s >> ST_FRAC, f->t >> ST_FRAC);
+        } else {
+            texel = sample_texture(gpu, ps, i->s / i->w, i->t / i->w);
+        }
+        color = texel;
+        alpha = texel >> 16;
+    }
+
+    u16 tr = color & 0x1f;
+    u16 tg = color >> 5 & 0x1f;
+    u16 tb = color >> 10 & 0x1f;
+
+    u16 r = 0, g = 0, b = 0, a = 0;
+    switch (p->attr.mode) {
+        case POLYMODE_MOD:
+            r = ((PIXEL_COLOR(r) + 1) * (tr + 1) - 1) / 32;
+            g = ((PIXEL_COLOR(g) + 1) * (tg + 1) - 1) / 32;
+            b = ((PIXEL_COLOR(b) + 1) * (tb + 1) - 1) / 32;
+            a = ((p->attr.alpha + 1) * (alpha + 1) - 1) / 32;
+            break;
+        case POLYMODE_DECAL:
+            r = ((tr * alpha) + (PIXEL_COLOR(r) * (31 - alpha))) / 32;
+            g = ((tg * alpha) + (PIXEL_COLOR(g) * (31 - alpha))) / 32;
+            b = ((tb * alpha) + (PIXEL_COLOR(b) * (31 - alpha))) / 32;
+            a = p->attr.alpha;
+            break;
+        case POLYMODE_TOON: {
+            u16 tooncolor = gpu->rendering->io.toon_table[(int) (PIXEL_COLOR(r))];
+            u16 shr = tooncolor & 0x1f;
+            u16 shg = tooncolor >> 5 & 0x1f;
+            u16 shb = tooncolor >> 10 & 0x1f;
+            if (gpu->rendering->io.disp3dcnt.shading_mode) {
+                r = ((PIXEL_COLOR(r) + 1) * (tr + 1) - 1) / 32;
+                g = ((PIXEL_COLOR(r) + 1) * (tg + 1) - 1) / 32;
+                b = ((PIXEL_COLOR(r) + 1) * (tb + 1) - 1) / 32;
+                r += shr;
+                if (r > 31) r = 31;
+                g += shg;
+                if (g > 31) g = 31;
+                b += shb;
+                if (b > 31) b = 31;
+            } else {
+                r = ((shr + 1) * (tr + 1) - 1) / 32;
+                g = ((shg + 1) * (tg + 1) - 1) / 32;
+                b = ((shb + 1) * (tb + 1) - 1) / 32;
+            }
+            a = ((p->attr.alpha + 1) * (alpha + 1) - 1) / 32;
+            break;
+        }
+        case POLYMODE_SHADOW: {
+            if (p->attr.id) {
+                if (!gpu->attr_buf[y][x].stencil) return;
+                gpu->attr_buf[y][x].stencil = 0;
+                if (gpu->polyid_buf[y][x] == p->attr.id) return;
+                if (gpu->rendering->io.disp3dcnt.texture &&
+                    p->texparam.format) {
+                    r = (tr * alpha) + (PIXEL_COLOR(r) * (31 - alpha)) / 32;
+                    g = (tg * alpha) + (PIXEL_COLOR(g) * (31 - alpha)) / 32;
+                    b = (tb * alpha) + (PIXEL_COLOR(b) * (31 - alpha)) / 32;
+                } else {
+                    r = PIXEL_COLOR(r);
+                    g = PIXEL_COLOR(g);
+                    b = PIXEL_COLOR(b);
+                }
+                a = p->attr.alpha;
+            } else {
+                return;
+            }
+            break;
+        }
+    }
+
+    if (a <= (gpu->rendering->io.disp3dcnt.alpha_test
+                  ? (gpu->rendering->io.alpha_test_ref & 0x1f)
+                  : 0))
         return;
+
+    if (a == 31 || p->attr.depth_transparent) {
+        gpu->depth_buf[y][x] = depth;
+    }
+
+    if (gpu->rendering->io.disp3dcnt.alpha_blending && a < 31 &&
+        (gpu->screen_last[y][x] & (1 << 15))) {
+        if (gpu->attr_buf[y][x].blend &&
+            gpu->polyid_buf[y][x] == p->attr.id)
+            return;
+        u16 sr = gpu->screen_back[y][x] & 0x1f;
+        u16 sg = gpu->screen_back[y][x] >> 5 & 0x1f;
+        u16 sb = gpu->screen_back[y][x] >> 10 & 0x1f;
+        u16 sa = gpu->screen_back[y][x] >> 16 & 0x1f;
+        r = (r * (a + 1) + sr * (31 - a)) / 32;
+        g = (g * (a + 1) + sg * (31 - a)) / 32;
+        b = (b * (a + 1) + sb * (31 - a)) / 32;
+        a = (a > sa) ? a : sa;
+        gpu->attr_buf[y][x].blend = 1;
+        gpu->attr_buf[y][x].fog &= p->attr.fog;
+    } else {
+        gpu->attr_buf[y][x].fog = p->attr.fog;
+        if ((y == ps->yMin || y == (ps->yMax - 1) || x == ps->left[y].x ||
+             x == ps->right[y].x ||
+             (ps->left[y - 1].x < x && x < ps->left[y + 1].x) ||
+             (ps->left[y + 1].x < x && x < ps->left[y - 1].x) ||
+             (ps->right[y - 1].x < x && x < ps->right[y + 1].x) ||
+             (ps->right[y + 1].x < x && x < ps->right[y - 1].x))) {
+            gpu->attr_buf[y][x].edge = 1;
+        }
+    }
+
+    gpu->polyid_buf[y][x] = p->attr.id;
+    gpu->screen_back[y][x] = r | g << 5 | b << 10 | 1 << 15 | a << 16;
+}
+
+#undef PIXEL_COLOR
+
+#ifdef __x86_64__
+static inline __m128i lane_bytes(__m128i v) {
+    return _mm_packs_epi16(_mm_packs_epi32(v, v), v);
+}
+
+static inline __m128i lanes_between(__m128i x, int lo, int hi) {
+    return _mm_and_si128(_mm_cmpgt_epi32(x, _mm_set1_epi32(lo)),
+                         _mm_cmplt_epi32(x, _mm_set1_epi32(hi)));
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i
+step_lanes(s32 base, s32 step, __m128i j) {
+    return _mm_add_epi32(_mm_set1_epi32(base),
+                         _mm_mullo_epi32(_mm_set1_epi32(step), j));
+}
+
+static inline __m128i mod_lanes(__m128i t, __m128 c) {
+    __m128 one = _mm_set1_ps(1);
+    __m128 tf = _mm_cvtepi32_ps(_mm_add_epi32(t, _mm_set1_epi32(1)));
+    __m128 v = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(c, one), tf), one);
+    return _mm_cvttps_epi32(_mm_div_ps(v, _mm_set1_ps(32)));
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i
+decal_lanes(__m128i t, __m128i ta, __m128 c, __m128 ia) {
+    __m128 v = _mm_add_ps(_mm_cvtepi32_ps(_mm_mullo_epi32(t, ta)),
+                          _mm_mul_ps(c, ia));
+    return _mm_cvttps_epi32(_mm_div_ps(v, _mm_set1_ps(32)));
+}
+
+// MOD and DECAL pixels of a fully covered subspan, four at a time. Lanes
+// that may blend with the framebuffer are returned for render_pixel.
+__attribute__((target("sse4.1"))) static u32
+shade_span_sse4(GPU* gpu, struct poly_setup* ps, int x, int y, u32 mask,
+                s32 d, s32 dd, float scale, struct interp_fixed* f0,
+                struct interp_fixed* df) {
+    poly* p = ps->p;
+    bool texture = gpu->rendering->io.disp3dcnt.texture && p->texparam.format;
+    bool blending = gpu->rendering->io.disp3dcnt.alpha_blending;
+    int ref = gpu->rendering->io.disp3dcnt.alpha_test
+                  ? gpu->rendering->io.alpha_test_ref & 0x1f
+                  : 0;
+    bool edge_row = y == ps->yMin || y == ps->yMax - 1;
+    struct interp_attrs* left = ps->left;
+    struct interp_attrs* right = ps->right;
+
+    typeof(gpu->attr_buf[0][0]) bits = {0};
+    bits.fog = 1;
+    u32 fog_bits = bits.b * 0x01010101u;
+    bits.b = 0;
+    bits.edge = 1;
+    u32 edge_bits = bits.b * 0x01010101u;
+    u32 fog_val = p->attr.fog ? fog_bits : 0;
+    u32 ids = p->attr.id * 0x01010101u;
+
+    __m128i m5 = _mm_set1_epi32(0x1f);
+    __m128i m16 = _mm_set1_epi32(0xffff);
+    __m128i v31 = _mm_set1_epi32(31);
+    __m128i lane_bit = _mm_setr_epi32(1, 2, 4, 8);
+    __m128 cscale = _mm_set1_ps(1.0f / (1 << COLOR_FRAC));
+
+    u32 rest = 0;
+    for (int h = 0; h < SPAN_STEP; h += 4) {
+        u32 m = mask >> h & 0xf;
+        if (!m) continue;
+        __m128i lm = _mm_cmpeq_epi32(
+            _mm_and_si128(_mm_set1_epi32(m), lane_bit), lane_bit);
+        __m128i j = _mm_setr_epi32(h, h + 1, h + 2, h + 3);
+
+        __m128i tr = m5, tg = m5, tb = m5, ta = v31;
+        if (texture) {
+            s32 ss[4], tt[4];
+            u32 texel[4] = {0};
+            _mm_storeu_si128((__m128i*) ss,
+                             _mm_srai_epi32(step_lanes(f0->s, df->s, j),
+                                            ST_FRAC));
+            _mm_storeu_si128((__m128i*) tt,
+                             _mm_srai_epi32(step_lanes(f0->t, df->t, j),
+                                            ST_FRAC));
+            for (int k = 0; k < 4; k++) {
+                if (m & 1 << k)
+                    texel[k] = sample_texture(gpu, ps, ss[k], tt[k]);
+            }
+            __m128i tx = _mm_loadu_si128((__m128i*) texel);
+            tr = _mm_and_si128(tx, m5);
+            tg = _mm_and_si128(_mm_srli_epi32(tx, 5), m5);
+            tb = _mm_and_si128(_mm_srli_epi32(tx, 10), m5);
+            ta = _mm_and_si128(_mm_srli_epi32(tx, 16), _mm_set1_epi32(0xff));
+        }
+
+        __m128 cr =
+            _mm_mul_ps(_mm_cvtepi32_ps(step_lanes(f0->r, df->r, j)), cscale);
+        __m128 cg =
+            _mm_mul_ps(_mm_cvtepi32_ps(step_lanes(f0->g, df->g, j)), cscale);
+        __m128 cb =
+            _mm_mul_ps(_mm_cvtepi32_ps(step_lanes(f0->b, df->b, j)), cscale);
+        __m128i r, g, b, a;
+        if (p->attr.mode == POLYMODE_DECAL) {
+            __m128 ia = _mm_cvtepi32_ps(_mm_sub_epi32(v31, ta));
+            r = decal_lanes(tr, ta, cr, ia);
+            g = decal_lanes(tg, ta, cg, ia);
+            b = decal_lanes(tb, ta, cb, ia);
+            a = _mm_set1_epi32(p->attr.alpha);
+        } else {
+            r = mod_lanes(tr, cr);
+            g = mod_lanes(tg, cg);
+            b = mod_lanes(tb, cb);
+            a = _mm_srli_epi32(
+                _mm_sub_epi32(
+                    _mm_mullo_epi32(_mm_set1_epi32(p->attr.alpha + 1),
+                                    _mm_add_epi32(ta, _mm_set1_epi32(1))),
+                    _mm_set1_epi32(1)),
+                5);
+        }
+        r = _mm_and_si128(r, m16);
+        g = _mm_and_si128(g, m16);
+        b = _mm_and_si128(b, m16);
+        a = _mm_and_si128(a, m16);
+
+        __m128i blend =
+            blending ? _mm_cmplt_epi32(a, v31) : _mm_setzero_si128();
+        rest |= _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(lm, blend)))
+                << h;
+        __m128i ok = _mm_andnot_si128(
+            blend, _mm_and_si128(lm, _mm_cmpgt_epi32(a, _mm_set1_epi32(ref))));
+        if (!_mm_movemask_ps(_mm_castsi128_ps(ok))) continue;
+
+        int px = x + h;
+        __m128i wd = p->attr.depth_transparent
+                         ? ok
+                         : _mm_and_si128(ok, _mm_cmpeq_epi32(a, v31));
+        __m128 depth = _mm_mul_ps(_mm_cvtepi32_ps(step_lanes(d, dd, j)),
+                                  _mm_set1_ps(scale));
+        float* db = &gpu->depth_buf[y][px];
+        _mm_storeu_ps(db, _mm_blendv_ps(_mm_loadu_ps(db), depth,
+                                        _mm_castsi128_ps(wd)));
+
+        __m128i c = _mm_or_si128(r, _mm_slli_epi32(g, 5));
+        c = _mm_or_si128(c, _mm_slli_epi32(b, 10));
+        c = _mm_or_si128(c, _mm_set1_epi32(1 << 15));
+        c = _mm_or_si128(c, _mm_slli_epi32(a, 16));
+        __m128i* sb = (__m128i*) &gpu->screen_back[y][px];
+        _mm_storeu_si128(sb, _mm_blendv_epi8(_mm_loadu_si128(sb), c, ok));
+
+        __m128i e;
+        if (edge_row) {
+            e = _mm_set1_epi32(-1);
+        } else {
+            __m128i xv = _mm_add_epi32(_mm_set1_epi32(x), j);
+            e = _mm_or_si128(_mm_cmpeq_epi32(xv, _mm_set1_epi32(left[y].x)),
+                             _mm_cmpeq_epi32(xv, _mm_set1_epi32(right[y].x)));
+            e = _mm_or_si128(
+                e, lanes_between(xv, left[y - 1].x, left[y + 1].x));
+            e = _mm_or_si128(
+                e, lanes_between(xv, left[y + 1].x, left[y - 1].x));
+            e = _mm_or_si128(
+                e, lanes_between(xv, right[y - 1].x, right[y + 1].x));
+            e = _mm_or_si128(
+                e, lanes_between(xv, right[y + 1].x, right[y - 1].x));
+        }
+        u32 okb = _mm_cvtsi128_si32(lane_bytes(ok));
+        u32 eb = _mm_cvtsi128_si32(lane_bytes(e));
+
+        u32 old;
+        memcpy(&old, &gpu->polyid_buf[y][px], sizeof old);
+        old = (old & ~okb) | (ids & okb);
+        memcpy(&gpu->polyid_buf[y][px], &old, sizeof old);
+
+        memcpy(&old, &gpu->attr_buf[y][px], sizeof old);
+        u32 attr = (old & ~fog_bits) | fog_val | (eb & edge_bits);
+        old = (old & ~okb) | (attr & okb);
+        memcpy(&gpu->attr_buf[y][px], &old, sizeof old);
+    }
+    return rest;
+}
+#endif
+
+static ShadeSpanFunc select_shade_span() {
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) return shade_span_sse4;
+#endif
+    return NULL;
+}
+
+static const s32 span_recip[SPAN_STEP + 1] = {
+    0, 1 << 16, 1 << 15, 65536 / 3, 1 << 14, 65536 / 5, 65536 / 6, 65536 / 7,
+    1 << 13};
+
+static struct interp_fixed span_point(struct interp_attrs* l,
+                                      struct interp_attrs* di, int k) {
+    struct interp_fixed f;
+    float w = 1 / (l->w + k * di->w);
+    f.s = (l->s + k * di->s) * w * (1 << ST_FRAC);
+    f.t = (l->t + k * di->t) * w * (1 << ST_FRAC);
+    f.r = (l->r + k * di->r) * w * (1 << COLOR_FRAC);
+    f.g = (l->g + k * di->g) * w * (1 << COLOR_FRAC);
+    f.b = (l->b + k * di->b) * w * (1 << COLOR_FRAC);
+    return f;
+}
+
+#define SPAN_DELTA(a) (((s64) (f1.a - f0.a) * span_recip[n]) >> 16)
+
+static void render_span_fixed(GPU* gpu, struct poly_setup* ps, int y,
+                              int xmin, int xmax) {
+    struct interp_attrs* l = &ps->left[y];
+    struct interp_attrs* r = &ps->right[y];
+    int h = r->x - l->x + 1;
+    if (h <= 0 || r->x < xmin || l->x >= xmax) return;
+    int k0 = xmin > l->x ? (xmin - l->x) & ~(SPAN_STEP - 1) : 0;
+    struct interp_attrs di = ps->delta[y];
+
+    bool w_buffer = gpu->rendering->w_buffer;
+    float dscale = w_buffer ? 1.0f / (1 << W_FRAC) : 1.0f / (1 << Z_FRAC);
+    s32 z = l->z * (1 << Z_FRAC);
+    s32 dz = di.z * (1 << Z_FRAC);
+    z += k0 * dz;
+    s32 w0 = 0;
+    if (w_buffer) {
+        w0 = k0 ? (1 / (l->w + k0 * di.w)) * (1 << W_FRAC)
+                : (1 / l->w) * (1 << W_FRAC);
+    }
+    bool equal = ps->p->attr.depth_test;
+    bool stencil = !ps->p->attr.id && ps->p->attr.mode == POLYMODE_SHADOW;
+    ShadeSpanFunc shade = ps->p->attr.mode == POLYMODE_MOD ||
+                                  ps->p->attr.mode == POLYMODE_DECAL
+                              ? span_shade
+                              : NULL;
+
+    struct interp_fixed f0 = {0}, f1 = {0}, df = {0};
+    int setup = -1;
+    for (int k = k0; k < h && l->x + k < xmax; k += SPAN_STEP) {
+        int n = h - k < SPAN_STEP ? h - k : SPAN_STEP;
+        s32 d = z;
+        s32 dd = dz;
+        if (w_buffer) {
+            s32 w1 = (1 / (l->w + (k + n) * di.w)) * (1 << W_FRAC);
+            d = w0;
+            dd = ((s64) (w1 - w0) * span_recip[n]) >> 16;
+            w0 = w1;
+        }
+        z += n * dz;
+
+        int j0 = xmin - (l->x + k);
+        if (j0 < 0) j0 = 0;
+        int j1 = xmax - (l->x + k);
+        if (j1 > n) j1 = n;
+        float* buf = &gpu->depth_buf[y][l->x + k];
+        u32 mask;
+        bool full = j0 == 0 && j1 == SPAN_STEP;
+        if (full) {
+            mask = span_depth_mask(buf, n, d, dd, dscale, equal);
+        } else {
+            mask = depth_mask_scalar(buf + j0, j1 - j0, d + j0 * dd, dd,
+                                     dscale, equal)
+                   << j0;
+        }
+        if (stencil) {
+            for (int j = j0; j < j1; j++) {
+                if (!(mask & 1 << j)) {
+                    gpu->attr_buf[y][l->x + k + j].stencil = 1;
+                }
+            }
+        }
+        if (!mask) continue;
+        if (setup != k) {
+            f0 = setup == k - SPAN_STEP ? f1 : span_point(l, &di, k);
+            f1 = span_point(l, &di, k + n);
+            df.s = SPAN_DELTA(s);
+            df.t = SPAN_DELTA(t);
+            df.r = SPAN_DELTA(r);
+            df.g = SPAN_DELTA(g);
+            df.b = SPAN_DELTA(b);
+            setup = k;
+        }
+        if (shade && full) {
+            mask = shade(gpu, ps, l->x + k, y, mask, d, dd, dscale, &f0, &df);
+        }
+        while (mask) {
+            int j = __builtin_ctz(mask);
+            mask &= mask - 1;
+            int x = l->x + k + j;
+            float depth = (d + j * dd) * dscale;
+            struct interp_fixed f = {f0.s + j * df.s, f0.t + j * df.t,
+                                     f0.r + j * df.r, f0.g + j * df.g,
+                                     f0.b + j * df.b};
+            render_pixel(gpu, ps, x, y, depth, NULL, &f);
+        }
     }
+}
+
+#undef SPAN_DELTA
 
+void setup_polygon(GPU* gpu, struct poly_setup* ps, poly* p) {
+    int xMin = NDS_SCREEN_W;
+    int xMax = -1;
     int yMin = NDS_SCREEN_H;
     int yMax = -1;
+    VertexRAM* vr = &gpu->rendering->vertexram;
     for (int i = 0; i < p->n; i++) {
-        int y = p->p[i]->sy;
+        int x = vr->sx[p->p[i]];
+        int y = vr->sy[p->p[i]];
+        if (x > xMax) xMax = x;
+        if (x < xMin) xMin = x;
         if (y > yMax) yMax = y;
         if (y < yMin) yMin = y;
     }
+    xMin--;
+    xMax++;
+    if (xMin < 0) xMin = 0;
+    if (xMax > NDS_SCREEN_W - 1) xMax = NDS_SCREEN_W - 1;
     if (yMin < 0) yMin = 0;
     if (yMax > NDS_SCREEN_H) yMax = NDS_SCREEN_H;
 
-    struct interp_attrs left[NDS_SCREEN_H], right[NDS_SCREEN_H];
-    for (int y = yMin; y < yMax; y++) {
+    ps->p = p;
+    ps->left = NULL;
+    ps->right = NULL;
+    ps->delta = NULL;
+    ps->xMin = xMin;
+    ps->xMax = xMax;
+    ps->yMin = yMin;
+    ps->yMax = yMax;
+    ps->base = p->texparam.offset << 3;
+    ps->s_shift = p->texparam.s_size + 3;
+    ps->t_shift = p->texparam.t_size + 3;
+    ps->palbase = p->pltt_base << 3;
+    if (p->texparam.format == TEX_2BPP) ps->palbase >>= 1;
+}
+
+void setup_edges(GPU* gpu, struct poly_setup* ps, struct interp_attrs* edges) {
+    poly* p = ps->p;
+    int yMin = ps->yMin;
+    int yMax = ps->yMax;
+    struct interp_attrs* left = edges - yMin;
+    struct interp_attrs* right = left + (yMax - yMin + 1);
+    struct interp_attrs* delta = right + (yMax - yMin + 1);
+    for (int y = yMin; y <= yMax; y++) {
         left[y].x = NDS_SCREEN_W;
         right[y].x = -1;
     }
@@ -1243,426 +2340,537 @@ void render_polygon(GPU* gpu, poly* p) {
         render_line_attrs(gpu, p->p[i], p->p[next], left, right);
     }
 
-    u32 base = p->texparam.offset << 3;
-    u32 s_shift = p->texparam.s_size + 3;
-    u32 t_shift = p->texparam.t_size + 3;
-    int format = p->texparam.format;
-
-    u32 palbase = p->pltt_base << 3;
-    if (format == TEX_2BPP) palbase >>= 1;
-
     for (int y = yMin; y < yMax; y++) {
         int h = right[y].x - left[y].x + 1;
+        if (h <= 0) continue;
+        delta[y].z = (right[y].z - left[y].z) / h;
+        delta[y].w = (right[y].w - left[y].w) / h;
+        delta[y].s = (right[y].s - left[y].s) / h;
+        delta[y].t = (right[y].t - left[y].t) / h;
+        delta[y].r = (right[y].r - left[y].r) / h;
+        delta[y].g = (right[y].g - left[y].g) / h;
+        delta[y].b = (right[y].b - left[y].b) / h;
+    }
+    ps->left = left;
+    ps->right = right;
+    ps->delta = delta;
+}
+
+void render_polygon(GPU* gpu, struct poly_setup* ps, int xmin, int xmax,
+                    int ymin, int ymax) {
+    poly* p = ps->p;
+    if (p->attr.alpha == 0) {
+        render_polygon_wireframe(gpu, p, xmin, xmax, ymin, ymax);
+        return;
+    }
+    if (ps->yMin >= ymax || ps->yMax <= ymin) return;
+
+    struct interp_attrs* left = ps->left;
+    struct interp_attrs* right = ps->right;
+    if (ymin < ps->yMin) ymin = ps->yMin;
+    if (ymax > ps->yMax) ymax = ps->yMax;
+    for (int y = ymin; y < ymax; y++) {
+        if (ntremu.fixed_raster) {
+            render_span_fixed(gpu, ps, y, xmin, xmax);
+            continue;
+        }
+
+        int x1 = right[y].x < xmax ? right[y].x : xmax - 1;
+        if (x1 < xmin) continue;
 
         struct interp_attrs i = left[y];
-        struct interp_attrs di;
-        di.z = (right[y].z - i.z) / h;
-        di.w = (right[y].w - i.w) / h;
-        di.s = (right[y].s - i.s) / h;
-        di.t = (right[y].t - i.t) / h;
-        di.r = (right[y].r - i.r) / h;
-        di.g = (right[y].g - i.g) / h;
-        di.b = (right[y].b - i.b) / h;
-        for (int x = left[y].x; x <= right[y].x; x++, i.z += di.z, i.w += di.w,
-                 i.s += di.s, i.t += di.t, i.r += di.r, i.g += di.g,
-                 i.b += di.b) {
-            bool depth_test;
-            if (p->attr.depth_test) {
-                if (gpu->w_buffer)
-                    depth_test =
-                        fabsf(1 / i.w - gpu->depth_buf[y][x]) <= 0.125f;
-                else depth_test = fabsf(i.z - gpu->depth_buf[y][x]) <= 0.125f;
-            } else {
-                if (gpu->w_buffer) depth_test = 1 / i.w < gpu->depth_buf[y][x];
-                else depth_test = i.z < gpu->depth_buf[y][x];
-            }
-            if (!depth_test) {
-                if (!p->attr.id && p->attr.mode == POLYMODE_SHADOW) {
-                    gpu->attr_buf[y][x].stencil = 1;
-                }
-                continue;
+        struct interp_attrs di = ps->delta[y];
+        int x = left[y].x;
+        for (; x < xmin; x++) {
+            i.z += di.z;
+            i.w += di.w;
+            i.s += di.s;
+            i.t += di.t;
+            i.r += di.r;
+            i.g += di.g;
+            i.b += di.b;
+        }
+        for (; x <= x1; x++, i.z += di.z, i.w += di.w, i.s += di.s,
+                        i.t += di.t, i.r += di.r, i.g += di.g, i.b += di.b) {
+            float depth = gpu->rendering->w_buffer ? 1 / i.w : i.z;
+            if (pixel_depth_test(gpu, p, x, y, depth)) {
+                render_pixel(gpu, ps, x, y, depth, &i, NULL);
             }
+        }
+    }
+}
 
-            u16 color = 0xffff;
-            u8 alpha = 31;
-            if (gpu->master->io9.disp3dcnt.texture && p->texparam.format) {
-                s32 ss = i.s / i.w;
-                s32 tt = i.t / i.w;
-                if (p->texparam.s_rep) {
-                    bool flip = p->texparam.s_flip && ((ss >> s_shift) & 1);
-                    ss &= (1 << s_shift) - 1;
-                    if (flip) ss = (1 << s_shift) - 1 - ss;
-                } else {
-                    if (ss < 0) ss = 0;
-                    if (ss > (1 << s_shift) - 1) ss = (1 << s_shift) - 1;
-                }
-                if (p->texparam.t_rep) {
-                    bool flip = p->texparam.t_flip && ((tt >> t_shift) & 1);
-                    tt &= (1 << t_shift) - 1;
-                    if (flip) tt = (1 << t_shift) - 1 - tt;
-                } else {
-                    if (tt < 0) tt = 0;
-                    if (tt > (1 << t_shift) - 1) tt = (1 << t_shift) - 1;
-                }
-                u32 ofs = (tt << s_shift) + ss;
-
-                switch (format) {
-                    case TEX_2BPP: {
-                        u32 addr = base + (ofs >> 2);
-                        u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
-                        col_ind >>= (ofs & 3) << 1;
-                        col_ind &= 3;
-                        if (!col_ind && p->texparam.color0) alpha = 0;
-                        else {
-                            u32 paladdr = palbase + col_ind;
-                            color =
-                                gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
-                        }
-                        break;
-                    }
-                    case TEX_4BPP: {
-                        u32 addr = base + (ofs >> 1);
-                        u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
-                        col_ind >>= (ofs & 1) << 2;
-                        col_ind &= 15;
-                        if (!col_ind && p->texparam.color0) alpha = 0;
-                        else {
-                            u32 paladdr = palbase + col_ind;
-                            color =
-                                gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
-                        }
-                        break;
-                    }
-                    case TEX_8BPP: {
-                        u32 addr = base + ofs;
-                        u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
-                        if (!col_ind && p->texparam.color0) alpha = 0;
-                        else {
-                            u32 paladdr = palbase + col_ind;
-                            color =
-                                gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
-                        }
-                        break;
-                    }
-                    case TEX_A3I5: {
-                        u32 addr = base + ofs;
-                        u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
-                        alpha = col_ind >> 5;
-                        alpha = alpha << 2 | alpha >> 1;
-                        col_ind &= 31;
-                        u32 paladdr = palbase + col_ind;
-                        color = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
-                        break;
-                    }
-                    case TEX_A5I3: {
-                        u32 addr = base + ofs;
-                        u8 col_ind = gpu->texram[addr >> 17][addr & 0x1ffff];
-                        alpha = col_ind >> 3;
-                        col_ind &= 7;
-                        u32 paladdr = palbase + col_ind;
-                        color = gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
-                        break;
-                    }
-                    case TEX_COMPRESS: {
-                        u32 block_ofs =
-                            ((tt >> 2) << (s_shift - 2)) + (ss >> 2);
-                        u32 block_addr = base + (block_ofs << 2);
-                        u32 row_addr = block_addr + (tt & 3);
-                        u8 ind =
-                            gpu->texram[row_addr >> 17][row_addr & 0x1ffff];
-                        ind >>= (ss & 3) << 1;
-                        ind &= 3;
-                        u16 palmode =
-                            *(u16*) &gpu
-                                 ->texram[1][(block_addr >> 18 << 16) +
-                                             ((block_addr >> 1) & 0xffff)];
-                        u32 paladdr = palbase + ((palmode & 0x3fff) << 1);
-                        palmode >>= 14;
-                        if (palmode < 2 && ind == 3) alpha = 0;
-                        else if (ind < 2 || !(palmode & 1)) {
-                            paladdr += ind;
-                            color =
-                                gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
-                        } else {
-                            u16 color0 =
-                                gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
-                            paladdr++;
-                            u16 color1 =
-                                gpu->texpal[paladdr >> 13][paladdr & 0x1fff];
-                            u16 r0 = color0 & 0x1f;
-                            u16 r1 = color1 & 0x1f;
-                            u16 g0 = (color0 >> 5) & 0x1f;
-                            u16 g1 = (color1 >> 5) & 0x1f;
-                            u16 b0 = (color0 >> 10) & 0x1f;
-                            u16 b1 = (color1 >> 10) & 0x1f;
-                            if (palmode == 1) {
-                                color = (r0 + r1) / 2 | (g0 + g1) / 2 << 5 |
-                                        (b0 + b1) / 2 << 10;
-                            } else if (ind == 2) {
-                                color = (5 * r0 + 3 * r1) / 8 |
-                                        (5 * g0 + 3 * g1) / 8 << 5 |
-                                        (5 * b0 + 3 * b1) / 8 << 10;
-                            } else {
-                                color = (3 * r0 + 5 * r1) / 8 |
-                                        (3 * g0 + 5 * g1) / 8 << 5 |
-                                        (3 * b0 + 5 * b1) / 8 << 10;
-                            }
-                        }
+#define IS_SEMITRANS(p)                                                        \
+    ((p).attr.alpha < 31 || (p).texparam.format == TEX_A3I5 ||                 \
+     (p).texparam.format == TEX_A5I3)
 
-                        break;
-                    }
-                    case TEX_DIRECT: {
-                        u32 addr = base + (ofs << 1);
-                        color =
-                            *(u16*) &gpu->texram[addr >> 17][addr & 0x1ffff];
-                        alpha = (color >> 15) ? 31 : 0;
-                        break;
-                    }
-                }
-            }
+static u32 texram_gen(GPU* gpu, u32 start, u32 end) {
+    u32 sum = 0;
+    for (u32 a = start & ~((1 << BLOCKPAGEBITS) - 1); a < end;
+         a += 1 << BLOCKPAGEBITS) {
+        sum += *vram_gen(gpu->master,
+                         &gpu->texram[(a >> 17) & 3][a & 0x1ffff]);
+    }
+    return sum;
+}
 
-            u16 tr = color & 0x1f;
-            u16 tg = color >> 5 & 0x1f;
-            u16 tb = color >> 10 & 0x1f;
-
-            u16 r = 0, g = 0, b = 0, a = 0;
-            switch (p->attr.mode) {
-                case POLYMODE_MOD:
-                    r = ((i.r / i.w + 1) * (tr + 1) - 1) / 32;
-                    g = ((i.g / i.w + 1) * (tg + 1) - 1) / 32;
-                    b = ((i.b / i.w + 1) * (tb + 1) - 1) / 32;
-                    a = ((p->attr.alpha + 1) * (alpha + 1) - 1) / 32;
-                    break;
-                case POLYMODE_DECAL:
-                    r = ((tr * alpha) + (i.r / i.w * (31 - alpha))) / 32;
-                    g = ((tg * alpha) + (i.g / i.w * (31 - alpha))) / 32;
-                    b = ((tb * alpha) + (i.b / i.w * (31 - alpha))) / 32;
-                    a = p->attr.alpha;
-                    break;
-                case POLYMODE_TOON: {
-                    u16 tooncolor =
-                        gpu->master->io9.toon_table[(int) (i.r / i.w)];
-                    u16 shr = tooncolor & 0x1f;
-                    u16 shg = tooncolor >> 5 & 0x1f;
-                    u16 shb = tooncolor >> 10 & 0x1f;
-                    if (gpu->master->io9.disp3dcnt.shading_mode) {
-                        r = ((i.r / i.w + 1) * (tr + 1) - 1) / 32;
-                        g = ((i.r / i.w + 1) * (tg + 1) - 1) / 32;
-                        b = ((i.r / i.w + 1) * (tb + 1) - 1) / 32;
-                        r += shr;
-                        if (r > 31) r = 31;
-                        g += shg;
-                        if (g > 31) g = 31;
-                        b += shb;
-                        if (b > 31) b = 31;
-                    } else {
-                        r = ((shr + 1) * (tr + 1) - 1) / 32;
-                        g = ((shg + 1) * (tg + 1) - 1) / 32;
-                        b = ((shb + 1) * (tb + 1) - 1) / 32;
-                    }
-                    a = ((p->attr.alpha + 1) * (alpha + 1) - 1) / 32;
-                    break;
-                }
-                case POLYMODE_SHADOW: {
-                    if (p->attr.id) {
-                        if (!gpu->attr_buf[y][x].stencil) continue;
-                        gpu->attr_buf[y][x].stencil = 0;
-                        if (gpu->polyid_buf[y][x] == p->attr.id) continue;
-                        if (gpu->master->io9.disp3dcnt.texture &&
-                            p->texparam.format) {
-                            r = (tr * alpha) + (i.r / i.w * (31 - alpha)) / 32;
-                            g = (tg * alpha) + (i.g / i.w * (31 - alpha)) / 32;
-                            b = (tb * alpha) + (i.b / i.w * (31 - alpha)) / 32;
-                        } else {
-                            r = i.r / i.w;
-                            g = i.g / i.w;
-                            b = i.b / i.w;
-                        }
-                        a = p->attr.alpha;
-                    } else {
-                        continue;
-                    }
-                    break;
-                }
+static u32 texpal_gen(GPU* gpu, u32 start, u32 end) {
+    u32 sum = 0;
+    for (u32 a = start & ~((1 << (BLOCKPAGEBITS - 1)) - 1); a < end;
+         a += 1 << (BLOCKPAGEBITS - 1)) {
+        if ((a >> 13) < 6) {
+            sum += *vram_gen(gpu->master, &gpu->texpal[a >> 13][a & 0x1fff]);
+        }
+    }
+    return sum;
+}
+
+static u32 texture_gen(GPU* gpu, poly* p, u32 base, u32 palbase,
+                       u32 texels) {
+    switch (p->texparam.format) {
+        case TEX_2BPP:
+            return texram_gen(gpu, base, base + texels / 4) +
+                   texpal_gen(gpu, palbase, palbase + 4);
+        case TEX_4BPP:
+            return texram_gen(gpu, base, base + texels / 2) +
+                   texpal_gen(gpu, palbase, palbase + 16);
+        case TEX_8BPP:
+            return texram_gen(gpu, base, base + texels) +
+                   texpal_gen(gpu, palbase, palbase + 256);
+        case TEX_A3I5:
+            return texram_gen(gpu, base, base + texels) +
+                   texpal_gen(gpu, palbase, palbase + 32);
+        case TEX_A5I3:
+            return texram_gen(gpu, base, base + texels) +
+                   texpal_gen(gpu, palbase, palbase + 8);
+        case TEX_COMPRESS: {
+            u32 sum = texram_gen(gpu, base, base + texels / 4) +
+                      texpal_gen(gpu, palbase, palbase + 0x8004);
+            for (u32 a = base; a < base + texels / 4;
+                 a += 1 << (BLOCKPAGEBITS - 1)) {
+                u32 ofs = (a >> 18 << 16) + ((a >> 1) & 0xffff);
+                sum += *vram_gen(gpu->master, &gpu->texram[1][ofs]);
             }
+            return sum;
+        }
+        case TEX_DIRECT:
+            return texram_gen(gpu, base, base + texels * 2);
+    }
+    return 0;
+}
 
-            if (a <= (gpu->master->io9.disp3dcnt.alpha_test
-                          ? (gpu->master->io9.alpha_test_ref & 0x1f)
-                          : 0))
-                continue;
+static u32* texcache_get(GPU* gpu, poly* p) {
+    u32 key = p->texparam.w & TEXCACHE_KEY;
+    u32 pltt_base = p->texparam.format == TEX_DIRECT ? 0 : p->pltt_base;
+    TexCacheEntry* set =
+        texcache[((key ^ pltt_base) * 0x9e3779b1) % TEXCACHE_SETS];
+
+    TexCacheEntry* e = NULL;
+    TexCacheEntry* victim = &set[0];
+    for (int i = 0; i < TEXCACHE_WAYS; i++) {
+        if (set[i].key == key && set[i].pltt_base == pltt_base) {
+            e = &set[i];
+            break;
+        }
+        if (set[i].frame < victim->frame) victim = &set[i];
+    }
+    if (e && e->frame == texcache_frame) return e->data;
 
-            if (a == 31 || p->attr.depth_transparent) {
-                if (gpu->w_buffer) gpu->depth_buf[y][x] = 1 / i.w;
-                else gpu->depth_buf[y][x] = i.z;
-            }
+    u32 s_shift = p->texparam.s_size + 3;
+    u32 t_shift = p->texparam.t_size + 3;
+    u32 texels = 1 << (s_shift + t_shift);
+    u32 base = p->texparam.offset << 3;
+    u32 palbase = pltt_base << 3;
+    if (p->texparam.format == TEX_2BPP) palbase >>= 1;
+    u32 gen = texture_gen(gpu, p, base, palbase, texels);
 
-            if (gpu->master->io9.disp3dcnt.alpha_blending && a < 31 &&
-                (gpu->screen[y][x] & (1 << 15))) {
-                if (gpu->attr_buf[y][x].blend &&
-                    gpu->polyid_buf[y][x] == p->attr.id)
-                    continue;
-                u16 sr = gpu->screen_back[y][x] & 0x1f;
-                u16 sg = gpu->screen_back[y][x] >> 5 & 0x1f;
-                u16 sb = gpu->screen_back[y][x] >> 10 & 0x1f;
-                u16 sa = gpu->screen_back[y][x] >> 16 & 0x1f;
-                r = (r * (a + 1) + sr * (31 - a)) / 32;
-                g = (g * (a + 1) + sg * (31 - a)) / 32;
-                b = (b * (a + 1) + sb * (31 - a)) / 32;
-                a = (a > sa) ? a : sa;
-                gpu->attr_buf[y][x].blend = 1;
-                gpu->attr_buf[y][x].fog &= p->attr.fog;
-            } else {
-                gpu->attr_buf[y][x].fog = p->attr.fog;
-                if ((y == yMin || y == (yMax - 1) || x == left[y].x ||
-                     x == right[y].x ||
-                     (left[y - 1].x < x && x < left[y + 1].x) ||
-                     (left[y + 1].x < x && x < left[y - 1].x) ||
-                     (right[y - 1].x < x && x < right[y + 1].x) ||
-                     (right[y + 1].x < x && x < right[y - 1].x))) {
-                    gpu->attr_buf[y][x].edge = 1;
-                }
-            }
+    if (e && e->map_gen == gpu->texmap_gen && e->gen == gen) {
+        e->frame = texcache_frame;
+        return e->data;
+    }
+    if (!e) {
+        if (victim->frame == texcache_frame) return NULL;
+        e = victim;
+    }
+    if (e->size < texels) {
+        free(e->data);
+        e->data = malloc(texels * sizeof *e->data);
+        e->size = texels;
+    }
+    for (u32 tt = 0; tt < 1 << t_shift; tt++) {
+        for (u32 ss = 0; ss < 1 << s_shift; ss++) {
+            u32 ofs = (tt << s_shift) + ss;
+            e->data[ofs] =
+                decode_texel(gpu, p, base, palbase, s_shift, ofs, ss, tt);
+        }
+    }
+    e->key = key;
+    e->pltt_base = pltt_base;
+    e->map_gen = gpu->texmap_gen;
+    e->gen = gen;
+    e->frame = texcache_frame;
+    return e->data;
+}
 
-            gpu->polyid_buf[y][x] = p->attr.id;
-            gpu->screen_back[y][x] = r | g << 5 | b << 10 | 1 << 15 | a << 16;
+static void bind_textures(GPU* gpu) {
+    texcache_frame++;
+    for (int i = 0; i < gpu->rendering->n_polys; i++) {
+        poly* p = &gpu->rendering->polygonram[i];
+        p->tex = NULL;
+        if (gpu->rendering->io.disp3dcnt.texture && p->texparam.format) {
+            p->tex = texcache_get(gpu, p);
         }
     }
 }
 
-#define IS_SEMITRANS(p)                                                        \
-    ((p).attr.alpha < 31 || (p).texparam.format == TEX_A3I5 ||                 \
-     (p).texparam.format == TEX_A5I3)
+static int edge_rows(struct poly_setup* ps) {
+    if (ntremu.wireframe || ps->p->attr.alpha == 0) return 0;
+    if (ps->yMin >= ps->yMax) return 0;
+    return 3 * (ps->yMax - ps->yMin + 1);
+}
 
-void gpu_render(GPU* gpu) {
-    if (gpu->master->io9.disp3dcnt.rearplane_mode) {
-        for (int y = 0; y < NDS_SCREEN_H; y++) {
-            for (int x = 0; x < NDS_SCREEN_W; x++) {
-                gpu->screen_back[y][x] =
-                    *(u16*) &gpu->texram[2][(y * NDS_SCREEN_W + x) << 1] |
-                    (31 << 16);
-                float depth =
-                    (*(u16*) &gpu->texram[3][(y * NDS_SCREEN_W + x) << 1] &
-                     0x7fff) /
-                    (float) (1 << 12);
-                if (gpu->w_buffer) depth *= 0x200;
-                gpu->depth_buf[y][x] = depth;
-                gpu->polyid_buf[y][x] = gpu->master->io9.clear_color.id;
-                gpu->attr_buf[y][x].b = 0;
-                gpu->attr_buf[y][x].fog = gpu->master->io9.clear_color.fog;
+static void setup_polys(GPU* gpu) {
+    int size = NDS_SCREEN_H;
+    for (int i = 0; i < gpu->rendering->n_polys; i++) {
+        setup_polygon(gpu, &poly_setups[i], &gpu->rendering->polygonram[i]);
+        size += edge_rows(&poly_setups[i]);
+    }
+    if (size > edge_buf_size) {
+        free(edge_buf);
+        edge_buf = malloc(size * sizeof *edge_buf);
+        edge_buf_size = size;
+    }
+    int ofs = NDS_SCREEN_H;
+    for (int i = 0; i < gpu->rendering->n_polys; i++) {
+        int rows = edge_rows(&poly_setups[i]);
+        if (rows) setup_edges(gpu, &poly_setups[i], &edge_buf[ofs]);
+        ofs += rows;
+    }
+}
+
+static void bin_poly(int i) {
+    struct poly_setup* ps = &poly_setups[i];
+    int yMax = ps->yMax < NDS_SCREEN_H ? ps->yMax : NDS_SCREEN_H - 1;
+    for (int ty = ps->yMin / TILE_H; ty <= yMax / TILE_H; ty++) {
+        for (int tx = ps->xMin / TILE_W; tx <= ps->xMax / TILE_W; tx++) {
+            int tile = ty * TILES_X + tx;
+            tile_polys[tile][tile_n_polys[tile]++] = i;
+        }
+    }
+}
+
+static void bin_polys(GPU* gpu) {
+    for (int t = 0; t < TILES_X * TILES_Y; t++) {
+        tile_n_polys[t] = 0;
+    }
+    if (ntremu.wireframe) {
+        for (int i = 0; i < gpu->rendering->n_polys; i++) {
+            bin_poly(i);
+        }
+    } else {
+        for (int i = 0; i < gpu->rendering->n_polys; i++) {
+            if (!IS_SEMITRANS(gpu->rendering->polygonram[i])) bin_poly(i);
+        }
+        for (int i = 0; i < gpu->rendering->n_polys; i++) {
+            if (IS_SEMITRANS(gpu->rendering->polygonram[i])) bin_poly(i);
+        }
+    }
+}
+
+static void fill32(u32* dst, u32 v, int n) {
+    int i = 0;
+#ifdef __x86_64__
+    __m128i vv = _mm_set1_epi32(v);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128((__m128i*) &dst[i], vv);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = v;
+    }
+}
+
+static void fillf(float* dst, float v, int n) {
+    int i = 0;
+#ifdef __x86_64__
+    __m128 vv = _mm_set1_ps(v);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(&dst[i], vv);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = v;
+    }
+}
+
+static void clear_tile(GPU* gpu, int xmin, int xmax, int ymin, int ymax) {
+    int n = xmax - xmin;
+    typeof(gpu->attr_buf[0][0]) attr = {0};
+    attr.fog = gpu->rendering->io.clear_color.fog;
+    u8 id = gpu->rendering->io.clear_color.id;
+    if (gpu->rendering->io.disp3dcnt.rearplane_mode) {
+        float scale = 1 / (float) (1 << 12);
+        if (gpu->rendering->w_buffer) scale *= 0x200;
+        for (int y = ymin; y < ymax; y++) {
+            u16* color = (u16*) &gpu->texram[2][(y * NDS_SCREEN_W) << 1];
+            u16* depth = (u16*) &gpu->texram[3][(y * NDS_SCREEN_W) << 1];
+            for (int x = xmin; x < xmax; x++) {
+                gpu->screen_back[y][x] = color[x] | (31 << 16);
+            }
+            for (int x = xmin; x < xmax; x++) {
+                gpu->depth_buf[y][x] = (depth[x] & 0x7fff) * scale;
             }
+            memset(&gpu->polyid_buf[y][xmin], id, n);
+            memset(&gpu->attr_buf[y][xmin], attr.b, n);
         }
     } else {
-        u32 clear_color = gpu->master->io9.clear_color.color;
-        if (gpu->master->io9.clear_color.alpha)
-            clear_color |= 0x8000 | (gpu->master->io9.clear_color.alpha << 16);
+        u32 clear_color = gpu->rendering->io.clear_color.color;
+        if (gpu->rendering->io.clear_color.alpha)
+            clear_color |= 0x8000 | (gpu->rendering->io.clear_color.alpha << 16);
         float clear_depth =
-            (gpu->master->io9.clear_depth & 0x7fff) / (float) (1 << 12);
-        if (gpu->w_buffer) clear_depth *= 0x200;
-        for (int y = 0; y < NDS_SCREEN_H; y++) {
-            for (int x = 0; x < NDS_SCREEN_W; x++) {
-                gpu->screen_back[y][x] = clear_color;
-                gpu->depth_buf[y][x] = clear_depth;
-                gpu->polyid_buf[y][x] = gpu->master->io9.clear_color.id;
-                gpu->attr_buf[y][x].b = 0;
-                gpu->attr_buf[y][x].fog = gpu->master->io9.clear_color.fog;
-            }
+            (gpu->rendering->io.clear_depth & 0x7fff) / (float) (1 << 12);
+        if (gpu->rendering->w_buffer) clear_depth *= 0x200;
+        for (int y = ymin; y < ymax; y++) {
+            fill32(&gpu->screen_back[y][xmin], clear_color, n);
+            fillf(&gpu->depth_buf[y][xmin], clear_depth, n);
+            memset(&gpu->polyid_buf[y][xmin], id, n);
+            memset(&gpu->attr_buf[y][xmin], attr.b, n);
         }
     }
-    if (ntremu.wireframe) {
-        for (int i = 0; i < gpu->n_polys_rendering; i++) {
-            render_polygon_wireframe(gpu, &gpu->polygonram_rendering[i]);
+}
+
+static void render_tile(GPU* gpu, int tile) {
+    int xmin = tile % TILES_X * TILE_W;
+    int xmax = xmin + TILE_W;
+    int ymin = tile / TILES_X * TILE_H;
+    int ymax = ymin + TILE_H;
+    clear_tile(gpu, xmin, xmax, ymin, ymax);
+    for (int i = 0; i < tile_n_polys[tile]; i++) {
+        struct poly_setup* ps = &poly_setups[tile_polys[tile][i]];
+        if (ntremu.wireframe) {
+            render_polygon_wireframe(gpu, ps->p, xmin, xmax, ymin, ymax);
+        } else {
+            render_polygon(gpu, ps, xmin, xmax, ymin, ymax);
         }
-    } else {
-        for (int i = 0; i < gpu->n_polys_rendering; i++) {
-            if (!IS_SEMITRANS(gpu->polygonram_rendering[i]))
-                render_polygon(gpu, &gpu->polygonram_rendering[i]);
-        }
-        for (int i = 0; i < gpu->n_polys_rendering; i++) {
-            if (IS_SEMITRANS(gpu->polygonram_rendering[i]))
-                render_polygon(gpu, &gpu->polygonram_rendering[i]);
-        }
-    }
-
-    if (gpu->master->io9.disp3dcnt.edge_marking ||
-        gpu->master->io9.disp3dcnt.fog_enable) {
-        float fog_depth =
-            (gpu->master->io9.fog_offset & 0x7fff) / (float) (1 << 12);
-        if (gpu->w_buffer) fog_depth *= 0x200;
-        float fog_step =
-            (0x400 >> gpu->master->io9.disp3dcnt.fog_shift) / (float) (1 << 12);
-        if (gpu->w_buffer) fog_step *= 0x200;
-        for (int y = 0; y < NDS_SCREEN_H; y++) {
-            for (int x = 0; x < NDS_SCREEN_W; x++) {
-                if (gpu->attr_buf[y][x].edge &&
-                    gpu->master->io9.disp3dcnt.edge_marking) {
-                    if ((x > 0 &&
-                         gpu->polyid_buf[y][x] != gpu->polyid_buf[y][x - 1] &&
-                         gpu->depth_buf[y][x] < gpu->depth_buf[y][x - 1]) ||
-                        (x < NDS_SCREEN_W - 1 &&
-                         gpu->polyid_buf[y][x] != gpu->polyid_buf[y][x + 1] &&
-                         gpu->depth_buf[y][x] < gpu->depth_buf[y][x + 1]) ||
-                        (y > 0 &&
-                         gpu->polyid_buf[y][x] != gpu->polyid_buf[y - 1][x] &&
-                         gpu->depth_buf[y][x] < gpu->depth_buf[y - 1][x]) ||
-                        (y < NDS_SCREEN_H - 1 &&
-                         gpu->polyid_buf[y][x] != gpu->polyid_buf[y + 1][x] &&
-                         gpu->depth_buf[y][x] < gpu->depth_buf[y + 1][x])) {
-                        if (gpu->master->io9.disp3dcnt.anti_aliasing) {
-                            u16 sr = gpu->screen_back[y][x] & 0x1f;
-                            u16 sg = gpu->screen_back[y][x] >> 5 & 0x1f;
-                            u16 sb = gpu->screen_back[y][x] >> 10 & 0x1f;
-                            u16 edgec =
-                                gpu->master->io9
-                                    .edge_color[gpu->polyid_buf[y][x] >> 3];
-                            u16 r = edgec & 0x1f;
-                            u16 g = edgec >> 5 & 0x1f;
-                            u16 b = edgec >> 10 & 0x1f;
-                            r = (r + sr) / 2;
-                            g = (g + sg) / 2;
-                            b = (b + sb) / 2;
-                            gpu->screen_back[y][x] &= 0xffff8000;
-                            gpu->screen_back[y][x] |= r | g << 5 | b << 10;
-                        } else {
-                            gpu->screen_back[y][x] &= 0xffff8000;
-                            gpu->screen_back[y][x] |=
-                                gpu->master->io9
-                                    .edge_color[gpu->polyid_buf[y][x] >> 3];
-                        }
-                    }
-                }
+    }
+}
 
-                if (gpu->attr_buf[y][x].fog &&
-                    gpu->master->io9.disp3dcnt.fog_enable) {
-                    float fog_ind_intr =
-                        (gpu->depth_buf[y][x] - fog_depth) / fog_step;
-                    if (fog_ind_intr < 0) fog_ind_intr = 0;
-                    if (fog_ind_intr > 31) fog_ind_intr = 31;
-                    int fog_ind = fog_ind_intr;
-                    fog_ind_intr -= fog_ind;
-                    u8 fog_density =
-                        (gpu->master->io9.fog_table[fog_ind] & 0x7f) *
-                            (1 - fog_ind_intr) +
-                        (gpu->master->io9.fog_table[fog_ind + 1] & 0x7f) *
-                            (fog_ind_intr);
-                    if (!gpu->master->io9.disp3dcnt.fog_mode) {
-                        u16 fogc = gpu->master->io9.fog_color.color;
-                        u16 fr = fogc & 0x1f;
-                        u16 fg = fogc >> 5 & 0x1f;
-                        u16 fb = fogc >> 10 & 0x1f;
-                        u16 sr = gpu->screen_back[y][x] & 0x1f;
-                        u16 sg = gpu->screen_back[y][x] >> 5 & 0x1f;
-                        u16 sb = gpu->screen_back[y][x] >> 10 & 0x1f;
-                        u16 r =
-                            (fr * fog_density + sr * (128 - fog_density)) / 128;
-                        u16 g =
-                            (fg * fog_density + sg * (128 - fog_density)) / 128;
-                        u16 b =
-                            (fb * fog_density + sb * (128 - fog_density)) / 128;
-                        gpu->screen_back[y][x] &= 0xffff8000;
-                        gpu->screen_back[y][x] |= r | g << 5 | b << 10;
-                    }
-                }
+static float fog_depth;
+static float fog_step;
+static float fog_densities[0x21];
+
+static void setup_post(GPU* gpu) {
+    fog_depth = (gpu->rendering->io.fog_offset & 0x7fff) / (float) (1 << 12);
+    if (gpu->rendering->w_buffer) fog_depth *= 0x200;
+    fog_step =
+        (0x400 >> gpu->rendering->io.disp3dcnt.fog_shift) / (float) (1 << 12);
+    if (gpu->rendering->w_buffer) fog_step *= 0x200;
+    for (int i = 0; i < 0x20; i++) {
+        fog_densities[i] = gpu->rendering->io.fog_table[i] & 0x7f;
+    }
+    fog_densities[0x20] = fog_densities[0x1f];
+}
+
+static void mark_edge(GPU* gpu, int x, int y) {
+    u16 edgec = gpu->rendering->io.edge_color[gpu->polyid_buf[y][x] >> 3];
+    if (gpu->rendering->io.disp3dcnt.anti_aliasing) {
+        u16 sr = gpu->screen_back[y][x] & 0x1f;
+        u16 sg = gpu->screen_back[y][x] >> 5 & 0x1f;
+        u16 sb = gpu->screen_back[y][x] >> 10 & 0x1f;
+        u16 r = ((edgec & 0x1f) + sr) / 2;
+        u16 g = ((edgec >> 5 & 0x1f) + sg) / 2;
+        u16 b = ((edgec >> 10 & 0x1f) + sb) / 2;
+        edgec = r | g << 5 | b << 10;
+    }
+    gpu->screen_back[y][x] &= 0xffff8000;
+    gpu->screen_back[y][x] |= edgec;
+}
+
+#ifdef __x86_64__
+static inline __m128i load_ids(u8* p) {
+    u32 w;
+    memcpy(&w, p, sizeof w);
+    __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(w), zero), zero);
+}
+
+static inline __m128i edge_test(__m128i id, __m128 d, __m128i nid,
+                                __m128 nd) {
+    return _mm_andnot_si128(_mm_cmpeq_epi32(id, nid),
+                            _mm_castps_si128(_mm_cmplt_ps(d, nd)));
+}
+
+static void post_row(GPU* gpu, int xmin, int xmax, int y, bool edges,
+                     bool fog) {
+    typeof(gpu->attr_buf[0][0]) attr = {0};
+    attr.edge = 1;
+    __m128i edge_bit = _mm_set1_epi32(attr.b);
+    attr.b = 0;
+    attr.fog = 1;
+    __m128i fog_bit = _mm_set1_epi32(attr.b);
+    __m128i zero = _mm_setzero_si128();
+    __m128i mask5 = _mm_set1_epi32(0x1f);
+    u16 fogc = gpu->rendering->io.fog_color.color;
+    __m128i fr = _mm_set1_epi32(fogc & 0x1f);
+    __m128i fg = _mm_set1_epi32(fogc >> 5 & 0x1f);
+    __m128i fb = _mm_set1_epi32(fogc >> 10 & 0x1f);
+    int yu = y > 0 ? y - 1 : y;
+    int yd = y < NDS_SCREEN_H - 1 ? y + 1 : y;
+    for (int x = xmin; x < xmax; x += 4) {
+        __m128i attrs = load_ids((u8*) &gpu->attr_buf[y][x]);
+        __m128 d = _mm_loadu_ps(&gpu->depth_buf[y][x]);
+        if (edges) {
+            __m128i id = load_ids(&gpu->polyid_buf[y][x]);
+            __m128i lid, rid;
+            __m128 ld, rd;
+            if (x > 0) {
+                lid = load_ids(&gpu->polyid_buf[y][x - 1]);
+                ld = _mm_loadu_ps(&gpu->depth_buf[y][x - 1]);
+            } else {
+                lid = _mm_shuffle_epi32(id, _MM_SHUFFLE(2, 1, 0, 0));
+                ld = _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 1, 0, 0));
             }
+            if (x + 4 < NDS_SCREEN_W) {
+                rid = load_ids(&gpu->polyid_buf[y][x + 1]);
+                rd = _mm_loadu_ps(&gpu->depth_buf[y][x + 1]);
+            } else {
+                rid = _mm_shuffle_epi32(id, _MM_SHUFFLE(3, 3, 2, 1));
+                rd = _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 2, 1));
+            }
+            __m128i e = edge_test(id, d, lid, ld);
+            e = _mm_or_si128(e, edge_test(id, d, rid, rd));
+            e = _mm_or_si128(
+                e, edge_test(id, d, load_ids(&gpu->polyid_buf[yu][x]),
+                             _mm_loadu_ps(&gpu->depth_buf[yu][x])));
+            e = _mm_or_si128(
+                e, edge_test(id, d, load_ids(&gpu->polyid_buf[yd][x]),
+                             _mm_loadu_ps(&gpu->depth_buf[yd][x])));
+            e = _mm_andnot_si128(
+                _mm_cmpeq_epi32(_mm_and_si128(attrs, edge_bit), zero), e);
+            int m = _mm_movemask_ps(_mm_castsi128_ps(e));
+            for (int i = 0; m; i++, m >>= 1) {
+                if (m & 1) mark_edge(gpu, x + i, y);
+            }
+        }
+        if (fog) {
+            __m128i f = _mm_andnot_si128(
+                _mm_cmpeq_epi32(_mm_and_si128(attrs, fog_bit), zero),
+                _mm_set1_epi32(-1));
+            if (!_mm_movemask_ps(_mm_castsi128_ps(f))) continue;
+            __m128 fi = _mm_div_ps(_mm_sub_ps(d, _mm_set1_ps(fog_depth)),
+                                   _mm_set1_ps(fog_step));
+            fi = _mm_min_ps(_mm_max_ps(fi, _mm_setzero_ps()),
+                            _mm_set1_ps(31));
+            __m128i ind = _mm_cvttps_epi32(fi);
+            fi = _mm_sub_ps(fi, _mm_cvtepi32_ps(ind));
+            int i[4];
+            _mm_storeu_si128((__m128i*) i, ind);
+            __m128 lo =
+                _mm_setr_ps(fog_densities[i[0]], fog_densities[i[1]],
+                            fog_densities[i[2]], fog_densities[i[3]]);
+            __m128 hi =
+                _mm_setr_ps(fog_densities[i[0] + 1], fog_densities[i[1] + 1],
+                            fog_densities[i[2] + 1], fog_densities[i[3] + 1]);
+            __m128i dens = _mm_cvttps_epi32(
+                _mm_add_ps(_mm_mul_ps(lo, _mm_sub_ps(_mm_set1_ps(1), fi)),
+                           _mm_mul_ps(hi, fi)));
+            __m128i inv = _mm_sub_epi32(_mm_set1_epi32(128), dens);
+            __m128i s = _mm_loadu_si128((__m128i*) &gpu->screen_back[y][x]);
+            __m128i sr = _mm_and_si128(s, mask5);
+            __m128i sg = _mm_and_si128(_mm_srli_epi32(s, 5), mask5);
+            __m128i sb = _mm_and_si128(_mm_srli_epi32(s, 10), mask5);
+            __m128i r = _mm_srli_epi32(
+                _mm_add_epi32(_mm_mullo_epi16(fr, dens),
+                              _mm_mullo_epi16(sr, inv)),
+                7);
+            __m128i g = _mm_srli_epi32(
+                _mm_add_epi32(_mm_mullo_epi16(fg, dens),
+                              _mm_mullo_epi16(sg, inv)),
+                7);
+            __m128i b = _mm_srli_epi32(
+                _mm_add_epi32(_mm_mullo_epi16(fb, dens),
+                              _mm_mullo_epi16(sb, inv)),
+                7);
+            __m128i res =
+                _mm_and_si128(s, _mm_set1_epi32(0xffff8000));
+            res = _mm_or_si128(res, r);
+            res = _mm_or_si128(res, _mm_slli_epi32(g, 5));
+            res = _mm_or_si128(res, _mm_slli_epi32(b, 10));
+            res = _mm_or_si128(_mm_and_si128(f, res), _mm_andnot_si128(f, s));
+            _mm_storeu_si128((__m128i*) &gpu->screen_back[y][x], res);
         }
     }
-}
\ No newline at end of file
+}
+#else
+static bool is_edge(GPU* gpu, int x, int y) {
+    return (x > 0 && gpu->polyid_buf[y][x] != gpu->polyid_buf[y][x - 1] &&
+            gpu->depth_buf[y][x] < gpu->depth_buf[y][x - 1]) ||
+           (x < NDS_SCREEN_W - 1 &&
+            gpu->polyid_buf[y][x] != gpu->polyid_buf[y][x + 1] &&
+            gpu->depth_buf[y][x] < gpu->depth_buf[y][x + 1]) ||
+           (y > 0 && gpu->polyid_buf[y][x] != gpu->polyid_buf[y - 1][x] &&
+            gpu->depth_buf[y][x] < gpu->depth_buf[y - 1][x]) ||
+           (y < NDS_SCREEN_H - 1 &&
+            gpu->polyid_buf[y][x] != gpu->polyid_buf[y + 1][x] &&
+            gpu->depth_buf[y][x] < gpu->depth_buf[y + 1][x]);
+}
+
+static void fog_pixel(GPU* gpu, int x, int y) {
+    float fog_ind_intr = (gpu->depth_buf[y][x] - fog_depth) / fog_step;
+    if (fog_ind_intr < 0) fog_ind_intr = 0;
+    if (fog_ind_intr > 31) fog_ind_intr = 31;
+    int fog_ind = fog_ind_intr;
+    fog_ind_intr -= fog_ind;
+    u8 fog_density = fog_densities[fog_ind] * (1 - fog_ind_intr) +
+                     fog_densities[fog_ind + 1] * fog_ind_intr;
+    u16 fogc = gpu->rendering->io.fog_color.color;
+    u16 fr = fogc & 0x1f;
+    u16 fg = fogc >> 5 & 0x1f;
+    u16 fb = fogc >> 10 & 0x1f;
+    u16 sr = gpu->screen_back[y][x] & 0x1f;
+    u16 sg = gpu->screen_back[y][x] >> 5 & 0x1f;
+    u16 sb = gpu->screen_back[y][x] >> 10 & 0x1f;
+    u16 r = (fr * fog_density + sr * (128 - fog_density)) / 128;
+    u16 g = (fg * fog_density + sg * (128 - fog_density)) / 128;
+    u16 b = (fb * fog_density + sb * (128 - fog_density)) / 128;
+    gpu->screen_back[y][x] &= 0xffff8000;
+    gpu->screen_back[y][x] |= r | g << 5 | b << 10;
+}
+
+static void post_row(GPU* gpu, int xmin, int xmax, int y, bool edges,
+                     bool fog) {
+    for (int x = xmin; x < xmax; x++) {
+        if (edges && gpu->attr_buf[y][x].edge && is_edge(gpu, x, y)) {
+            mark_edge(gpu, x, y);
+        }
+        if (fog && gpu->attr_buf[y][x].fog) fog_pixel(gpu, x, y);
+    }
+}
+#endif
+
+static void post_tile(GPU* gpu, int tile) {
+    int xmin = tile % TILES_X * TILE_W;
+    int xmax = xmin + TILE_W;
+    int ymin = tile / TILES_X * TILE_H;
+    int ymax = ymin + TILE_H;
+    bool edges = gpu->rendering->io.disp3dcnt.edge_marking;
+    bool fog = gpu->rendering->io.disp3dcnt.fog_enable &&
+               !gpu->rendering->io.disp3dcnt.fog_mode;
+    for (int y = ymin; y < ymax; y++) {
+        post_row(gpu, xmin, xmax, y, edges, fog);
+    }
+}
+
+void gpu_render(GPU* gpu) {
+    bind_textures(gpu);
+    setup_polys(gpu);
+    bin_polys(gpu);
+    run_jobs(gpu, render_tile);
+    if (gpu->rendering->io.disp3dcnt.edge_marking ||
+        (gpu->rendering->io.disp3dcnt.fog_enable &&
+         !gpu->rendering->io.disp3dcnt.fog_mode)) {
+        setup_post(gpu);
+        run_jobs(gpu, post_tile);
+    }
+}
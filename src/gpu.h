@@ -11,6 +11,24 @@
 
 #define MAX_POLY_N 10
 
+#define VTX_BATCH 4
+
+#define GX_RING_CMDS 1024
+#define GX_RING_PARAMS 4096
+
+#define MAX_RENDER_THREADS 16
+
+#define GPU_FRAMES 3
+
+#define TILE_W NDS_SCREEN_W
+#define TILE_H 32
+#define TILES_X (NDS_SCREEN_W / TILE_W)
+#define TILES_Y (NDS_SCREEN_H / TILE_H)
+
+#define TEXCACHE_SETS 16
+#define TEXCACHE_WAYS 4
+#define TEXCACHE_KEY 0x3ff0ffff
+
 enum {
     MTX_MODE = 0x10,
     MTX_PUSH,
@@ -151,15 +169,26 @@ typedef struct {
     vec4 v;
     vec4 vt;
     float r, g, b;
-    int sx, sy;
 } vertex;
 
 typedef struct {
-    vertex* p[MAX_POLY_N];
-    int n;
+    vec4 pos[MAX_VTX];
+    float s[MAX_VTX];
+    float t[MAX_VTX];
+    float r[MAX_VTX];
+    float g[MAX_VTX];
+    float b[MAX_VTX];
+    s16 sx[MAX_VTX];
+    s16 sy[MAX_VTX];
+} VertexRAM;
+
+typedef struct {
+    u16 p[MAX_POLY_N];
+    u8 n;
     PolygonAttr attr;
     TexParam texparam;
     u32 pltt_base;
+    u32* tex;
 } poly;
 
 struct interp_attrs {
@@ -169,14 +198,65 @@ struct interp_attrs {
     float r, g, b;
 };
 
+#define SPAN_STEP 8
+#define Z_FRAC 20
+#define W_FRAC 12
+#define ST_FRAC 12
+#define COLOR_FRAC 16
+
+struct interp_fixed {
+    s32 s, t;
+    s32 r, g, b;
+};
+
+struct poly_setup {
+    poly* p;
+    struct interp_attrs* left;
+    struct interp_attrs* right;
+    struct interp_attrs* delta;
+    int xMin, xMax;
+    int yMin, yMax;
+    u32 base;
+    u32 s_shift;
+    u32 t_shift;
+    u32 palbase;
+};
+
+typedef struct {
+    u32 key;
+    u32 pltt_base;
+    u32 map_gen;
+    u32 gen;
+    u32 frame;
+    u32 size;
+    u32* data;
+} TexCacheEntry;
+
+typedef struct {
+    u32 framebuffer[NDS_SCREEN_H][NDS_SCREEN_W];
+    VertexRAM vertexram;
+    poly polygonram[MAX_POLY];
+    u16 n_polys;
+    bool w_buffer;
+    IO io;
+} GPUFrame;
+
 typedef struct _NDS NDS;
 
 typedef struct {
     NDS* master;
 
-    u32 framebuffers[2][NDS_SCREEN_H][NDS_SCREEN_W];
+    GPUFrame frames[GPU_FRAMES];
     u32 (*screen)[NDS_SCREEN_W];
     u32 (*screen_back)[NDS_SCREEN_W];
+    u32 (*screen_last)[NDS_SCREEN_W];
+    GPUFrame* rendering;
+
+    u32 frame_submitted;
+    u32 frame_presented;
+    u32 frame_shown;
+    u32 frame_done;
+    u32 render_waits;
 
     float depth_buf[NDS_SCREEN_H][NDS_SCREEN_W];
     u8 polyid_buf[NDS_SCREEN_H][NDS_SCREEN_W];
@@ -193,19 +273,13 @@ typedef struct {
 
     u8* texram[4];
     u16* texpal[6];
+    u32 texmap_gen;
 
-    vertex vertexrambufs[2][MAX_VTX];
-    poly polygonrambufs[2][MAX_POLY];
-
-    vertex* vertexram;
+    VertexRAM* vertexram;
     poly* polygonram;
     u16 n_verts;
     u16 n_polys;
 
-    vertex* vertexram_rendering;
-    poly* polygonram_rendering;
-    u16 n_polys_rendering;
-
     bool blocked;
     bool drawing;
     bool pending_swapbuffers;
@@ -214,6 +288,12 @@ typedef struct {
     FIFO(u32, 256) param_fifo;
     u8 params_pending;
 
+    bool ram_overflow;
+    bool mtxstk_error;
+    bool boxtest;
+    s32 pos_result[4];
+    s16 vec_result[3];
+
     mat4 projmtx;
     mat4 projmtx_stk[1];
     u8 projstk_size;
@@ -233,6 +313,11 @@ typedef struct {
     mat4 clipmtx;
 
     bool mtx_dirty;
+    u32 freecam_gen;
+
+    vec4 vtx_batch[VTX_BATCH];
+    int vtx_batch_n;
+    int vtx_batch_i;
 
     int poly_mode;
     PolygonAttr cur_attr;
@@ -245,7 +330,7 @@ typedef struct {
     bool tri_orient;
 
     vertex cur_poly_vtxs[4];
-    vertex* cur_poly_strip[4];
+    u16 cur_poly_strip[4];
 
     vec4 lightvec[4];
     vec4 halfvec[4];
@@ -267,19 +352,20 @@ typedef struct {
 
 } GPU;
 
-extern pthread_t gpu_thread;
-extern pthread_mutex_t gpu_mutex;
-extern pthread_cond_t gpu_cond;
-
 void init_gpu_thread(GPU* gpu);
 void destroy_gpu_thread();
 
 void gpu_init_ptrs(GPU* gpu);
+void gpu_reset_texcache();
 
 void gxfifo_write(GPU* gpu, u32 command);
 void gxcmd_execute(GPU* gpu);
 void gxcmd_execute_all(GPU* gpu);
+void gxcmd_wait(GPU* gpu);
+void gpu_sync(GPU* gpu);
 void swap_buffers(GPU* gpu);
+void gpu_show_frame(GPU* gpu);
+void gpu_render_wait(GPU* gpu);
 
 void update_mtxs(GPU* gpu);
 
@@ -24,7 +24,10 @@ void io7_write8(IO* io, u32 addr, u8 data) {
     }
     if (addr == HALTCNT) {
         io->haltcnt = data;
-        if ((data >> 6) == 2) io->master->halt7 = true;
+        if ((data >> 6) == 2) {
+            io->master->halt7 = true;
+            io->master->cpu7.c.block = NULL;
+        }
         if ((data >> 6) == 3) io->master->sleep = true;
         return;
     }
@@ -546,6 +549,7 @@ void io9_write8(IO* io, u32 addr, u8 data) {
         case VRAMCNT_G:
         case VRAMCNT_H:
         case VRAMCNT_I: {
+            ppu_wait_lines();
             int i = addr - VRAMCNT_A;
             VRAMBank b = i + 1;
             if (b > VRAMG) b--;
@@ -577,11 +581,18 @@ void io9_write8(IO* io, u32 addr, u8 data) {
                                  io->vramcnt[i].ofs);
                 }
             }
+            io->master->gpu.texmap_gen++;
+            ppu_map_bg_vram(&io->master->ppuA);
+            ppu_map_bg_vram(&io->master->ppuB);
+            arm9_map_pages(&io->master->cpu9, 0x6000000, 0x7000000);
+            nds_remap7(io->master, 0x6000000, 0x7000000);
             break;
         }
         case WRAMCNT:
             io->wramcnt = data & 3;
             io->master->io7.wramstat = io->wramcnt;
+            arm9_map_pages(&io->master->cpu9, 0x3000000, 0x4000000);
+            nds_remap7(io->master, 0x3000000, 0x4000000);
             break;
         default: {
             u16 h;
@@ -609,6 +620,11 @@ u16 io9_read16(IO* io, u32 addr) {
         }
         return 0;
     }
+    if ((addr & ~3) == DISP3DCNT ||
+        (GXSTAT <= addr && addr < VECMTX_RESULT + 0x24)) {
+        gpu_sync(&io->master->gpu);
+        if (CLIPMTX_RESULT <= addr) update_mtxs(&io->master->gpu);
+    }
     switch (addr) {
         case TM0CNT:
         case TM1CNT:
@@ -634,6 +650,7 @@ void io9_write16(IO* io, u32 addr, u16 data) {
     if (AUXSPICNT <= addr && addr <= SEED1HI && io->exmemcnt.ndscardrights)
         return;
     if (addr >= IO_SIZE) return;
+    if (ppu_pending && ppu_deferred) ppu_log_write(io->master, addr, data);
     if (VRAMCNT_A <= addr && addr <= VRAMCNT_I) {
         io9_write8(io, addr, data & 0xff);
         io9_write8(io, addr | 1, data >> 8);
@@ -741,6 +758,7 @@ void io9_write16(IO* io, u32 addr, u16 data) {
             io->master->ppuB.bgaffintr[1].y = io->ppuB.bgaff[1].y;
             break;
         case DISP3DCNT:
+            gpu_sync(&io->master->gpu);
             io->disp3dcnt.w = data;
             io->disp3dcnt.rdlines_underflow = 0;
             io->disp3dcnt.ram_overflow = 0;
@@ -849,6 +867,7 @@ void io9_write16(IO* io, u32 addr, u16 data) {
             io9_write32(io, addr & ~3, data << 16);
             break;
         case GXSTAT:
+            gpu_sync(&io->master->gpu);
             if (data & (1 << 15)) io->gxstat.mtxstk_error = 0;
             break;
         case GXSTAT + 2:
@@ -867,6 +886,7 @@ void io9_write16(IO* io, u32 addr, u16 data) {
 
 u32 io9_read32(IO* io, u32 addr) {
     if (CLIPMTX_RESULT <= addr && addr < VECMTX_RESULT + 0x24) {
+        gpu_sync(&io->master->gpu);
         update_mtxs(&io->master->gpu);
     }
     switch (addr) {
@@ -16,6 +16,7 @@
 #include "emulator_state.h"
 #include "types.h"
 #include "nds.h"
+#include "bios.h"
 #include "arm/arm.h"
 #include "arm/thumb.h"
 
@@ -42,6 +43,7 @@ static int touch_x = 0;
 static int touch_y = 0;
 
 static bool show_touch_cursor;
+static bool show_cpu_stats;
 
 static uint32_t clamp(uint32_t value, uint32_t min, uint32_t max)
 {
@@ -223,6 +225,17 @@ static void init_config()
     { "ntremu_boot_bios", "Boot bios on startup; disabled|enabled" },
     { "ntremu_uncaped_speed", "Run at uncapped speed; enabled|disabled" },
     { "ntremu_touch_cursor", "Show touch cursor; disabled|enabled" },
+    { "ntremu_cpu_backend", "CPU backend; interpreter|cached|jit" },
+    { "ntremu_fastmem", "Fastmem arena for CPU loads; disabled|enabled" },
+    { "ntremu_hle_bios", "Emulate common bios calls natively; disabled|enabled" },
+    { "ntremu_cpu7_thread", "Run the ARM7 on its own thread; disabled|enabled" },
+    { "ntremu_ppu_threads", "Render the 2D engines on worker threads; disabled|enabled" },
+    { "ntremu_ppu_deferred", "Render 2D frames at VBlank from a register log; disabled|enabled" },
+    { "ntremu_cpu_quantum", "CPU slice length; auto|64|128|256|512|1024|2048|4096" },
+    { "ntremu_cpu_stats", "Log the average CPU slice length; disabled|enabled" },
+    { "ntremu_geometry_thread", "Run the 3D geometry engine on its own thread; disabled|enabled" },
+    { "ntremu_render_threads", "3D render threads; 1|2|3|4|6|8|12|16" },
+    { "ntremu_rasterizer", "3D rasterizer; float|fixed" },
     { NULL, NULL }
   };
 
@@ -234,6 +247,31 @@ static void update_config()
   ntremu.bootbios = fetch_variable_bool("ntremu_boot_bios", false);
   ntremu.uncap = fetch_variable_bool("ntremu_uncaped_speed", true);
   show_touch_cursor = fetch_variable_bool("ntremu_touch_cursor", false);
+  show_cpu_stats = fetch_variable_bool("ntremu_cpu_stats", false);
+  ntremu.fastmem = fetch_variable_bool("ntremu_fastmem", false);
+  ntremu.hle_bios = fetch_variable_bool("ntremu_hle_bios", false);
+  ntremu.cpu7_thread = fetch_variable_bool("ntremu_cpu7_thread", false);
+  ntremu.ppu_threads = fetch_variable_bool("ntremu_ppu_threads", false);
+  ntremu.ppu_deferred = fetch_variable_bool("ntremu_ppu_deferred", false);
+  ntremu.geometry_thread = fetch_variable_bool("ntremu_geometry_thread", false);
+
+  char* backend = fetch_variable("ntremu_cpu_backend", "interpreter");
+  if (strcmp(backend, "jit") == 0) ntremu.cpu_backend = CPU_JIT;
+  else if (strcmp(backend, "cached") == 0) ntremu.cpu_backend = CPU_CACHED;
+  else ntremu.cpu_backend = CPU_INTERP;
+  free(backend);
+
+  char* quantum = fetch_variable("ntremu_cpu_quantum", "auto");
+  ntremu.quantum = atoi(quantum);
+  free(quantum);
+
+  char* render_threads = fetch_variable("ntremu_render_threads", "1");
+  ntremu.render_threads = atoi(render_threads);
+  free(render_threads);
+
+  char* rasterizer = fetch_variable("ntremu_rasterizer", "float");
+  ntremu.fixed_raster = strcmp(rasterizer, "fixed") == 0;
+  free(rasterizer);
 }
 
 static void check_config_variables()
@@ -244,6 +282,24 @@ static void check_config_variables()
   if (updated) update_config();
 }
 
+static void log_cpu_stats()
+{
+  static unsigned frames;
+  static uint64_t prev_now;
+  static uint64_t prev_slices;
+
+  if (++frames < 60) return;
+
+  uint64_t slices = ntremu.nds->slices - prev_slices;
+  if (slices)
+    log_cb(RETRO_LOG_INFO, "%u cyc/slice\n",
+           (unsigned)((ntremu.nds->sched.now - prev_now) / slices));
+
+  frames = 0;
+  prev_now = ntremu.nds->sched.now;
+  prev_slices = ntremu.nds->slices;
+}
+
 static void draw_cursor(uint32_t *data, int32_t pointX, int32_t pointY, int32_t size)
 {
   uint32_t scale = 1;
@@ -385,21 +441,33 @@ bool retro_load_game(const struct retro_game_info* info)
   int bios9fd = open(bios9_path, O_RDONLY);
   int fwarefd = open(fware_path, O_RDWR);
 
-  if (bios7fd < 0 || bios9fd < 0 || fwarefd < 0)
+  if ((bios7fd < 0 || bios9fd < 0 || fwarefd < 0) &&
+      (!ntremu.hle_bios || ntremu.bootbios))
   {
     log_cb(RETRO_LOG_ERROR, "Missing bios or firmware");
     return false;
   }
 
-  ntremu.bios7 = mmap(NULL, BIOS7SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, bios7fd, 0);
-  ntremu.bios9 = mmap(NULL, BIOS9SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, bios9fd, 0);
-  ntremu.firmware = mmap(NULL, FIRMWARESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fwarefd, 0);
+  ntremu.bios7 = mmap(NULL, BIOS7SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | (bios7fd < 0 ? MAP_ANONYMOUS : 0), bios7fd, 0);
+  ntremu.bios9 = mmap(NULL, BIOS9SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | (bios9fd < 0 ? MAP_ANONYMOUS : 0), bios9fd, 0);
+  ntremu.firmware = mmap(NULL, FIRMWARESIZE, PROT_READ | PROT_WRITE, fwarefd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED, fwarefd, 0);
+
+  if (bios7fd < 0)
+    bios7_stub(ntremu.bios7);
+  if (bios9fd < 0)
+    bios9_stub(ntremu.bios9);
 
   close(bios7fd);
   close(bios9fd);
   close(fwarefd);
 
-  ntremu.nds = malloc(sizeof *ntremu.nds);
+  ntremu.nds = create_nds(ntremu.fastmem);
+  if (!ntremu.nds)
+  {
+    log_cb(RETRO_LOG_ERROR, "Out of memory");
+    return false;
+  }
+
   ntremu.card = create_card(ntremu.romfile);
 
   if (!ntremu.card)
@@ -421,6 +489,9 @@ bool retro_load_game(const struct retro_game_info* info)
   ntremu.debugger = false;
 
   init_gpu_thread(&ntremu.nds->gpu);
+  if (ntremu.cpu7_thread) init_cpu7_thread(ntremu.nds);
+  if (ntremu.ppu_threads) init_ppu_threads(ntremu.nds);
+  else if (ntremu.ppu_deferred) init_ppu_deferred(ntremu.nds);
 
   return true;
 }
@@ -432,12 +503,14 @@ bool retro_load_game_special(unsigned type, const struct retro_game_info* info,
 
 void retro_unload_game(void)
 {
+  destroy_ppu_threads();
+  destroy_cpu7_thread();
   destroy_gpu_thread();
 
   close(ntremu.dldi_sd_fd);
   destroy_card(ntremu.card);
 
-  free(ntremu.nds);
+  destroy_nds(ntremu.nds);
 
   munmap(ntremu.bios7, BIOS7SIZE);
   munmap(ntremu.bios9, BIOS9SIZE);
@@ -532,6 +605,9 @@ void retro_run(void)
 
   ntremu.nds->frame_complete = false;
 
+  if (show_cpu_stats)
+    log_cpu_stats();
+
   video_cb(pixels, NDS_SCREEN_W, NDS_SCREEN_H * 2, NDS_SCREEN_W * 4);
   audio_batch_cb(samples, sizeof(samples) / (2 * sizeof(int16_t)));
 }
@@ -29,6 +29,9 @@ int main(int argc, char** argv) {
     if (emulator_init(argc, argv) < 0) return -1;
 
     init_gpu_thread(&ntremu.nds->gpu);
+    if (ntremu.cpu7_thread) init_cpu7_thread(ntremu.nds);
+    if (ntremu.ppu_threads) init_ppu_threads(ntremu.nds);
+    else if (ntremu.ppu_deferred) init_ppu_deferred(ntremu.nds);
 
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER);
 
@@ -41,8 +44,9 @@ int main(int argc, char** argv) {
     SDL_Renderer* renderer;
     SDL_CreateWindowAndRenderer(NDS_SCREEN_W * 2, NDS_SCREEN_H * 4,
                                 SDL_WINDOW_RESIZABLE, &window, &renderer);
-    snprintf(wintitle, 199, "ntremu | %s | %.2lf FPS", ntremu.romfilenodir,
-             0.0);
+    snprintf(wintitle, 199,
+             "ntremu | %s | %.2lf FPS | %u cyc/slice | %u 3d waits",
+             ntremu.romfilenodir, 0.0, QUANTUM_DEFAULT, 0);
     SDL_SetWindowTitle(window, wintitle);
     SDL_RenderClear(renderer);
     SDL_RenderPresent(renderer);
@@ -62,6 +66,9 @@ int main(int argc, char** argv) {
     Uint64 prev_time = SDL_GetPerformanceCounter();
     Uint64 prev_fps_update = prev_time;
     Uint64 prev_fps_frame = 0;
+    u64 prev_fps_now = 0;
+    u64 prev_fps_slices = 0;
+    u32 prev_fps_waits = 0;
     const Uint64 frame_ticks = SDL_GetPerformanceFrequency() / 60;
     Uint64 frame = 0;
 
@@ -162,11 +169,20 @@ int main(int argc, char** argv) {
             if (elapsed >= SDL_GetPerformanceFrequency() / 2) {
                 double fps = (double) SDL_GetPerformanceFrequency() *
                              (frame - prev_fps_frame) / elapsed;
-                snprintf(wintitle, 199, "ntremu | %s | %.2lf FPS",
-                         ntremu.romfilenodir, fps);
+                u64 slices = ntremu.nds->slices - prev_fps_slices;
+                u32 slice_len =
+                    slices ? (ntremu.nds->sched.now - prev_fps_now) / slices
+                           : 0;
+                u32 waits = ntremu.nds->gpu.render_waits - prev_fps_waits;
+                snprintf(wintitle, 199,
+                         "ntremu | %s | %.2lf FPS | %u cyc/slice | %u 3d waits",
+                         ntremu.romfilenodir, fps, slice_len, waits);
                 SDL_SetWindowTitle(window, wintitle);
                 prev_fps_update = cur_time;
                 prev_fps_frame = frame;
+                prev_fps_now = ntremu.nds->sched.now;
+                prev_fps_slices = ntremu.nds->slices;
+                prev_fps_waits = ntremu.nds->gpu.render_waits;
             }
             prev_time = cur_time;
 
@@ -221,6 +237,8 @@ int main(int argc, char** argv) {
 
     SDL_Quit();
 
+    destroy_ppu_threads();
+    destroy_cpu7_thread();
     destroy_gpu_thread();
 
     emulator_quit();
@@ -1,17 +1,85 @@
 #include "nds.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "arm/jit.h"
 #include "bus7.h"
 #include "bus9.h"
 #include "dldi.h"
+#include "fastmem.h"
+#include "emulator_state.h"
 #include "ppu.h"
 
+#define CPU7_SPIN 4096
+
+bool cpu7_threaded;
+pthread_t cpu7_thread;
+pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t cpu7_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cpu7_cond = PTHREAD_COND_INITIALIZER;
+static u32 cpu7_slice;
+static u32 cpu7_done;
+static bool cpu7_sleeping;
+static bool cpu7_quit;
+static pthread_cond_t cpu9_cond = PTHREAD_COND_INITIALIZER;
+static bool cpu9_sleeping;
+static int io_depth[2];
+
+NDS* create_nds(bool fastmem) {
+    int memfd = -1;
+    NDS* nds = fastmem ? fastmem_alloc(sizeof *nds, &memfd) : NULL;
+    if (nds) {
+        nds->cpu9.fastmem = fastmem_create();
+        nds->cpu7.fastmem = fastmem_create();
+        if (!nds->cpu9.fastmem || !nds->cpu7.fastmem) {
+            fastmem_destroy(nds->cpu9.fastmem);
+            fastmem_destroy(nds->cpu7.fastmem);
+            nds->cpu9.fastmem = NULL;
+            nds->cpu7.fastmem = NULL;
+        }
+    } else {
+        nds = aligned_alloc(PAGESIZE, sizeof *nds);
+        if (!nds) return NULL;
+        nds->cpu9.fastmem = NULL;
+        nds->cpu7.fastmem = NULL;
+    }
+    nds->cpu9.c.jit = jit_create();
+    nds->cpu7.c.jit = jit_create();
+    nds->memfd = memfd;
+    return nds;
+}
+
+void destroy_nds(NDS* nds) {
+    fastmem_destroy(nds->cpu9.fastmem);
+    fastmem_destroy(nds->cpu7.fastmem);
+    jit_destroy(nds->cpu9.c.jit);
+    jit_destroy(nds->cpu7.c.jit);
+    if (nds->memfd >= 0) fastmem_free(nds, sizeof *nds, nds->memfd);
+    else free(nds);
+}
+
 void init_nds(NDS* nds, GameCard* card, u8* bios7, u8* bios9, u8* firmware,
               bool bootbios) {
+    int memfd = nds->memfd;
+    u8* fastmem9 = nds->cpu9.fastmem;
+    u8* fastmem7 = nds->cpu7.fastmem;
+    JitState* jit9 = nds->cpu9.c.jit;
+    JitState* jit7 = nds->cpu7.c.jit;
+    gxcmd_wait(&nds->gpu);
+    gpu_render_wait(&nds->gpu);
+    ppu_wait_lines();
     memset(nds, 0, sizeof *nds);
-    nds->sched.master = nds;
+    nds->memfd = memfd;
+    nds->cpu9.fastmem = fastmem9;
+    nds->cpu7.fastmem = fastmem7;
+    nds->cpu9.c.jit = jit9;
+    nds->cpu7.c.jit = jit7;
+    init_scheduler(&nds->sched, nds);
+    nds->quantum = QUANTUM_DEFAULT;
+    nds->quantum_base = QUANTUM_DEFAULT;
 
     arm7_init(&nds->cpu7);
     nds->cpu7.master = nds;
@@ -54,6 +122,8 @@ void init_nds(NDS* nds, GameCard* card, u8* bios7, u8* bios9, u8* firmware,
     nds->ppuB.oam = nds->oamB;
     nds->ppuB.bgReg = VRAMBGB;
     nds->ppuB.objReg = VRAMOBJB;
+    ppu_map_bg_vram(&nds->ppuA);
+    ppu_map_bg_vram(&nds->ppuB);
 
     nds->gpu.master = nds;
     nds->gpu.texram[0] = nds->vramA;
@@ -67,6 +137,7 @@ void init_nds(NDS* nds, GameCard* card, u8* bios7, u8* bios9, u8* firmware,
     nds->gpu.texpal[4] = (u16*) nds->vramF;
     nds->gpu.texpal[5] = (u16*) nds->vramG;
     gpu_init_ptrs(&nds->gpu);
+    gpu_reset_texcache();
 
     nds->io7.master = nds;
     nds->io9.master = nds;
@@ -181,41 +252,180 @@ void init_nds(NDS* nds, GameCard* card, u8* bios7, u8* bios9, u8* firmware,
         cpu_flush((ArmCore*) &nds->cpu7);
     }
 
+    arm9_map_pages(&nds->cpu9, 0, 1 << 28);
+    arm7_map_pages(&nds->cpu7, 0, 1 << 28);
+
     lcd_hdraw(nds);
     spu_sample(&nds->spu);
 }
 
-void nds_run(NDS* nds) {
-    while (nds->sched.now - nds->last_event < 512 &&
-           !event_pending(&nds->sched)) {
+static void run_cpu9(NDS* nds, u64* now) {
+    nds->idle[CPU9] = false;
+    while (*now - nds->last_event < nds->quantum && *now < nds->sched.next) {
         if (arm9_step(&nds->cpu9)) {
-            nds->sched.now += nds->cpu9.c.cycles >> 1;
+            *now += nds->cpu9.c.cycles >> 1;
             if (!(nds->half_tick ^= nds->cpu9.c.cycles & 1)) {
-                nds->sched.now++;
+                (*now)++;
             }
         } else {
-            nds->sched.now = FIFO_peek(nds->sched.event_queue).time;
+            *now = nds->sched.next;
+            nds->idle[CPU9] = true;
             break;
         }
     }
-    nds->cur_cpu = (ArmCore*) &nds->cpu7;
-    nds->cur_cpu_type = CPU7;
-    nds->sched.now = nds->last_event;
-    while (nds->sched.now - nds->last_event < 512 &&
-           !event_pending(&nds->sched)) {
+}
+
+static void run_cpu7(NDS* nds, u64* now) {
+    nds->idle[CPU7] = false;
+    while (*now - nds->last_event < nds->quantum && *now < nds->sched.next) {
         if (nds->halt7) {
             if (nds->io7.ie.w & nds->io7.ifl.w) {
                 nds->halt7 = false;
                 nds->io7.haltcnt = 0;
                 nds->cpu7.c.irq = true;
             } else {
-                nds->sched.now = FIFO_peek(nds->sched.event_queue).time;
+                *now = nds->sched.next;
+                nds->idle[CPU7] = true;
                 break;
             }
+        } else if (arm7_step(&nds->cpu7)) {
+            *now += nds->cpu7.c.cycles;
         } else {
-            arm7_step(&nds->cpu7);
-            nds->sched.now += nds->cpu7.c.cycles;
+            *now = nds->sched.next;
+            nds->idle[CPU7] = true;
+            break;
+        }
+    }
+}
+
+static void* cpu7_thread_run(void* data) {
+    NDS* nds = data;
+    u32 slice = 0;
+    while (true) {
+        slice++;
+        for (int i = 0; __atomic_load_n(&cpu7_slice, __ATOMIC_ACQUIRE) != slice;
+             i++) {
+            if (i < CPU7_SPIN) continue;
+            pthread_mutex_lock(&cpu7_mutex);
+            while (cpu7_slice != slice && !cpu7_quit) {
+                cpu7_sleeping = true;
+                pthread_cond_wait(&cpu7_cond, &cpu7_mutex);
+            }
+            cpu7_sleeping = false;
+            pthread_mutex_unlock(&cpu7_mutex);
+            break;
+        }
+        if (cpu7_quit) return NULL;
+        run_cpu7(nds, &nds->cpu_now[CPU7]);
+        pthread_mutex_lock(&cpu7_mutex);
+        __atomic_store_n(&cpu7_done, slice, __ATOMIC_RELEASE);
+        if (cpu9_sleeping) pthread_cond_signal(&cpu9_cond);
+        pthread_mutex_unlock(&cpu7_mutex);
+    }
+}
+
+void init_cpu7_thread(NDS* nds) {
+    cpu7_quit = false;
+    pthread_create(&cpu7_thread, NULL, cpu7_thread_run, nds);
+    cpu7_threaded = true;
+    arm7_map_pages(&nds->cpu7, 0x3000000, 0x3800000);
+}
+
+void destroy_cpu7_thread() {
+    if (!cpu7_threaded) return;
+    pthread_mutex_lock(&cpu7_mutex);
+    cpu7_quit = true;
+    pthread_cond_signal(&cpu7_cond);
+    pthread_mutex_unlock(&cpu7_mutex);
+    pthread_join(cpu7_thread, NULL);
+    cpu7_threaded = false;
+}
+
+// each CPU only takes the lock from its own thread, so a per-CPU depth is
+// enough to let DMA started under the lock reenter the bus
+void nds_lock_io(NDS* nds, CPUType t) {
+    if (io_depth[t]++) return;
+    pthread_mutex_lock(&io_mutex);
+    nds->sched.now = nds->cpu_now[t];
+}
+
+void nds_unlock_io(NDS* nds, CPUType t) {
+    if (--io_depth[t]) return;
+    nds->cpu_now[t] = nds->sched.now;
+    pthread_mutex_unlock(&io_mutex);
+}
+
+void nds_remap7(NDS* nds, u32 start, u32 end) {
+    if (!nds->cpu7_parallel) {
+        arm7_map_pages(&nds->cpu7, start, end);
+        return;
+    }
+    if (nds->remap7_start == nds->remap7_end || start < nds->remap7_start)
+        nds->remap7_start = start;
+    if (end > nds->remap7_end) nds->remap7_end = end;
+}
+
+static void run_parallel(NDS* nds) {
+    nds->cpu_now[CPU9] = nds->last_event;
+    nds->cpu_now[CPU7] = nds->last_event;
+    nds->cpu7_parallel = true;
+
+    pthread_mutex_lock(&cpu7_mutex);
+    u32 slice = __atomic_add_fetch(&cpu7_slice, 1, __ATOMIC_RELEASE);
+    if (cpu7_sleeping) pthread_cond_signal(&cpu7_cond);
+    pthread_mutex_unlock(&cpu7_mutex);
+
+    run_cpu9(nds, &nds->cpu_now[CPU9]);
+    for (int i = 0; __atomic_load_n(&cpu7_done, __ATOMIC_ACQUIRE) != slice;
+         i++) {
+        if (i < CPU7_SPIN) continue;
+        pthread_mutex_lock(&cpu7_mutex);
+        while (cpu7_done != slice) {
+            cpu9_sleeping = true;
+            pthread_cond_wait(&cpu9_cond, &cpu7_mutex);
         }
+        cpu9_sleeping = false;
+        pthread_mutex_unlock(&cpu7_mutex);
+        break;
+    }
+
+    nds->cpu7_parallel = false;
+    nds->sched.now = nds->cpu_now[CPU7];
+    if (nds->remap7_start != nds->remap7_end) {
+        arm7_map_pages(&nds->cpu7, nds->remap7_start, nds->remap7_end);
+        nds->remap7_start = nds->remap7_end = 0;
+    }
+}
+
+static void update_quantum(NDS* nds) {
+    nds->slices++;
+    if (ntremu.quantum) {
+        nds->quantum = ntremu.quantum;
+        return;
+    }
+    if (nds->ipc_count >= QUANTUM_IPC_BUSY) {
+        if (nds->quantum_base > QUANTUM_MIN) nds->quantum_base >>= 1;
+    } else if (!nds->ipc_count) {
+        if (nds->quantum_base < QUANTUM_MAX) nds->quantum_base <<= 1;
+    }
+    nds->ipc_count = 0;
+    if (nds->idle[CPU9] || nds->idle[CPU7] || nds->cpu9.halt || nds->halt7) {
+        nds->quantum = -1;
+    } else {
+        nds->quantum = nds->quantum_base;
+    }
+}
+
+void nds_run(NDS* nds) {
+    update_quantum(nds);
+    if (cpu7_threaded) {
+        run_parallel(nds);
+    } else {
+        run_cpu9(nds, &nds->sched.now);
+        nds->cur_cpu = (ArmCore*) &nds->cpu7;
+        nds->cur_cpu_type = CPU7;
+        nds->sched.now = nds->last_event;
+        run_cpu7(nds, &nds->sched.now);
     }
     run_to_present(&nds->sched);
     nds->cpu7.c.irq = nds->io7.ime && (nds->io7.ie.w & nds->io7.ifl.w);
@@ -234,11 +444,12 @@ bool nds_step(NDS* nds) {
                 nds->io7.haltcnt = 0;
                 nds->cpu7.c.irq = true;
             } else {
-                nds->sched.now = FIFO_peek(nds->sched.event_queue).time;
+                nds->sched.now = nds->sched.next;
             }
-        } else {
-            arm7_step(&nds->cpu7);
+        } else if (arm7_step(&nds->cpu7)) {
             nds->sched.now += nds->cpu7.c.cycles;
+        } else {
+            nds->sched.now = nds->sched.next;
         }
     } else {
         if (arm9_step(&nds->cpu9)) {
@@ -249,10 +460,11 @@ bool nds_step(NDS* nds) {
                 }
             }
         } else {
-            nds->sched.now = FIFO_peek(nds->sched.event_queue).time;
+            nds->sched.now = nds->sched.next;
         }
     }
-    if (nds->sched.now - nds->last_event >= 512 || event_pending(&nds->sched)) {
+    if (nds->sched.now - nds->last_event >= nds->quantum ||
+        event_pending(&nds->sched)) {
         if (nds->cur_cpu_type == CPU7) {
             run_to_present(&nds->sched);
             nds->cpu7.c.irq = nds->io7.ime && (nds->io7.ie.w & nds->io7.ifl.w);
@@ -493,7 +705,10 @@ void* get_vram(NDS* nds, VRAMRegion region, u32 addr) {
     void vram_write##size(NDS* nds, VRAMRegion region, u32 addr,               \
                           u##size data) {                                      \
         u##size* p = get_vram(nds, region, addr);                              \
-        if (p) *p = data;                                                      \
+        if (p) {                                                               \
+            *p = data;                                                         \
+            (*vram_gen(nds, p))++;                                             \
+        }                                                                      \
     }
 
 VRAMREADDECL(8)
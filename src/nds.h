@@ -1,6 +1,8 @@
 #ifndef NDS_H
 #define NDS_H
 
+#include <pthread.h>
+
 #include "arm7tdmi.h"
 #include "arm946e.h"
 #include "dma.h"
@@ -48,6 +50,11 @@ typedef enum {
 #define BIOS9SIZE (1 << 12)
 #define FIRMWARESIZE (1 << 18)
 
+#define QUANTUM_MIN 64
+#define QUANTUM_DEFAULT 512
+#define QUANTUM_MAX 4096
+#define QUANTUM_IPC_BUSY 8
+
 typedef enum { CPU9, CPU7 } CPUType;
 
 enum {
@@ -99,16 +106,23 @@ typedef struct _NDS {
     PPU ppuB;
     GPU gpu;
 
-    u8 ram[RAMSIZE];
+    u8 ram[RAMSIZE] __attribute__((aligned(PAGESIZE)));
 
     union {
         struct {
             u8 wram0[WRAMSIZE / 2];
             u8 wram1[WRAMSIZE / 2];
         };
-        u8 wram[WRAMSIZE];
+        u8 wram[WRAMSIZE] __attribute__((aligned(PAGESIZE)));
     };
-    u8 wram7[WRAM7SIZE];
+    u8 wram7[WRAM7SIZE] __attribute__((aligned(PAGESIZE)));
+
+    u32 ramgen[RAMSIZE >> BLOCKPAGEBITS];
+    u32 wramgen[WRAMSIZE >> BLOCKPAGEBITS];
+    u32 wram7gen[WRAM7SIZE >> BLOCKPAGEBITS];
+    u32 vramgen[VRAMSIZE >> BLOCKPAGEBITS];
+    u32 oamgen[2 * OAMSIZE >> BLOCKPAGEBITS];
+    u32 biosgen;
 
     IO io7;
     IO io9;
@@ -137,7 +151,7 @@ typedef struct _NDS {
             u8 vramH[VRAMHSIZE];
             u8 vramI[VRAMFGISIZE];
         };
-        u8 vram[VRAMSIZE];
+        u8 vram[VRAMSIZE] __attribute__((aligned(PAGESIZE)));
     };
 
     u8* vrambanks[9];
@@ -177,7 +191,7 @@ typedef struct _NDS {
         u8 oam[2 * OAMSIZE];
     };
 
-    u8 expansionram[1 << 25];
+    u8 expansionram[1 << 25] __attribute__((aligned(PAGESIZE)));
 
     u8* bios7;
     u8* bios9;
@@ -214,6 +228,11 @@ typedef struct _NDS {
     ArmCore* cur_cpu;
 
     u64 last_event;
+    u32 quantum;
+    u32 quantum_base;
+    u32 ipc_count;
+    bool idle[2];
+    u64 slices;
     u64 next_vblank;
     int half_tick;
 
@@ -223,18 +242,50 @@ typedef struct _NDS {
     bool memerr;
     bool cpuerr;
 
+    bool cpu7_parallel;
+    u64 cpu_now[2];
+    u32 remap7_start;
+    u32 remap7_end;
+
+    int memfd;
+
 } NDS;
 
+extern bool cpu7_threaded;
+extern pthread_t cpu7_thread;
+extern pthread_mutex_t io_mutex;
+
+NDS* create_nds(bool fastmem);
+void destroy_nds(NDS* nds);
+
 void init_nds(NDS* nds, GameCard* card, u8* bios7, u8* bios9, u8* firmware,
               bool bootbios);
 
 bool nds_step(NDS* nds);
 void nds_run(NDS* nds);
 
+void init_cpu7_thread(NDS* nds);
+void destroy_cpu7_thread();
+
+void nds_lock_io(NDS* nds, CPUType t);
+void nds_unlock_io(NDS* nds, CPUType t);
+void nds_remap7(NDS* nds, u32 start, u32 end);
+
 void firmware_spi_write(NDS* nds, u8 data, bool hold);
 void tsc_spi_write(NDS* nds, u8 data);
 void rtc_write(NDS* nds);
 
+static inline void nds_count_ipc(NDS* nds, u32 addr) {
+    if ((addr & 0xfffff0) == IPCSYNC || (addr & 0xfffffc) == IPCFIFORECV)
+        __atomic_add_fetch(&nds->ipc_count, 1, __ATOMIC_RELAXED);
+}
+
+void* get_vram(NDS* nds, VRAMRegion region, u32 addr);
+
+static inline u32* vram_gen(NDS* nds, void* p) {
+    return &nds->vramgen[((u8*) p - nds->vram) >> BLOCKPAGEBITS];
+}
+
 u8 vram_read8(NDS* nds, VRAMRegion region, u32 addr);
 u16 vram_read16(NDS* nds, VRAMRegion region, u32 addr);
 u32 vram_read32(NDS* nds, VRAMRegion region, u32 addr);
@@ -1,13 +1,22 @@
 #include "ppu.h"
 
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #include "gpu.h"
 #include "io.h"
 #include "nds.h"
 #include "scheduler.h"
 
+#define LINE_SPIN 4096
+#define LINE_QUEUE 256
+#define LINE_BATCH 16
+#define LINE_LOG 4096
+
 const int SCLAYOUT[4][2][2] = {
     {{0, 0}, {0, 0}}, {{0, 1}, {0, 1}}, {{0, 0}, {1, 1}}, {{0, 1}, {2, 3}}};
 
@@ -15,10 +24,100 @@ const int BMLAYOUT[4][2] = {{128, 128}, {256, 256}, {512, 256}, {512, 512}};
 
 const int DISPCAPLAYOUT[4][2] = {{128, 128}, {256, 64}, {256, 128}, {256, 192}};
 
+typedef struct {
+    PPUIO io;
+    u16 (*screen)[NDS_SCREEN_W];
+    BgAffIntr bgaffintr[2];
+    u16 ly;
+    u8 bgmos_y;
+    u8 objmos_y;
+    bool in_win[2];
+} PPULine;
+
+typedef struct {
+    u8 ly;
+    u8 hblank;
+    u16 addr;
+    u16 data;
+} LineLogEntry;
+
+typedef struct {
+    PPU* src;
+    PPU ppu;
+    PPUIO io;
+    RING(PPULine, LINE_QUEUE) lines;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool sleeping;
+} LineWorker;
+
+bool ppu_threaded;
+bool ppu_deferred;
+bool ppu_pending;
+
+static LineWorker line_workers[2];
+static u32 line_vram_banks;
+static bool line_quit;
+
+static LineLogEntry line_log[LINE_LOG];
+static u32 line_log_n;
+static u16 defer_start;
+static u16 defer_end;
+
 // size: sqr, short, long
 const int OBJLAYOUT[4][3] = {
     {8, 8, 16}, {16, 8, 32}, {32, 16, 32}, {64, 32, 64}};
 
+static inline LineWorker* line_worker(PPU* ppu) {
+    return &line_workers[ppu != &ppu->master->ppuA];
+}
+
+static void line_ppu_sync(LineWorker* w) {
+    PPU* p = &w->ppu;
+    p->master = w->src->master;
+    p->io = &w->io;
+    p->pal = w->src->pal;
+    memcpy(p->extPalBg, w->src->extPalBg, sizeof p->extPalBg);
+    p->extPalObj = w->src->extPalObj;
+    p->oam = w->src->oam;
+    p->bgReg = w->src->bgReg;
+    p->objReg = w->src->objReg;
+    memcpy(p->bg_pages, w->src->bg_pages, sizeof p->bg_pages);
+    memset(p->bg_rows, 0, sizeof p->bg_rows);
+    p->obj_binned = false;
+}
+
+void ppu_map_bg_vram(PPU* ppu) {
+    for (int i = 0; i < BG_PAGES; i++) {
+        ppu->bg_pages[i] = get_vram(ppu->master, ppu->bgReg, i << BG_PAGEBITS);
+    }
+    memset(ppu->bg_rows, 0, sizeof ppu->bg_rows);
+    if (ppu_threaded || ppu_deferred) line_ppu_sync(line_worker(ppu));
+}
+
+static u8 blank_row[8];
+
+static inline u8* bg_vram(PPU* ppu, u32 addr) {
+    u8* page = ppu->bg_pages[(addr >> BG_PAGEBITS) % BG_PAGES];
+    return page ? page + (addr & ((1 << BG_PAGEBITS) - 1)) : NULL;
+}
+
+static u8* bg_row_4bpp(PPU* ppu, u32 addr) {
+    u8* p = bg_vram(ppu, addr);
+    if (!p) return blank_row;
+    BgRowEntry* e = &ppu->bg_rows[(addr >> 2) % BG_ROW_CACHE];
+    u32 gen = *vram_gen(ppu->master, p);
+    if (e->key == (addr | 1) && e->gen == gen) return e->px;
+    u32 row = *(u32*) p;
+    for (int i = 0; i < 8; i++, row >>= 4) {
+        e->px[i] = row & 0xf;
+    }
+    e->key = addr | 1;
+    e->gen = gen;
+    return e->px;
+}
+
 void render_bg_line_text(PPU* ppu, int bg) {
     if (!(ppu->io->dispcnt.bg_enable & (1 << bg))) return;
     ppu->draw_bg[bg] = true;
@@ -51,105 +150,39 @@ void render_bg_line_text(PPU* ppu, int bg) {
     u16 fx = sx & 0b111;
     u8 scs[2] = {SCLAYOUT[ppu->io->bgcnt[bg].size][scy & 1][0],
                  SCLAYOUT[ppu->io->bgcnt[bg].size][scy & 1][1]};
-    u32 map_addr = map_start + 0x800 * scs[scx & 1] + 32 * 2 * ty + 2 * tx;
-    BgTile tile = {vram_read16(ppu->master, ppu->bgReg, map_addr)};
-    if (ppu->io->bgcnt[bg].palmode) {
-        u32 tile_addr = tile_start + 64 * tile.num;
+    bool bpp8 = ppu->io->bgcnt[bg].palmode;
+    int x = 0;
+    while (x < NDS_SCREEN_W) {
+        u32 map_addr = map_start + 0x800 * scs[scx & 1] + 32 * 2 * ty + 2 * tx;
+        u16* map = (u16*) bg_vram(ppu, map_addr);
+        BgTile tile = {map ? *map : 0};
         u16 tmpfy = fy;
         if (tile.vflip) tmpfy = 7 - fy;
-        u64 row = vram_read32(ppu->master, ppu->bgReg, tile_addr + 8 * tmpfy);
-        row |= (u64) vram_read32(ppu->master, ppu->bgReg,
-                                 tile_addr + 8 * tmpfy + 4)
-               << 32;
-        if (tile.hflip) {
-            row = (row & 0xffffffff00000000) >> 32 | (row & 0x00000000ffffffff)
-                                                         << 32;
-            row = (row & 0xffff0000ffff0000) >> 16 | (row & 0x0000ffff0000ffff)
-                                                         << 16;
-            row = (row & 0xff00ff00ff00ff00) >> 8 | (row & 0x00ff00ff00ff00ff)
-                                                        << 8;
+        u8* px;
+        u16* pal;
+        u16 palbase;
+        if (bpp8) {
+            px = bg_vram(ppu, tile_start + 64 * tile.num + 8 * tmpfy);
+            if (!px) px = blank_row;
+            pal = bpp8Pal;
+            palbase = extPal ? tile.palette << 8 : 0;
+        } else {
+            px = bg_row_4bpp(ppu, tile_start + 32 * tile.num + 4 * tmpfy);
+            pal = ppu->pal;
+            palbase = tile.palette << 4;
         }
-        row >>= 8 * fx;
-        for (int x = 0; x < NDS_SCREEN_W; x++) {
-            u16 col_ind = row & 0xff;
+        int flip = tile.hflip ? 7 : 0;
+        for (; fx < 8 && x < NDS_SCREEN_W; fx++, x++) {
+            u8 col_ind = px[fx ^ flip];
             if (col_ind) {
-                if (extPal) col_ind |= tile.palette << 8;
-                ppu->layerlines[bg][x] = bpp8Pal[col_ind] | (1 << 15);
-            }
-
-            row >>= 8;
-            fx++;
-            if (fx == 8) {
-                fx = 0;
-                tx++;
-                if (tx == 32) {
-                    tx = 0;
-                    scx++;
-                    map_addr = map_start + 0x800 * scs[scx & 1] + 32 * 2 * ty;
-                } else {
-                    map_addr += 2;
-                }
-                tile.h = vram_read16(ppu->master, ppu->bgReg, map_addr);
-                tile_addr = tile_start + 64 * tile.num;
-                tmpfy = fy;
-                if (tile.vflip) tmpfy = 7 - fy;
-                row =
-                    vram_read32(ppu->master, ppu->bgReg, tile_addr + 8 * tmpfy);
-                row |= (u64) vram_read32(ppu->master, ppu->bgReg,
-                                         tile_addr + 8 * tmpfy + 4)
-                       << 32;
-                if (tile.hflip) {
-                    row = (row & 0xffffffff00000000) >> 32 |
-                          (row & 0x00000000ffffffff) << 32;
-                    row = (row & 0xffff0000ffff0000) >> 16 |
-                          (row & 0x0000ffff0000ffff) << 16;
-                    row = (row & 0xff00ff00ff00ff00) >> 8 |
-                          (row & 0x00ff00ff00ff00ff) << 8;
-                }
+                ppu->layerlines[bg][x] = pal[col_ind | palbase] | (1 << 15);
             }
         }
-    } else {
-        u32 tile_addr = tile_start + 32 * tile.num;
-        u16 tmpfy = fy;
-        if (tile.vflip) tmpfy = 7 - fy;
-        u32 row = vram_read32(ppu->master, ppu->bgReg, tile_addr + 4 * tmpfy);
-        if (tile.hflip) {
-            row = (row & 0xffff0000) >> 16 | (row & 0x0000ffff) << 16;
-            row = (row & 0xff00ff00) >> 8 | (row & 0x00ff00ff) << 8;
-            row = (row & 0xf0f0f0f0) >> 4 | (row & 0x0f0f0f0f) << 4;
-        }
-        row >>= 4 * fx;
-        for (int x = 0; x < NDS_SCREEN_W; x++) {
-            u8 col_ind = row & 0xf;
-            if (col_ind) {
-                col_ind |= tile.palette << 4;
-                ppu->layerlines[bg][x] = ppu->pal[col_ind] | (1 << 15);
-            }
-
-            row >>= 4;
-            fx++;
-            if (fx == 8) {
-                fx = 0;
-                tx++;
-                if (tx == 32) {
-                    tx = 0;
-                    scx++;
-                    map_addr = map_start + 0x800 * scs[scx & 1] + 32 * 2 * ty;
-                } else {
-                    map_addr += 2;
-                }
-                tile.h = vram_read16(ppu->master, ppu->bgReg, map_addr);
-                tile_addr = tile_start + 32 * tile.num;
-                tmpfy = fy;
-                if (tile.vflip) tmpfy = 7 - fy;
-                row =
-                    vram_read32(ppu->master, ppu->bgReg, tile_addr + 4 * tmpfy);
-                if (tile.hflip) {
-                    row = (row & 0xffff0000) >> 16 | (row & 0x0000ffff) << 16;
-                    row = (row & 0xff00ff00) >> 8 | (row & 0x00ff00ff) << 8;
-                    row = (row & 0xf0f0f0f0) >> 4 | (row & 0x0f0f0f0f) << 4;
-                }
-            }
+        fx = 0;
+        tx++;
+        if (tx == 32) {
+            tx = 0;
+            scx++;
         }
     }
 }
@@ -285,6 +318,7 @@ void render_bgs(PPU* ppu) {
             if (ppu->io->dispcnt.bg_enable & 1) {
                 ppu->draw_bg[0] = true;
                 ppu->bg0_3d = true;
+                gpu_show_frame(&ppu->master->gpu);
 
                 for (int x = 0; x < NDS_SCREEN_W; x++) {
                     int sx = (ppu->io->bgtext[0].hofs + x) % 512;
@@ -329,37 +363,42 @@ void render_bgs(PPU* ppu) {
     }
 }
 
-void render_obj_line(PPU* ppu, int i) {
-    ObjAttr o = ppu->oam[i];
-
-    bool extPal = ppu->io->dispcnt.obj_extpal;
-    u16* bpp8Pal = ppu->pal + 0x100;
-    if (extPal) {
-        bpp8Pal = ppu->extPalObj;
-    }
-
-    u8 w, h;
+static bool obj_size(ObjAttr o, u8* w, u8* h) {
     switch (o.shape) {
         case OBJ_SHAPE_SQR:
-            w = h = OBJLAYOUT[o.size][0];
+            *w = *h = OBJLAYOUT[o.size][0];
             break;
         case OBJ_SHAPE_HORZ:
-            w = OBJLAYOUT[o.size][2];
-            h = OBJLAYOUT[o.size][1];
+            *w = OBJLAYOUT[o.size][2];
+            *h = OBJLAYOUT[o.size][1];
             break;
         case OBJ_SHAPE_VERT:
-            w = OBJLAYOUT[o.size][1];
-            h = OBJLAYOUT[o.size][2];
+            *w = OBJLAYOUT[o.size][1];
+            *h = OBJLAYOUT[o.size][2];
             break;
         default:
-            return;
+            return false;
     }
     if (o.disable_double) {
         if (o.aff) {
-            w *= 2;
-            h *= 2;
-        } else return;
+            *w *= 2;
+            *h *= 2;
+        } else return false;
     }
+    return true;
+}
+
+void render_obj_line(PPU* ppu, int i) {
+    ObjAttr o = ppu->oam[i];
+
+    bool extPal = ppu->io->dispcnt.obj_extpal;
+    u16* bpp8Pal = ppu->pal + 0x100;
+    if (extPal) {
+        bpp8Pal = ppu->extPalObj;
+    }
+
+    u8 w, h;
+    if (!obj_size(o, &w, &h)) return;
 
     u8 yofs = ppu->ly - (u8) o.y;
     if (yofs >= h) return;
@@ -611,11 +650,39 @@ void render_obj_line(PPU* ppu, int i) {
     }
 }
 
+static u32 oam_gen(PPU* ppu) {
+    u32* gen = &ppu->master->oamgen[((u8*) ppu->oam - ppu->master->oam) >>
+                                    BLOCKPAGEBITS];
+    u32 sum = 0;
+    for (int i = 0; i < OAMSIZE >> BLOCKPAGEBITS; i++) {
+        sum += gen[i];
+    }
+    return sum;
+}
+
+static void bin_objs(PPU* ppu) {
+    memset(ppu->obj_line_n, 0, sizeof ppu->obj_line_n);
+    for (int i = 0; i < 128; i++) {
+        u8 w, h;
+        if (!obj_size(ppu->oam[i], &w, &h)) continue;
+        for (int yofs = 0; yofs < h; yofs++) {
+            u8 y = ppu->oam[i].y + yofs;
+            if (y < NDS_SCREEN_H) ppu->obj_lines[y][ppu->obj_line_n[y]++] = i;
+        }
+    }
+}
+
 void render_objs(PPU* ppu) {
     if (!ppu->io->dispcnt.obj_enable) return;
 
-    for (int i = 0; i < 128; i++) {
-        render_obj_line(ppu, i);
+    u32 gen = oam_gen(ppu);
+    if (!ppu->obj_binned || gen != ppu->obj_gen) {
+        bin_objs(ppu);
+        ppu->obj_gen = gen;
+        ppu->obj_binned = true;
+    }
+    for (int i = 0; i < ppu->obj_line_n[ppu->ly]; i++) {
+        render_obj_line(ppu, ppu->obj_lines[ppu->ly][i]);
     }
 }
 
@@ -661,7 +728,134 @@ void hmosaic_obj(PPU* ppu) {
     }
 }
 
-void compose_lines(PPU* ppu) {
+#ifdef __x86_64__
+enum { BLD_T1 = 1, BLD_T2 = 2, BLD_OBJ = 4, BLD_3D = 8 };
+
+struct compose_top {
+    __m128i k1, c1, f1, a1;
+    __m128i k2, c2, f2;
+};
+
+static inline __m128i select16(__m128i m, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+static inline __m128i nonzero16(__m128i v) {
+    return _mm_xor_si128(_mm_cmpeq_epi16(v, _mm_setzero_si128()),
+                         _mm_set1_epi16(-1));
+}
+
+static inline __m128i load_colors(u32* p) {
+    __m128i a = _mm_loadu_si128((__m128i*) p);
+    __m128i b = _mm_loadu_si128((__m128i*) (p + 4));
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    return _mm_packs_epi32(a, b);
+}
+
+static inline __m128i load_alphas(u32* p) {
+    __m128i m = _mm_set1_epi32(0xf);
+    __m128i a = _mm_and_si128(
+        _mm_srli_epi32(_mm_loadu_si128((__m128i*) p), 16), m);
+    __m128i b = _mm_and_si128(
+        _mm_srli_epi32(_mm_loadu_si128((__m128i*) (p + 4)), 16), m);
+    return _mm_packs_epi32(a, b);
+}
+
+static inline __m128i load_bytes(u8* p) {
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) p),
+                             _mm_setzero_si128());
+}
+
+static inline void compose_insert(struct compose_top* t, __m128i vis,
+                                  __m128i k, __m128i c, __m128i f, __m128i a) {
+    k = select16(vis, k, _mm_set1_epi16(0xff));
+    __m128i lt1 = _mm_cmplt_epi16(k, t->k1);
+    __m128i lt2 = _mm_cmplt_epi16(k, t->k2);
+    t->k2 = select16(lt1, t->k1, select16(lt2, k, t->k2));
+    t->c2 = select16(lt1, t->c1, select16(lt2, c, t->c2));
+    t->f2 = select16(lt1, t->f1, select16(lt2, f, t->f2));
+    t->k1 = select16(lt1, k, t->k1);
+    t->c1 = select16(lt1, c, t->c1);
+    t->f1 = select16(lt1, f, t->f1);
+    t->a1 = select16(lt1, a, t->a1);
+}
+
+static inline __m128i blend_alpha(__m128i c1, __m128i c2, __m128i ea,
+                                  __m128i eb) {
+    __m128i m = _mm_set1_epi16(0x1f);
+    __m128i res = _mm_setzero_si128();
+    for (int s = 0; s < 15; s += 5) {
+        __m128i x1 = _mm_and_si128(_mm_srli_epi16(c1, s), m);
+        __m128i x2 = _mm_and_si128(_mm_srli_epi16(c2, s), m);
+        __m128i x = _mm_srli_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(ea, x1), _mm_mullo_epi16(eb, x2)),
+            4);
+        res = _mm_or_si128(res, _mm_slli_epi16(_mm_min_epi16(x, m), s));
+    }
+    return res;
+}
+
+static inline __m128i blend_brightness(__m128i c, __m128i ev, bool up) {
+    __m128i m = _mm_set1_epi16(0x1f);
+    __m128i res = _mm_setzero_si128();
+    for (int s = 0; s < 15; s += 5) {
+        __m128i x = _mm_and_si128(_mm_srli_epi16(c, s), m);
+        if (up) {
+            x = _mm_add_epi16(
+                x, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(m, x), ev), 4));
+        } else {
+            x = _mm_sub_epi16(x, _mm_srli_epi16(_mm_mullo_epi16(x, ev), 4));
+        }
+        res = _mm_or_si128(res, _mm_slli_epi16(x, s));
+    }
+    return res;
+}
+
+static inline __m128i apply_masterbright(PPU* ppu, __m128i c) {
+    u16 factor = ppu->io->masterbright.factor;
+    if (factor > 16) factor = 16;
+    switch (ppu->io->masterbright.mode) {
+        case 1:
+            return blend_brightness(c, _mm_set1_epi16(factor), true);
+        case 2:
+            return blend_brightness(c, _mm_set1_epi16(factor), false);
+        default:
+            return c;
+    }
+}
+#endif
+
+static void masterbright_line(PPU* ppu, u16* line) {
+    if (ppu->io->masterbright.mode != 1 && ppu->io->masterbright.mode != 2)
+        return;
+#ifdef __x86_64__
+    for (int x = 0; x < NDS_SCREEN_W; x += 8) {
+        __m128i c = _mm_loadu_si128((__m128i*) &line[x]);
+        _mm_storeu_si128((__m128i*) &line[x], apply_masterbright(ppu, c));
+    }
+#else
+    u16 factor = ppu->io->masterbright.factor;
+    if (factor > 16) factor = 16;
+    for (int x = 0; x < NDS_SCREEN_W; x++) {
+        u16 r = line[x] & 0x1f;
+        u16 g = (line[x] >> 5) & 0x1f;
+        u16 b = (line[x] >> 10) & 0x1f;
+        if (ppu->io->masterbright.mode == 1) {
+            r += (31 - r) * factor / 16;
+            g += (31 - g) * factor / 16;
+            b += (31 - b) * factor / 16;
+        } else {
+            r -= r * factor / 16;
+            g -= g * factor / 16;
+            b -= b * factor / 16;
+        }
+        line[x] = r | g << 5 | b << 10;
+    }
+#endif
+}
+
+void compose_lines(PPU* ppu, u16* out) {
     u8 sorted_bgs[4];
     u8 bg_prios[4];
     u8 bgs = 0;
@@ -690,6 +884,114 @@ void compose_lines(PPU* ppu) {
     if (evb > 16) evb = 16;
     if (evy > 16) evy = 16;
 
+#ifdef __x86_64__
+    bool win_ena = ppu->io->dispcnt.win_enable || ppu->io->dispcnt.winobj_enable;
+    u8 winmask[NDS_SCREEN_W];
+    if (win_ena) {
+        u8 lut[4];
+        for (int w = 0; w < 4; w++) {
+            lut[w] = ppu->io->wincnt[w].bg_enable |
+                     ppu->io->wincnt[w].obj_enable << 4 |
+                     ppu->io->wincnt[w].effects_enable << 5;
+        }
+        for (int x = 0; x < NDS_SCREEN_W; x++) {
+            winmask[x] = lut[ppu->window[x]];
+        }
+    } else {
+        memset(winmask, 0x3f, sizeof winmask);
+    }
+
+    u16 flags[LMAX];
+    for (int l = 0; l < LMAX; l++) {
+        flags[l] = ((ppu->io->bldcnt.target1 >> l) & 1) * BLD_T1 |
+                   ((ppu->io->bldcnt.target2 >> l) & 1) * BLD_T2;
+    }
+    flags[LOBJ] |= BLD_OBJ;
+    if (ppu->bg0_3d) flags[LBG0] |= BLD_3D;
+
+    typeof(ppu->objdotattrs[0]) semi_attr = {.semitrans = 1};
+    __m128i semi_bit = _mm_set1_epi16(*(u8*) &semi_attr);
+    bool blend = effect || ppu->obj_semitrans || ppu->bg0_3d;
+    __m128i zero = _mm_setzero_si128();
+
+    for (int x = 0; x < NDS_SCREEN_W; x += 8) {
+        __m128i wm = load_bytes(&winmask[x]);
+        struct compose_top t = {
+            .k1 = _mm_set1_epi16(0xfe),
+            .c1 = load_colors(&ppu->layerlines[LBD][x]),
+            .f1 = _mm_set1_epi16(flags[LBD]),
+            .a1 = zero,
+            .k2 = _mm_set1_epi16(0xff),
+            .c2 = zero,
+            .f2 = zero,
+        };
+        for (int i = 0; i < bgs; i++) {
+            int bg = sorted_bgs[i];
+            __m128i c = load_colors(ppu->layerlines[bg] + x);
+            __m128i bit = _mm_set1_epi16(1 << bg);
+            __m128i vis = _mm_and_si128(
+                _mm_srai_epi16(c, 15),
+                _mm_cmpeq_epi16(_mm_and_si128(wm, bit), bit));
+            __m128i a = zero;
+            if (bg == 0 && ppu->bg0_3d) a = load_alphas(ppu->layerlines[0] + x);
+            compose_insert(&t, vis, _mm_set1_epi16(bg_prios[i] * 8 + 1 + bg), c,
+                           _mm_set1_epi16(flags[bg]), a);
+        }
+        __m128i attrs = zero;
+        if (ppu->draw_obj) {
+            __m128i c = load_colors(ppu->layerlines[LOBJ] + x);
+            __m128i bit = _mm_set1_epi16(1 << LOBJ);
+            __m128i vis = _mm_and_si128(
+                _mm_srai_epi16(c, 15),
+                _mm_cmpeq_epi16(_mm_and_si128(wm, bit), bit));
+            attrs = load_bytes((u8*) &ppu->objdotattrs[x]);
+            __m128i k = _mm_slli_epi16(_mm_and_si128(attrs, _mm_set1_epi16(3)),
+                                       3);
+            compose_insert(&t, vis, k, c, _mm_set1_epi16(flags[LOBJ]), zero);
+        }
+
+        __m128i res = t.c1;
+        if (blend) {
+            __m128i is3d = nonzero16(_mm_and_si128(t.f1, _mm_set1_epi16(BLD_3D)));
+            __m128i t2 = nonzero16(_mm_and_si128(t.f2, _mm_set1_epi16(BLD_T2)));
+            __m128i ea = select16(is3d, t.a1, _mm_set1_epi16(eva));
+            __m128i eb = select16(
+                is3d, _mm_sub_epi16(_mm_set1_epi16(16), t.a1), _mm_set1_epi16(evb));
+            __m128i alpha = blend_alpha(t.c1, t.c2, ea, eb);
+            __m128i plain = _mm_and_si128(t.c1, _mm_set1_epi16(0x7fff));
+            __m128i eff_res;
+            switch (effect) {
+                case EFF_ALPHA:
+                    eff_res = select16(t2, alpha, plain);
+                    break;
+                case EFF_BINC:
+                    eff_res = blend_brightness(t.c1, _mm_set1_epi16(evy), true);
+                    break;
+                case EFF_BDEC:
+                    eff_res =
+                        blend_brightness(t.c1, _mm_set1_epi16(evy), false);
+                    break;
+                default:
+                    eff_res = plain;
+                    break;
+            }
+            __m128i semi = _mm_and_si128(
+                _mm_and_si128(
+                    nonzero16(_mm_and_si128(t.f1, _mm_set1_epi16(BLD_OBJ))),
+                    nonzero16(_mm_and_si128(attrs, semi_bit))),
+                t2);
+            __m128i eff = _mm_and_si128(
+                nonzero16(_mm_and_si128(t.f1, _mm_set1_epi16(BLD_T1))),
+                _mm_or_si128(
+                    nonzero16(_mm_and_si128(wm, _mm_set1_epi16(0x20))), is3d));
+            res = select16(semi, alpha, select16(eff, eff_res, res));
+        }
+        _mm_storeu_si128((__m128i*) &ppu->cur_line[x], res);
+        if (out) {
+            _mm_storeu_si128((__m128i*) &out[x], apply_masterbright(ppu, res));
+        }
+    }
+#else
     if (effect || ppu->obj_semitrans || ppu->bg0_3d) {
         for (int x = 0; x < NDS_SCREEN_W; x++) {
             u8 layers[6];
@@ -814,9 +1116,14 @@ void compose_lines(PPU* ppu) {
             ppu->cur_line[x] = ppu->layerlines[layers[0]][x];
         }
     }
+    if (out) {
+        memcpy(out, ppu->cur_line, sizeof ppu->cur_line);
+        masterbright_line(ppu, out);
+    }
+#endif
 }
 
-void draw_scanline_normal(PPU* ppu) {
+void draw_scanline_normal(PPU* ppu, u16* out) {
     memset(ppu->layerlines, 0, sizeof ppu->layerlines);
     for (int x = 0; x < NDS_SCREEN_W; x++) {
         ppu->layerlines[LBD][x] = ppu->pal[0];
@@ -843,7 +1150,7 @@ void draw_scanline_normal(PPU* ppu) {
     if (ppu->io->bgcnt[3].mosaic) hmosaic_bg(ppu, 3);
     if (ppu->obj_mos) hmosaic_obj(ppu);
 
-    compose_lines(ppu);
+    compose_lines(ppu, out);
 }
 
 void draw_scanline(PPU* ppu) {
@@ -852,15 +1159,17 @@ void draw_scanline(PPU* ppu) {
         return;
     }
 
-    draw_scanline_normal(ppu);
+    if (ppu->io->dispcnt.disp_mode == 1) {
+        draw_scanline_normal(ppu, ppu->screen[ppu->ly]);
+        return;
+    }
+
+    draw_scanline_normal(ppu, NULL);
 
     switch (ppu->io->dispcnt.disp_mode) {
         case 0:
             memset(ppu->screen[ppu->ly], 0, sizeof ppu->screen[0]);
             break;
-        case 1:
-            memcpy(ppu->screen[ppu->ly], ppu->cur_line, sizeof ppu->cur_line);
-            break;
         case 2:
             memcpy(ppu->screen[ppu->ly],
                    &ppu->master->vrambanks[ppu->io->dispcnt.vram_block]
@@ -870,56 +1179,286 @@ void draw_scanline(PPU* ppu) {
         case 3:
             break;
     }
-    switch (ppu->io->masterbright.mode) {
-        case 1: {
-            u16 factor = ppu->io->masterbright.factor;
-            if (factor > 16) factor = 16;
-            for (int x = 0; x < NDS_SCREEN_W; x++) {
-                u16 r = ppu->screen[ppu->ly][x] & 0x1f;
-                u16 g = (ppu->screen[ppu->ly][x] >> 5) & 0x1f;
-                u16 b = (ppu->screen[ppu->ly][x] >> 10) & 0x1f;
-                r += (31 - r) * factor / 16;
-                g += (31 - g) * factor / 16;
-                b += (31 - b) * factor / 16;
-                ppu->screen[ppu->ly][x] = r | g << 5 | b << 10;
+    masterbright_line(ppu, ppu->screen[ppu->ly]);
+}
+
+void ppu_check_window(PPU* ppu) {
+    for (int i = 0; i < 2; i++) {
+        if ((u8) ppu->ly == ppu->io->winv[i].y1) ppu->in_win[i] = true;
+        if ((u8) ppu->ly == ppu->io->winv[i].y2) ppu->in_win[i] = false;
+    }
+}
+
+void ppu_hblank(PPU* ppu) {
+    ppu->bgaffintr[0].x += ppu->io->bgaff[0].pb;
+    ppu->bgaffintr[0].y += ppu->io->bgaff[0].pd;
+    ppu->bgaffintr[1].x += ppu->io->bgaff[1].pb;
+    ppu->bgaffintr[1].y += ppu->io->bgaff[1].pd;
+
+    if (++ppu->bgmos_ct == ppu->io->mosaic.bg_v) {
+        ppu->bgmos_ct = -1;
+        ppu->bgmos_y = ppu->ly + 1;
+        ppu->bgaffintr[0].mosx = ppu->bgaffintr[0].x;
+        ppu->bgaffintr[0].mosy = ppu->bgaffintr[0].y;
+        ppu->bgaffintr[1].mosx = ppu->bgaffintr[1].x;
+        ppu->bgaffintr[1].mosy = ppu->bgaffintr[1].y;
+    }
+    if (++ppu->objmos_ct == ppu->io->mosaic.obj_v) {
+        ppu->objmos_ct = -1;
+        ppu->objmos_y = ppu->ly + 1;
+    }
+}
+
+static void line_kick(LineWorker* w) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&w->mutex);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+    }
+}
+
+static void* line_thread_run(void* data) {
+    LineWorker* w = data;
+    while (true) {
+        for (int i = 0; w->lines.head == RING_tail(w->lines) &&
+                        !__atomic_load_n(&line_quit, __ATOMIC_ACQUIRE);
+             i++) {
+            if (i < LINE_SPIN) continue;
+            pthread_mutex_lock(&w->mutex);
+            __atomic_store_n(&w->sleeping, true, __ATOMIC_SEQ_CST);
+            while (w->lines.head ==
+                       __atomic_load_n(&w->lines.tail, __ATOMIC_SEQ_CST) &&
+                   !line_quit) {
+                pthread_cond_wait(&w->cond, &w->mutex);
             }
+            w->sleeping = false;
+            pthread_mutex_unlock(&w->mutex);
             break;
         }
-        case 2: {
-            u16 factor = ppu->io->masterbright.factor;
-            if (factor > 16) factor = 16;
-            for (int x = 0; x < NDS_SCREEN_W; x++) {
-                u16 r = ppu->screen[ppu->ly][x] & 0x1f;
-                u16 g = (ppu->screen[ppu->ly][x] >> 5) & 0x1f;
-                u16 b = (ppu->screen[ppu->ly][x] >> 10) & 0x1f;
-                r -= r * factor / 16;
-                g -= g * factor / 16;
-                b -= b * factor / 16;
-                ppu->screen[ppu->ly][x] = r | g << 5 | b << 10;
-            }
+        if (__atomic_load_n(&line_quit, __ATOMIC_ACQUIRE)) return NULL;
+
+        PPULine* l = &RING_at(w->lines, w->lines.head);
+        w->io = l->io;
+        w->ppu.screen = l->screen;
+        w->ppu.ly = l->ly;
+        memcpy(w->ppu.bgaffintr, l->bgaffintr, sizeof l->bgaffintr);
+        w->ppu.bgmos_y = l->bgmos_y;
+        w->ppu.objmos_y = l->objmos_y;
+        w->ppu.in_win[0] = l->in_win[0];
+        w->ppu.in_win[1] = l->in_win[1];
+        draw_scanline(&w->ppu);
+        __atomic_store_n(&w->lines.head, w->lines.head + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void queue_line(PPU* ppu) {
+    LineWorker* w = line_worker(ppu);
+    if (ppu->io->dispcnt.bg_mode != 6 && ppu->io->dispcnt.enable_3d &&
+        (ppu->io->dispcnt.bg_enable & 1)) {
+        gpu_show_frame(&ppu->master->gpu);
+    }
+    if (ppu->io->dispcnt.disp_mode == 2) {
+        line_vram_banks |= 1 << ppu->io->dispcnt.vram_block;
+    }
+
+    PPULine l = {.io = *ppu->io,
+                 .screen = ppu->screen,
+                 .ly = ppu->ly,
+                 .bgmos_y = ppu->bgmos_y,
+                 .objmos_y = ppu->objmos_y,
+                 .in_win = {ppu->in_win[0], ppu->in_win[1]}};
+    memcpy(l.bgaffintr, ppu->bgaffintr, sizeof l.bgaffintr);
+    RING_push(w->lines, l);
+    ppu_pending = true;
+    if (w->lines.tail - RING_head(w->lines) >= LINE_BATCH) line_kick(w);
+}
+
+static void defer_lines(NDS* nds) {
+    if (!ppu_pending) {
+        for (int e = 0; e < 2; e++) {
+            LineWorker* w = &line_workers[e];
+            PPU* p = &w->ppu;
+            w->io = *w->src->io;
+            p->screen = w->src->screen;
+            p->ly = w->src->ly;
+            memcpy(p->bgaffintr, w->src->bgaffintr, sizeof p->bgaffintr);
+            p->bgmos_y = w->src->bgmos_y;
+            p->bgmos_ct = w->src->bgmos_ct;
+            p->objmos_y = w->src->objmos_y;
+            p->objmos_ct = w->src->objmos_ct;
+            p->in_win[0] = w->src->in_win[0];
+            p->in_win[1] = w->src->in_win[1];
+        }
+        defer_start = nds->ppuA.ly;
+        line_log_n = 0;
+        ppu_pending = true;
+    }
+    if (nds->ppuA.io->dispcnt.disp_mode == 2) {
+        line_vram_banks |= 1 << nds->ppuA.io->dispcnt.vram_block;
+    }
+    defer_end = nds->ppuA.ly + 1;
+}
+
+static void replay_write(LineWorker* w, u16 addr, u16 data) {
+    u16 ofs = addr & ~PPUB_OFF;
+    ((u16*) &w->io)[ofs >> 1] = data;
+    switch (ofs & ~2) {
+        case BG2X:
+            w->ppu.bgaffintr[0].x = w->io.bgaff[0].x;
+            break;
+        case BG2Y:
+            w->ppu.bgaffintr[0].y = w->io.bgaff[0].y;
+            break;
+        case BG3X:
+            w->ppu.bgaffintr[1].x = w->io.bgaff[1].x;
+            break;
+        case BG3Y:
+            w->ppu.bgaffintr[1].y = w->io.bgaff[1].y;
             break;
+    }
+}
+
+static void replay_lines(LineWorker* w, u16 engine) {
+    PPU* p = &w->ppu;
+    if (!line_log_n) {
+        for (int l = defer_start; l < defer_end; l++) {
+            if (l != defer_start) {
+                p->ly = l;
+                ppu_check_window(p);
+            }
+            draw_scanline(p);
+            ppu_hblank(p);
+        }
+        return;
+    }
+
+    u32 k = 0;
+    for (int l = defer_start; l < defer_end; l++) {
+        if (l != defer_start) {
+            p->ly = l;
+            ppu_check_window(p);
+        }
+        draw_scanline(p);
+        for (; k < line_log_n && line_log[k].ly == l && !line_log[k].hblank;
+             k++) {
+            if ((line_log[k].addr & PPUB_OFF) == engine)
+                replay_write(w, line_log[k].addr, line_log[k].data);
+        }
+        ppu_hblank(p);
+        for (; k < line_log_n && line_log[k].ly == l; k++) {
+            if ((line_log[k].addr & PPUB_OFF) == engine)
+                replay_write(w, line_log[k].addr, line_log[k].data);
         }
     }
 }
 
-void ppu_check_window(PPU* ppu) {
-    for (int i = 0; i < 2; i++) {
-        if ((u8) ppu->ly == ppu->io->winv[i].y1) ppu->in_win[i] = true;
-        if ((u8) ppu->ly == ppu->io->winv[i].y2) ppu->in_win[i] = false;
+void ppu_log_write(NDS* nds, u32 addr, u16 data) {
+    u32 ofs = addr & ~PPUB_OFF;
+    if (addr >= PPUB_OFF + sizeof(PPUIO) || ofs >= sizeof(PPUIO) ||
+        (DISPSTAT <= ofs && ofs < BG0CNT) ||
+        (DISP3DCNT <= ofs && ofs < MASTERBRIGHT)) {
+        return;
+    }
+    if (line_log_n == LINE_LOG) {
+        ppu_wait_lines();
+        return;
+    }
+    line_log[line_log_n++] = (LineLogEntry){.ly = nds->io9.vcount,
+                                            .hblank = nds->io9.dispstat.hblank,
+                                            .addr = addr,
+                                            .data = data};
+}
+
+static PPU* line_ppu(PPU* ppu) {
+    return ppu_threaded || ppu_deferred ? &line_worker(ppu)->ppu : ppu;
+}
+
+void ppu_wait_lines() {
+    if (!ppu_pending) return;
+    ppu_pending = false;
+    if (ppu_deferred) {
+        replay_lines(&line_workers[0], 0);
+        replay_lines(&line_workers[1], PPUB_OFF);
+        line_log_n = 0;
+    } else {
+        for (int e = 0; e < 2; e++) {
+            LineWorker* w = &line_workers[e];
+            if (RING_head(w->lines) == w->lines.tail) continue;
+            line_kick(w);
+            for (int i = 0; RING_head(w->lines) != w->lines.tail; i++) {
+                if (i >= LINE_SPIN) sched_yield();
+            }
+        }
+    }
+    line_vram_banks = 0;
+}
+
+void ppu_wait_vram(u32 addr) {
+    if (((addr >> 21) & 7) < 4 || (line_vram_banks >> ((addr >> 17) & 7) & 1))
+        ppu_wait_lines();
+}
+
+void init_ppu_threads(NDS* nds) {
+    line_quit = false;
+    line_vram_banks = 0;
+    for (int e = 0; e < 2; e++) {
+        LineWorker* w = &line_workers[e];
+        w->src = e ? &nds->ppuB : &nds->ppuA;
+        w->lines.head = w->lines.tail = 0;
+        w->sleeping = false;
+        line_ppu_sync(w);
+        pthread_mutex_init(&w->mutex, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        pthread_create(&w->thread, NULL, line_thread_run, w);
     }
+    ppu_threaded = true;
+    arm9_map_pages(&nds->cpu9, 0x6000000, 0x7000000);
+}
+
+void init_ppu_deferred(NDS* nds) {
+    line_vram_banks = 0;
+    line_log_n = 0;
+    for (int e = 0; e < 2; e++) {
+        LineWorker* w = &line_workers[e];
+        w->src = e ? &nds->ppuB : &nds->ppuA;
+        line_ppu_sync(w);
+    }
+    ppu_deferred = true;
+    arm9_map_pages(&nds->cpu9, 0x6000000, 0x7000000);
+}
+
+void destroy_ppu_threads() {
+    if (!ppu_threaded) return;
+    ppu_wait_lines();
+    __atomic_store_n(&line_quit, true, __ATOMIC_RELEASE);
+    for (int e = 0; e < 2; e++) {
+        LineWorker* w = &line_workers[e];
+        pthread_mutex_lock(&w->mutex);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->mutex);
+        pthread_cond_destroy(&w->cond);
+    }
+    ppu_threaded = false;
 }
 
 void lcd_capture_line(NDS* nds) {
     int w = DISPCAPLAYOUT[nds->io9.dispcapcnt.size][0];
 
+    ppu_wait_lines();
+
     u16 gpu_line[NDS_SCREEN_W];
     if (nds->io9.dispcapcnt.srcA) {
+        gpu_show_frame(&nds->gpu);
         for (int i = 0; i < NDS_SCREEN_W; i++)
             gpu_line[i] = nds->gpu.screen[nds->io7.vcount][i];
     }
     u16 blended[NDS_SCREEN_W];
 
-    u16* srcA = nds->io9.dispcapcnt.srcA ? gpu_line : nds->ppuA.cur_line;
+    u16* srcA =
+        nds->io9.dispcapcnt.srcA ? gpu_line : line_ppu(&nds->ppuA)->cur_line;
     u16* srcB = (u16*) &nds->vrambanks[nds->io9.ppuA.dispcnt.vram_block]
                                       [2 * NDS_SCREEN_W * nds->io7.vcount];
     if (nds->io9.ppuA.dispcnt.disp_mode != 2)
@@ -963,8 +1502,10 @@ void lcd_capture_line(NDS* nds) {
         return;
 
     for (int i = 0; i < w; i++) {
-        *(u16*) &nds->vrambanks[nds->io9.dispcapcnt.vram_w_block]
-                               [(dest_addr + 2 * i) % VRAMABCDSIZE] = source[i];
+        u16* p = (u16*) &nds->vrambanks[nds->io9.dispcapcnt.vram_w_block]
+                                       [(dest_addr + 2 * i) % VRAMABCDSIZE];
+        *p = source[i];
+        (*vram_gen(nds, p))++;
     }
 }
 
@@ -1000,10 +1541,7 @@ void lcd_hdraw(NDS* nds) {
 
             if (nds->gpu.drawing) {
                 nds->gpu.drawing = false;
-                pthread_mutex_lock(&gpu_mutex);
-                void* tmp = nds->gpu.screen_back;
-                nds->gpu.screen_back = nds->gpu.screen;
-                nds->gpu.screen = tmp;
+                nds->gpu.frame_presented = nds->gpu.frame_submitted;
             }
             if (nds->gpu.pending_swapbuffers) {
                 nds->gpu.pending_swapbuffers = false;
@@ -1011,8 +1549,15 @@ void lcd_hdraw(NDS* nds) {
             }
         }
 
-        draw_scanline(&nds->ppuA);
-        draw_scanline(&nds->ppuB);
+        if (ppu_threaded) {
+            queue_line(&nds->ppuA);
+            queue_line(&nds->ppuB);
+        } else if (ppu_deferred) {
+            defer_lines(nds);
+        } else {
+            draw_scanline(&nds->ppuA);
+            draw_scanline(&nds->ppuB);
+        }
 
         if (nds->io9.dispcapcnt.enable &&
             nds->io7.vcount < DISPCAPLAYOUT[nds->io9.dispcapcnt.size][1]) {
@@ -1025,6 +1570,7 @@ void lcd_hdraw(NDS* nds) {
             }
         }
     } else if (nds->io7.vcount == NDS_SCREEN_H) {
+        ppu_wait_lines();
         nds->io9.dispcapcnt.enable = 0;
         lcd_vblank(nds);
         nds->frame_complete = true;
@@ -1083,26 +1629,6 @@ void lcd_vblank(NDS* nds) {
     nds->next_vblank = nds->sched.now + LINES_H * DOTS_W * 6;
 }
 
-void ppu_hblank(PPU* ppu) {
-    ppu->bgaffintr[0].x += ppu->io->bgaff[0].pb;
-    ppu->bgaffintr[0].y += ppu->io->bgaff[0].pd;
-    ppu->bgaffintr[1].x += ppu->io->bgaff[1].pb;
-    ppu->bgaffintr[1].y += ppu->io->bgaff[1].pd;
-
-    if (++ppu->bgmos_ct == ppu->io->mosaic.bg_v) {
-        ppu->bgmos_ct = -1;
-        ppu->bgmos_y = ppu->ly + 1;
-        ppu->bgaffintr[0].mosx = ppu->bgaffintr[0].x;
-        ppu->bgaffintr[0].mosy = ppu->bgaffintr[0].y;
-        ppu->bgaffintr[1].mosx = ppu->bgaffintr[1].x;
-        ppu->bgaffintr[1].mosy = ppu->bgaffintr[1].y;
-    }
-    if (++ppu->objmos_ct == ppu->io->mosaic.obj_v) {
-        ppu->objmos_ct = -1;
-        ppu->objmos_y = ppu->ly + 1;
-    }
-}
-
 void lcd_hblank(NDS* nds) {
     nds->io7.dispstat.hblank = 1;
     nds->io9.dispstat.hblank = 1;
@@ -9,6 +9,10 @@
 #define DOTS_W 355
 #define LINES_H 263
 
+#define BG_PAGEBITS 14
+#define BG_PAGES 64
+#define BG_ROW_CACHE 4096
+
 typedef union {
     u16 h;
     struct {
@@ -68,6 +72,19 @@ enum { EFF_NONE, EFF_ALPHA, EFF_BINC, EFF_BDEC };
 
 typedef enum { VRAMBGA, VRAMBGB, VRAMOBJA, VRAMOBJB } VRAMRegion;
 
+typedef struct {
+    u32 key;
+    u32 gen;
+    u8 px[8];
+} BgRowEntry;
+
+typedef struct {
+    u32 x;
+    u32 y;
+    u32 mosx;
+    u32 mosy;
+} BgAffIntr;
+
 typedef struct _NDS NDS;
 
 typedef struct {
@@ -80,6 +97,7 @@ typedef struct {
     ObjAttr* oam;
     VRAMRegion bgReg;
     VRAMRegion objReg;
+    u8* bg_pages[BG_PAGES];
 
     u16 (*screen)[NDS_SCREEN_W];
     u16 cur_line[NDS_SCREEN_W];
@@ -94,12 +112,7 @@ typedef struct {
     } objdotattrs[NDS_SCREEN_W];
     u8 window[NDS_SCREEN_W];
 
-    struct {
-        u32 x;
-        u32 y;
-        u32 mosx;
-        u32 mosy;
-    } bgaffintr[2];
+    BgAffIntr bgaffintr[2];
 
     u8 bgmos_y;
     u8 bgmos_ct;
@@ -113,10 +126,30 @@ typedef struct {
     bool obj_mos;
     bool bg0_3d;
 
+    BgRowEntry bg_rows[BG_ROW_CACHE];
+
+    u8 obj_lines[NDS_SCREEN_H][128];
+    u8 obj_line_n[NDS_SCREEN_H];
+    u32 obj_gen;
+    bool obj_binned;
+
 } PPU;
 
+extern bool ppu_threaded;
+extern bool ppu_deferred;
+extern bool ppu_pending;
+
+void ppu_map_bg_vram(PPU* ppu);
+
 void draw_scanline(PPU* ppu);
 
+void init_ppu_threads(NDS* nds);
+void destroy_ppu_threads();
+void init_ppu_deferred(NDS* nds);
+void ppu_log_write(NDS* nds, u32 addr, u16 data);
+void ppu_wait_lines();
+void ppu_wait_vram(u32 addr);
+
 void lcd_hdraw(NDS* nds);
 void lcd_vblank(NDS* nds);
 void lcd_hblank(NDS* nds);
@@ -6,10 +6,85 @@
 #include "ppu.h"
 #include "timer.h"
 
+typedef void (*EventHandler)(NDS* nds, EventType t);
+
+static void event_lcd_hdraw(NDS* nds, EventType t) {
+    lcd_hdraw(nds);
+}
+
+static void event_lcd_hblank(NDS* nds, EventType t) {
+    lcd_hblank(nds);
+}
+
+static void event_card_drq(NDS* nds, EventType t) {
+    if (nds->io7.exmemcnt.ndscardrights) {
+        nds->io7.romctrl.drq = 1;
+        for (int i = 0; i < 4; i++) {
+            if (nds->io7.dma[i].cnt.mode == DMA7_DSCARD) {
+                dma7_activate(&nds->dma7, i);
+            }
+        }
+    } else {
+        nds->io9.romctrl.drq = 1;
+        for (int i = 0; i < 4; i++) {
+            if (nds->io9.dma[i].cnt.mode == DMA9_DSCARD) {
+                dma9_activate(&nds->dma9, i);
+            }
+        }
+    }
+}
+
+static void event_tm7_reload(NDS* nds, EventType t) {
+    reload_timer(&nds->tmc7, t - EVENT_TM07_RELOAD);
+}
+
+static void event_tm9_reload(NDS* nds, EventType t) {
+    reload_timer(&nds->tmc9, t - EVENT_TM09_RELOAD);
+}
+
+static void event_spu_sample(NDS* nds, EventType t) {
+    spu_sample(&nds->spu);
+}
+
+static void event_spu_channel(NDS* nds, EventType t) {
+    spu_tick_channel(&nds->spu, t - EVENT_SPU_CH0);
+}
+
+static void event_spu_capture(NDS* nds, EventType t) {
+    spu_tick_capture(&nds->spu, t - EVENT_SPU_CAP0);
+}
+
+static const EventHandler event_handlers[EVENT_MAX] = {
+    [EVENT_LCD_HDRAW] = event_lcd_hdraw,
+    [EVENT_LCD_HBLANK] = event_lcd_hblank,
+    [EVENT_CARD_DRQ] = event_card_drq,
+    [EVENT_TM07_RELOAD... EVENT_TM37_RELOAD] = event_tm7_reload,
+    [EVENT_TM09_RELOAD... EVENT_TM39_RELOAD] = event_tm9_reload,
+    [EVENT_SPU_SAMPLE] = event_spu_sample,
+    [EVENT_SPU_CH0... EVENT_SPU_CAP0 - 1] = event_spu_channel,
+    [EVENT_SPU_CAP0... EVENT_SPU_CAP1] = event_spu_capture,
+};
+
+static void update_next(Scheduler* sched) {
+    sched->next = -1;
+    for (u32 m = sched->active; m; m &= m - 1) {
+        EventType t = __builtin_ctz(m);
+        if (sched->time[t] < sched->next) {
+            sched->next = sched->time[t];
+            sched->next_type = t;
+        }
+    }
+}
+
+void init_scheduler(Scheduler* sched, NDS* master) {
+    sched->master = master;
+    sched->active = 0;
+    sched->next = -1;
+}
+
 void run_to_present(Scheduler* sched) {
     u64 end_time = sched->now;
-    while (sched->event_queue.size &&
-           FIFO_peek(sched->event_queue).time <= end_time) {
+    while (sched->next <= end_time) {
         run_next_event(sched);
         if (sched->now > end_time) end_time = sched->now;
     }
@@ -17,84 +92,39 @@ void run_to_present(Scheduler* sched) {
 }
 
 int run_next_event(Scheduler* sched) {
-    if (sched->event_queue.size == 0) return 0;
-
-    Event e;
-    FIFO_pop(sched->event_queue, e);
-    sched->now = e.time;
-
-    if (e.type == EVENT_LCD_HDRAW) {
-        lcd_hdraw(sched->master);
-    } else if (e.type == EVENT_LCD_HBLANK) {
-        lcd_hblank(sched->master);
-    } else if (e.type == EVENT_CARD_DRQ) {
-        if (sched->master->io7.exmemcnt.ndscardrights) {
-            sched->master->io7.romctrl.drq = 1;
-            for (int i = 0; i < 4; i++) {
-                if (sched->master->io7.dma[i].cnt.mode == DMA7_DSCARD) {
-                    dma7_activate(&sched->master->dma7, i);
-                }
-            }
-        } else {
-            sched->master->io9.romctrl.drq = 1;
-            for (int i = 0; i < 4; i++) {
-                if (sched->master->io9.dma[i].cnt.mode == DMA9_DSCARD) {
-                    dma9_activate(&sched->master->dma9, i);
-                }
-            }
-        }
-    } else if (e.type < EVENT_TM09_RELOAD) {
-        reload_timer(&sched->master->tmc7, e.type - EVENT_TM07_RELOAD);
-    } else if (e.type < EVENT_SPU_SAMPLE) {
-        reload_timer(&sched->master->tmc9, e.type - EVENT_TM09_RELOAD);
-    } else if (e.type == EVENT_SPU_SAMPLE) {
-        spu_sample(&sched->master->spu);
-    } else if (e.type < EVENT_SPU_CAP0) {
-        spu_tick_channel(&sched->master->spu, e.type - EVENT_SPU_CH0);
-    } else if (e.type < EVENT_MAX) {
-        spu_tick_capture(&sched->master->spu, e.type - EVENT_SPU_CAP0);
-    }
+    if (!sched->active) return 0;
+
+    EventType t = sched->next_type;
+    u64 time = sched->next;
+    sched->active &= ~(1 << t);
+    update_next(sched);
+    sched->now = time;
+
+    event_handlers[t](sched->master, t);
 
-    return sched->now - e.time;
+    return sched->now - time;
 }
 
 void add_event(Scheduler* sched, EventType t, u64 time) {
-    if (sched->event_queue.size == EVENT_MAX) return;
-
-    FIFO_push(sched->event_queue, ((Event){.type = t, .time = time}));
-
-    u32 i = (sched->event_queue.tail - 1) % EVENT_MAX;
-    while (i != sched->event_queue.head &&
-           sched->event_queue.d[i].time <
-               sched->event_queue.d[(i - 1) % EVENT_MAX].time) {
-        Event tmp = sched->event_queue.d[(i - 1) % EVENT_MAX];
-        sched->event_queue.d[(i - 1) % EVENT_MAX] = sched->event_queue.d[i];
-        sched->event_queue.d[i] = tmp;
-        i = (i - 1) % EVENT_MAX;
+    bool was_next = (sched->active & (1 << t)) && sched->next_type == t;
+    sched->active |= 1 << t;
+    sched->time[t] = time;
+    if (time < sched->next) {
+        sched->next = time;
+        sched->next_type = t;
+    } else if (was_next) {
+        update_next(sched);
     }
 }
 
 void remove_event(Scheduler* sched, EventType t) {
-    FIFO_foreach(i, sched->event_queue) {
-        if (sched->event_queue.d[i].type == t) {
-            sched->event_queue.size--;
-            sched->event_queue.tail = (sched->event_queue.tail - 1) % EVENT_MAX;
-            for (u32 j = i; j != sched->event_queue.tail;
-                 j = (j + 1) % EVENT_MAX) {
-                sched->event_queue.d[j] =
-                    sched->event_queue.d[(j + 1) % EVENT_MAX];
-            }
-            return;
-        }
-    }
+    if (!(sched->active & (1 << t))) return;
+    sched->active &= ~(1 << t);
+    if (sched->next_type == t) update_next(sched);
 }
 
 u64 find_event(Scheduler* sched, EventType t) {
-    FIFO_foreach(i, sched->event_queue) {
-        if (sched->event_queue.d[i].type == t) {
-            return sched->event_queue.d[i].time;
-        }
-    }
+    if (sched->active & (1 << t)) return sched->time[t];
     return -1;
 }
 
@@ -105,13 +135,16 @@ void print_scheduled_events(Scheduler* sched) {
         "TM1-9 Reload", "TM2-9 Reload", "TM3-9 Reload", "SPU Sample"};
 
     printf("Now: %ld\n", sched->now);
-    FIFO_foreach(i, sched->event_queue) {
-        if (sched->event_queue.d[i].type < EVENT_SPU_CH0) {
-            printf("%ld => %s\n", sched->event_queue.d[i].time,
-                   event_names[sched->event_queue.d[i].type]);
+    for (u32 m = sched->active; m; m &= m - 1) {
+        EventType t = __builtin_ctz(m);
+        if (t < EVENT_SPU_CH0) {
+            printf("%ld => %s\n", sched->time[t], event_names[t]);
+        } else if (t < EVENT_SPU_CAP0) {
+            printf("%ld => SPU CH%x Reload\n", sched->time[t],
+                   t - EVENT_SPU_CH0);
         } else {
-            printf("%ld => SPU CH%x Reload\n", sched->event_queue.d[i].time,
-                   sched->event_queue.d[i].type - EVENT_SPU_CH0);
+            printf("%ld => SPU CAP%x Reload\n", sched->time[t],
+                   t - EVENT_SPU_CAP0);
         }
     }
 }
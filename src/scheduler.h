@@ -22,29 +22,28 @@ typedef enum {
     EVENT_MAX = 32
 } EventType;
 
-typedef struct {
-    u64 time;
-    EventType type;
-} Event;
-
 typedef struct _NDS NDS;
 
 typedef struct {
     NDS* master;
 
     u64 now;
+    u64 next;
+    EventType next_type;
 
-    FIFO(Event, EVENT_MAX) event_queue;
+    u32 active;
+    u64 time[EVENT_MAX];
 } Scheduler;
 
 void run_to_present(Scheduler* sched);
 int run_next_event(Scheduler* sched);
 
 static inline bool event_pending(Scheduler* sched) {
-    return sched->event_queue.size &&
-           sched->now >= FIFO_peek(sched->event_queue).time;
+    return sched->now >= sched->next;
 }
 
+void init_scheduler(Scheduler* sched, NDS* master);
+
 void add_event(Scheduler* sched, EventType t, u64 time);
 void remove_event(Scheduler* sched, EventType t);
 u64 find_event(Scheduler* sched, EventType t);
@@ -37,6 +37,23 @@ typedef int64_t s64;
          _i++, i = (i + 1) & (FIFO_MAX(f) - 1))
 #define FIFO_clear(f) ((f).d[0] = (f).head = (f).tail = (f).size = 0)
 
+#define RING(T, N)                                                             \
+    struct {                                                                   \
+        T d[N];                                                                \
+        u32 head;                                                              \
+        u32 tail;                                                              \
+    }
+
+#define RING_at(r, i) ((r).d[(i) & (FIFO_MAX(r) - 1)])
+#define RING_head(r) __atomic_load_n(&(r).head, __ATOMIC_ACQUIRE)
+#define RING_tail(r) __atomic_load_n(&(r).tail, __ATOMIC_ACQUIRE)
+#define RING_push(r, v)                                                        \
+    (RING_at(r, (r).tail) = v,                                                 \
+     __atomic_store_n(&(r).tail, (r).tail + 1, __ATOMIC_RELEASE))
+#define RING_pop(r, v)                                                         \
+    (v = RING_at(r, (r).head),                                                 \
+     __atomic_store_n(&(r).head, (r).head + 1, __ATOMIC_RELEASE))
+
 #define Vector(T)                                                              \
     struct {                                                                   \
         T* d;                                                                  \